@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "q3area.h"
+
+#define UNLABELED 0xFFFFFFFFU
+/* leaf bounds are snapped outward to integers, so a model this close to a leaf is touching it */
+#define TOUCH_EPS 1
+
+struct pair {
+	u32 a, b;
+	i32 model;
+};
+
+struct pair_list {
+	size_t n, cap;
+	struct pair* p;
+};
+
+static void push_pair(struct pair_list* l, u32 a, u32 b, i32 model) {
+	if(l->n == l->cap) {
+		l->cap = l->cap? l->cap * 2 : 64;
+		l->p = realloc(l->p, l->cap * sizeof(struct pair));
+	}
+	l->p[l->n++] = (struct pair) { a < b? a : b, a < b? b : a, model };
+}
+
+static int cmp_pair(const void* x, const void* y) {
+	const struct pair* p = x;
+	const struct pair* q = y;
+	if(p->a != q->a)
+		return p->a < q->a? -1 : 1;
+	if(p->b != q->b)
+		return p->b < q->b? -1 : 1;
+	return (p->model > q->model) - (p->model < q->model);
+}
+
+static bool boxes_touch(ivec3 amin, ivec3 amax, ivec3 bmin, ivec3 bmax) {
+	return amin.x <= bmax.x + TOUCH_EPS && bmin.x <= amax.x + TOUCH_EPS
+		&& amin.y <= bmax.y + TOUCH_EPS && bmin.y <= amax.y + TOUCH_EPS
+		&& amin.z <= bmax.z + TOUCH_EPS && bmin.z <= amax.z + TOUCH_EPS;
+}
+
+/* copies the next quoted token into out, returns NULL when there is none before the closing brace */
+static const char* next_token(const char* p, char* out, size_t len) {
+	while(*p && *p != '"' && *p != '}')
+		p++;
+	if(*p != '"')
+		return NULL;
+	p++;
+	size_t i = 0;
+	while(*p && *p != '"') {
+		if(i + 1 < len)
+			out[i++] = *p;
+		p++;
+	}
+	out[i] = '\0';
+	return *p? p + 1 : NULL;
+}
+
+/* areas of every leaf touching a brush model, we need exactly two for a portal */
+static bool model_areas(const struct q3bsp* bsp, const struct q3model* model, u32 areas[2]) {
+	ivec3 mins = { (i32)model->mins.x, (i32)model->mins.y, (i32)model->mins.z };
+	ivec3 maxs = { (i32)model->maxs.x + 1, (i32)model->maxs.y + 1, (i32)model->maxs.z + 1 };
+	size_t n = 0;
+	for(size_t i = 0; i < bsp->n_leafs; i++) {
+		const struct q3leaf* leaf = bsp->leafs + i;
+		if((i32)leaf->area < 0 || !boxes_touch(mins, maxs, leaf->bb_mins, leaf->bb_maxs))
+			continue;
+		if(n > 0 && areas[0] == leaf->area)
+			continue;
+		if(n > 1 && areas[1] == leaf->area)
+			continue;
+		if(n == 2)
+			return false;
+		areas[n++] = leaf->area;
+	}
+	return n == 2;
+}
+
+/* func_areaportal is the explicit form, Q3 doors gate whatever portal their model spans */
+static void entity_pairs(const struct q3bsp* bsp, struct pair_list* out) {
+	char key[64], value[256], classname[256], model[256];
+	for(const char* p = bsp->entities; (p = strchr(p, '{'));) {
+		classname[0] = model[0] = '\0';
+		const char* q = ++p;
+		while((q = next_token(q, key, sizeof(key))) && (q = next_token(q, value, sizeof(value)))) {
+			if(!strcmp(key, "classname"))
+				snprintf(classname, sizeof(classname), "%s", value);
+			else if(!strcmp(key, "model"))
+				snprintf(model, sizeof(model), "%s", value);
+		}
+		if(strcmp(classname, "func_areaportal") && strcmp(classname, "func_door"))
+			continue;
+		if(model[0] != '*')
+			continue;
+
+		i32 idx = atoi(model + 1);
+		u32 areas[2];
+		if(idx > 0 && (size_t)idx < bsp->n_models && model_areas(bsp, bsp->models + idx, areas))
+			push_pair(out, areas[0], areas[1], idx);
+	}
+}
+
+/* labels everything reachable from start through open portals, threading it into one list */
+static void flood(struct q3area_graph* graph, u32 start) {
+	u32 n = 0, last = start;
+	graph->label[start] = start;
+	graph->next[start] = start;
+	graph->size[start] = 1;
+	graph->stack[n++] = start;
+
+	while(n) {
+		u32 area = graph->stack[--n];
+		for(u32 i = graph->adj_start[area]; i < graph->adj_start[area + 1]; i++) {
+			const struct q3area_portal* portal = graph->portals + graph->adj[i];
+			if(portal->open <= 0)
+				continue;
+			u32 other = portal->areas[0] == area? portal->areas[1] : portal->areas[0];
+			if(graph->label[other] != UNLABELED)
+				continue;
+			graph->label[other] = start;
+			graph->next[other] = graph->next[last];
+			graph->next[last] = other;
+			last = other;
+			graph->size[start]++;
+			graph->stack[n++] = other;
+		}
+	}
+}
+
+struct q3area_graph* q3area_build(const struct q3bsp* bsp) {
+	struct q3area_graph* graph = calloc(1, sizeof(struct q3area_graph));
+
+	for(size_t i = 0; i < bsp->n_leafs; i++)
+		if((i32)bsp->leafs[i].area >= 0 && bsp->leafs[i].area >= graph->n_areas)
+			graph->n_areas = bsp->leafs[i].area + 1;
+
+	/* q3map floods areas through every portal but areaportals, so those are the only connections */
+	struct pair_list pairs = { 0 };
+	entity_pairs(bsp, &pairs);
+	qsort(pairs.p, pairs.n, sizeof(struct pair), cmp_pair);
+
+	graph->portals = malloc(sizeof(struct q3area_portal) * (pairs.n? pairs.n : 1));
+	graph->n_models = bsp->n_models;
+	graph->model_portal = malloc(sizeof(i32) * (bsp->n_models? bsp->n_models : 1));
+	for(size_t i = 0; i < bsp->n_models; i++)
+		graph->model_portal[i] = -1;
+
+	for(size_t i = 0; i < pairs.n; i++) {
+		const struct pair* p = pairs.p + i;
+		if(graph->n_portals) {
+			struct q3area_portal* last = graph->portals + graph->n_portals - 1;
+			if(last->areas[0] == p->a && last->areas[1] == p->b) {
+				graph->model_portal[p->model] = graph->n_portals - 1;
+				continue;
+			}
+		}
+		/* doors start closed, same as the game */
+		graph->portals[graph->n_portals] = (struct q3area_portal) {
+			.areas = { p->a, p->b },
+			.open = 0,
+			.model = p->model,
+		};
+		graph->model_portal[p->model] = graph->n_portals;
+		graph->n_portals++;
+	}
+	free(pairs.p);
+
+	/* CSR adjacency, counting then filling */
+	graph->adj_start = calloc(graph->n_areas + 1, sizeof(u32));
+	graph->adj = malloc(sizeof(u32) * (graph->n_portals * 2 + 1));
+	for(size_t i = 0; i < graph->n_portals; i++) {
+		graph->adj_start[graph->portals[i].areas[0] + 1]++;
+		graph->adj_start[graph->portals[i].areas[1] + 1]++;
+	}
+	for(u32 i = 0; i < graph->n_areas; i++)
+		graph->adj_start[i + 1] += graph->adj_start[i];
+
+	u32* fill = malloc(sizeof(u32) * (graph->n_areas + 1));
+	memcpy(fill, graph->adj_start, sizeof(u32) * (graph->n_areas + 1));
+	for(size_t i = 0; i < graph->n_portals; i++) {
+		graph->adj[fill[graph->portals[i].areas[0]]++] = i;
+		graph->adj[fill[graph->portals[i].areas[1]]++] = i;
+	}
+	free(fill);
+
+	size_t n = graph->n_areas? graph->n_areas : 1;
+	graph->label = malloc(sizeof(u32) * n);
+	graph->next = malloc(sizeof(u32) * n);
+	graph->size = malloc(sizeof(u32) * n);
+	graph->stack = malloc(sizeof(u32) * n);
+	graph->pending = malloc(sizeof(u32) * n);
+	memset(graph->label, 0xFF, sizeof(u32) * n);
+	for(u32 i = 0; i < graph->n_areas; i++)
+		if(graph->label[i] == UNLABELED)
+			flood(graph, i);
+
+	return graph;
+}
+
+void q3area_free(struct q3area_graph* graph) {
+	if(!graph)
+		return;
+	free(graph->portals);
+	free(graph->adj_start);
+	free(graph->adj);
+	free(graph->model_portal);
+	free(graph->label);
+	free(graph->next);
+	free(graph->size);
+	free(graph->stack);
+	free(graph->pending);
+	free(graph);
+}
+
+/* opening can only merge, so relabel the smaller side and splice the two lists */
+static void merge(struct q3area_graph* graph, u32 a, u32 b) {
+	u32 la = graph->label[a], lb = graph->label[b];
+	if(la == lb)
+		return;
+	if(graph->size[la] < graph->size[lb]) {
+		u32 t = la; la = lb; lb = t;
+		t = a; a = b; b = t;
+	}
+
+	u32 i = b;
+	do {
+		graph->label[i] = la;
+		i = graph->next[i];
+	} while(i != b);
+
+	u32 t = graph->next[a];
+	graph->next[a] = graph->next[b];
+	graph->next[b] = t;
+	graph->size[la] += graph->size[lb];
+}
+
+/* closing can only split the component the portal was in, so only that gets flooded again */
+static void split(struct q3area_graph* graph, u32 a) {
+	u32 n = 0, i = a;
+	do {
+		graph->pending[n++] = i;
+		i = graph->next[i];
+	} while(i != a);
+
+	for(u32 j = 0; j < n; j++)
+		graph->label[graph->pending[j]] = UNLABELED;
+	for(u32 j = 0; j < n; j++)
+		if(graph->label[graph->pending[j]] == UNLABELED)
+			flood(graph, graph->pending[j]);
+}
+
+bool q3area_adjust_portal(struct q3area_graph* graph, size_t idx, bool open) {
+	struct q3area_portal* portal = graph->portals + idx;
+	/* the engine drops an error on a negative count, here the count stays at 0 and the caller hears about it */
+	if(!open && portal->open <= 0)
+		return false;
+	bool was_open = portal->open > 0;
+	portal->open += open? 1 : -1;
+	bool is_open = portal->open > 0;
+
+	if(!was_open && is_open)
+		merge(graph, portal->areas[0], portal->areas[1]);
+	else if(was_open && !is_open)
+		split(graph, portal->areas[0]);
+	return true;
+}
+
+bool q3area_adjust_model(struct q3area_graph* graph, i32 model, bool open) {
+	if(model < 0 || (size_t)model >= graph->n_models || graph->model_portal[model] < 0)
+		return false;
+	return q3area_adjust_portal(graph, graph->model_portal[model], open);
+}
@@ -0,0 +1,64 @@
+#ifndef Q3_AREA_H_
+#define Q3_AREA_H_
+
+#include <stdbool.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* an areaportal between two areas, found from the func_areaportal or door model spanning it */
+struct q3area_portal {
+	u32 areas[2];
+	/* passable while > 0 */
+	i32 open;
+	/* controlling brush model */
+	i32 model;
+};
+
+struct q3area_graph {
+	u32 n_areas;
+	size_t n_portals;
+	struct q3area_portal* portals;
+
+	/* CSR adjacency, portal indices of area i are adj[adj_start[i]..adj_start[i+1]) */
+	u32* adj_start;
+	u32* adj;
+
+	/* model index -> portal index or -1 */
+	size_t n_models;
+	i32* model_portal;
+
+	/* connected component of every area as the index of one of its members */
+	u32* label;
+	/* circular list threading each component, and component sizes indexed by label */
+	u32* next;
+	u32* size;
+	/* flood stack, and the members of a component being split */
+	u32* stack;
+	u32* pending;
+};
+
+struct q3area_graph* q3area_build(const struct q3bsp* bsp);
+void q3area_free(struct q3area_graph* graph);
+
+/*
+	open/close calls nest the way trap_AdjustAreaPortalState does, two doors on one portal need two closes.
+	Returns false and changes nothing when closing a portal that isn't open.
+*/
+bool q3area_adjust_portal(struct q3area_graph* graph, size_t portal, bool open);
+/* convenience for the door entity owning a brush model, returns false if the model has no portal or the close was unmatched */
+bool q3area_adjust_model(struct q3area_graph* graph, i32 model, bool open);
+
+static inline bool q3area_connected(const struct q3area_graph* graph, i32 a, i32 b) {
+	if(a < 0 || b < 0 || (u32)a >= graph->n_areas || (u32)b >= graph->n_areas)
+		return false;
+	return graph->label[a] == graph->label[b];
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
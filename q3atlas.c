@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "q3atlas.h"
+#include "q3parallel.h"
+
+struct copy_job {
+	const struct q3bsp* bsp;
+	struct q3atlas* atlas;
+	size_t per_page;
+};
+
+/* one page per task, the blocks on it are copied a row at a time */
+static void copy_page(void* user, size_t page) {
+	const struct copy_job* job = user;
+	struct q3atlas* atlas = job->atlas;
+	const size_t stride = (size_t)atlas->width * 3;
+	u8* out = calloc((size_t)atlas->height * stride, 1);
+
+	size_t first = page * job->per_page;
+	size_t last = first + job->per_page;
+	if(last > job->bsp->n_lightmaps)
+		last = job->bsp->n_lightmaps;
+
+	for(size_t i = first; i < last; i++) {
+		const struct q3atlas_slot* slot = atlas->slots + i;
+		const struct q3lightmap* lm = job->bsp->lightmaps + i;
+		for(u32 y = 0; y < Q3LIGHTMAP_SIZE; y++)
+			memcpy(out + (slot->y + y) * stride + slot->x * 3, lm->map[y], Q3LIGHTMAP_SIZE * 3);
+	}
+
+	atlas->pages[page] = out;
+}
+
+struct q3atlas* q3atlas_build(const struct q3bsp* bsp, u32 width, u32 height) {
+	struct q3atlas* atlas = calloc(1, sizeof(struct q3atlas));
+	u32 cols = width / Q3LIGHTMAP_SIZE, rows = height / Q3LIGHTMAP_SIZE;
+	if(!cols)
+		cols = 1;
+	if(!rows)
+		rows = 1;
+	atlas->width = cols * Q3LIGHTMAP_SIZE;
+	atlas->height = rows * Q3LIGHTMAP_SIZE;
+
+	/* every block is the same size, so packing is just filling a grid page by page */
+	size_t per_page = (size_t)cols * rows;
+	atlas->n_slots = bsp->n_lightmaps;
+	atlas->slots = malloc(sizeof(struct q3atlas_slot) * (bsp->n_lightmaps? bsp->n_lightmaps : 1));
+	for(size_t i = 0; i < bsp->n_lightmaps; i++) {
+		size_t cell = i % per_page;
+		atlas->slots[i] = (struct q3atlas_slot) {
+			.page = i / per_page,
+			.x = (cell % cols) * Q3LIGHTMAP_SIZE,
+			.y = (cell / cols) * Q3LIGHTMAP_SIZE,
+		};
+	}
+
+	atlas->n_pages = (bsp->n_lightmaps + per_page - 1) / per_page;
+	atlas->pages = calloc(atlas->n_pages? atlas->n_pages : 1, sizeof(u8*));
+
+	struct copy_job job = { bsp, atlas, per_page };
+	q3_parallel_for(atlas->n_pages, copy_page, &job);
+	return atlas;
+}
+
+void q3atlas_free(struct q3atlas* atlas) {
+	if(!atlas)
+		return;
+	for(size_t i = 0; i < atlas->n_pages; i++)
+		free(atlas->pages[i]);
+	free(atlas->pages);
+	free(atlas->slots);
+	free(atlas);
+}
+
+size_t q3atlas_remap_vertices(const struct q3atlas* atlas, struct q3bsp* bsp) {
+	/* scale and offset per lightmap, entry 0 is the identity for vertices without one */
+	float (*xf)[4] = malloc(sizeof(float[4]) * (atlas->n_slots + 1));
+	xf[0][0] = xf[0][1] = 1.0f;
+	xf[0][2] = xf[0][3] = 0.0f;
+	for(size_t i = 0; i < atlas->n_slots; i++) {
+		xf[i + 1][0] = (float)Q3LIGHTMAP_SIZE / atlas->width;
+		xf[i + 1][1] = (float)Q3LIGHTMAP_SIZE / atlas->height;
+		xf[i + 1][2] = (float)atlas->slots[i].x / atlas->width;
+		xf[i + 1][3] = (float)atlas->slots[i].y / atlas->height;
+	}
+
+	/* which transform each vertex takes, faces own disjoint vertex ranges */
+	u32* which = calloc(bsp->n_vertices? bsp->n_vertices : 1, sizeof(u32));
+	for(size_t i = 0; i < bsp->n_faces; i++) {
+		const struct q3face* face = bsp->faces + i;
+		if(face->lightmap_idx < 0 || (size_t)face->lightmap_idx >= atlas->n_slots)
+			continue;
+		if(face->first_vertex_idx < 0 || (size_t)face->first_vertex_idx + face->n_vertices > bsp->n_vertices)
+			continue;
+		for(u32 j = 0; j < face->n_vertices; j++)
+			which[face->first_vertex_idx + j] = face->lightmap_idx + 1;
+	}
+
+	size_t count = 0, i = 0;
+	struct q3vertex* v = bsp->vertices;
+#ifdef __SSE2__
+	/* two vertices per register, coords*scale + offset with no branches */
+	const __m128 zero = _mm_setzero_ps();
+	for(; i + 2 <= bsp->n_vertices; i += 2) {
+		const float* a = xf[which[i]];
+		const float* b = xf[which[i + 1]];
+		__m128 c = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64*)&v[i].lightmap_coords), (const __m64*)&v[i + 1].lightmap_coords);
+		__m128 s = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64*)a), (const __m64*)b);
+		__m128 o = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64*)(a + 2)), (const __m64*)(b + 2));
+		c = _mm_add_ps(_mm_mul_ps(c, s), o);
+		_mm_storel_pi((__m64*)&v[i].lightmap_coords, c);
+		_mm_storeh_pi((__m64*)&v[i + 1].lightmap_coords, c);
+		count += (which[i] != 0) + (which[i + 1] != 0);
+	}
+#endif
+	for(; i < bsp->n_vertices; i++) {
+		const float* t = xf[which[i]];
+		v[i].lightmap_coords.s = v[i].lightmap_coords.s * t[0] + t[2];
+		v[i].lightmap_coords.t = v[i].lightmap_coords.t * t[1] + t[3];
+		count += which[i] != 0;
+	}
+
+	free(which);
+	free(xf);
+	return count;
+}
+
+u8* q3atlas_encode_page(const struct q3atlas* atlas, size_t page, enum q3atlas_format format, size_t* len) {
+	if(page >= atlas->n_pages)
+		return NULL;
+
+	char header[32] = "";
+	int header_len = 0;
+	if(format == Q3ATLAS_PPM)
+		header_len = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", atlas->width, atlas->height);
+
+	size_t body = (size_t)atlas->width * atlas->height * 3;
+	u8* out = malloc(header_len + body);
+	memcpy(out, header, header_len);
+	memcpy(out + header_len, atlas->pages[page], body);
+	*len = header_len + body;
+	return out;
+}
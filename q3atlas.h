@@ -0,0 +1,52 @@
+#ifndef Q3_ATLAS_H_
+#define Q3_ATLAS_H_
+
+#include <stdbool.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define Q3LIGHTMAP_SIZE 128
+
+enum q3atlas_format {
+	Q3ATLAS_RAW,
+	Q3ATLAS_PPM,
+};
+
+/* where a lightmap ended up */
+struct q3atlas_slot {
+	u32 page;
+	/* texel offset of the block's top left corner */
+	u32 x, y;
+};
+
+struct q3atlas {
+	/* page dimensions in texels, whole multiples of Q3LIGHTMAP_SIZE */
+	u32 width, height;
+	size_t n_pages;
+	/* tightly packed RGB, width*height*3 bytes per page */
+	u8** pages;
+	size_t n_slots;
+	struct q3atlas_slot* slots;
+};
+
+/* width and height get rounded down to whole lightmaps, anything smaller than one becomes one */
+struct q3atlas* q3atlas_build(const struct q3bsp* bsp, u32 width, u32 height);
+void q3atlas_free(struct q3atlas* atlas);
+
+/*
+	Moves every vertex's lightmap_coords from its face's block into atlas space in place.
+	Vertices of faces without a lightmap are left alone. Returns the number rewritten.
+*/
+size_t q3atlas_remap_vertices(const struct q3atlas* atlas, struct q3bsp* bsp);
+
+/* the page as a standalone buffer the caller frees, PPM adds the P6 header */
+u8* q3atlas_encode_page(const struct q3atlas* atlas, size_t page, enum q3atlas_format format, size_t* len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,173 @@
+#include <string.h>
+
+#include "q3batch.h"
+#include "q3patch.h"
+
+/* lightmap_idx goes down to -4 for the special cases (vertex lit and so on) */
+#define LIGHTMAP_BIAS 8
+
+static u64 face_key(const struct q3face* face) {
+	return ((u64)((u32)(face->texture_idx + 1) & 0xFFFFFF) << 28)
+		| ((u64)((u32)(face->lightmap_idx + LIGHTMAP_BIAS) & 0xFFFFFF) << 4)
+		| ((u64)face->type & 0xF);
+}
+
+void q3batch_sort_faces(const struct q3bsp* bsp, u32* faces, size_t n) {
+	if(!n)
+		return;
+	u64* keys = malloc(sizeof(u64) * n * 2);
+	u32* tmp = malloc(sizeof(u32) * n);
+	u64* tmp_keys = keys + n;
+	for(size_t i = 0; i < n; i++)
+		keys[i] = face_key(bsp->faces + faces[i]);
+
+	/* 8 bits a pass over the 52 bit key, passes where every key has the same digit are skipped */
+	for(u32 shift = 0; shift < 56; shift += 8) {
+		size_t count[257] = { 0 };
+		for(size_t i = 0; i < n; i++)
+			count[((keys[i] >> shift) & 0xFF) + 1]++;
+		if(count[((keys[0] >> shift) & 0xFF) + 1] == n)
+			continue;
+		for(int d = 0; d < 256; d++)
+			count[d + 1] += count[d];
+		for(size_t i = 0; i < n; i++) {
+			size_t at = count[(keys[i] >> shift) & 0xFF]++;
+			tmp[at] = faces[i];
+			tmp_keys[at] = keys[i];
+		}
+		memcpy(faces, tmp, sizeof(u32) * n);
+		memcpy(keys, tmp_keys, sizeof(u64) * n);
+	}
+
+	free(tmp);
+	free(keys);
+}
+
+struct q3batch_set* q3batch_build(const struct q3bsp* bsp, u32 patch_level) {
+	struct q3batch_set* set = calloc(1, sizeof(struct q3batch_set));
+
+	/* patches are flattened once up front, then spliced in wherever their face sorts to */
+	struct q3patch_set* patches = NULL;
+	struct q3vertex* patch_vertices = NULL;
+	u32* patch_indices = NULL;
+	size_t n_patch_vertices = 0, n_patch_indices = 0;
+	i32* face_patch = malloc(sizeof(i32) * (bsp->n_faces? bsp->n_faces : 1));
+	u32* patch_first_index = NULL;
+	for(size_t i = 0; i < bsp->n_faces; i++)
+		face_patch[i] = -1;
+
+	if(patch_level) {
+		if(patch_level > Q3PATCH_MAX_LEVEL)
+			patch_level = Q3PATCH_MAX_LEVEL;
+		patches = q3patch_init(bsp);
+		u32* levels = malloc(sizeof(u32) * (patches->n_patches? patches->n_patches : 1));
+		for(size_t i = 0; i < patches->n_patches; i++)
+			levels[i] = patch_level;
+		q3patch_assemble(patches, levels, &patch_vertices, &n_patch_vertices, &patch_indices, &n_patch_indices);
+		free(levels);
+
+		/* where each patch's indices landed, in the same order assemble walks them */
+		patch_first_index = malloc(sizeof(u32) * (patches->n_patches? patches->n_patches : 1));
+		size_t at = 0;
+		for(size_t i = 0; i < patches->n_patches; i++) {
+			const struct q3patch* p = patches->patches + i;
+			if(!p->pieces_x)
+				continue;
+			face_patch[p->face] = i;
+			patch_first_index[i] = at;
+			at += p->lods[patch_level].n_indices;
+		}
+	}
+
+	u32* order = malloc(sizeof(u32) * (bsp->n_faces? bsp->n_faces : 1));
+	size_t n = 0, n_indices = 0;
+	for(size_t i = 0; i < bsp->n_faces; i++) {
+		const struct q3face* face = bsp->faces + i;
+		if((face->type == POLYGON || face->type == MESH) && face->n_mesh_vertices)
+			n_indices += face->n_mesh_vertices;
+		else if(face->type == PATCH && face_patch[i] >= 0)
+			n_indices += patches->patches[face_patch[i]].lods[patch_level].n_indices;
+		else
+			continue;
+		order[n++] = i;
+	}
+	set->n_faces = n;
+	q3batch_sort_faces(bsp, order, n);
+
+	/* one shared vertex buffer, patch indices are shifted past the map's own vertices */
+	set->n_vertices = bsp->n_vertices + n_patch_vertices;
+	set->vertices = malloc(sizeof(struct q3vertex) * (set->n_vertices? set->n_vertices : 1));
+	memcpy(set->vertices, bsp->vertices, sizeof(struct q3vertex) * bsp->n_vertices);
+	if(n_patch_vertices)
+		memcpy(set->vertices + bsp->n_vertices, patch_vertices, sizeof(struct q3vertex) * n_patch_vertices);
+
+	set->indices = malloc(sizeof(u32) * (n_indices? n_indices : 1));
+	set->batches = malloc(sizeof(struct q3batch) * (n? n : 1));
+	u64 last_key = ~(u64)0;
+	for(size_t i = 0; i < n; i++) {
+		const struct q3face* face = bsp->faces + order[i];
+		u64 key = face_key(face);
+		if(key != last_key) {
+			set->batches[set->n_batches++] = (struct q3batch) {
+				.texture_idx = face->texture_idx,
+				.lightmap_idx = face->lightmap_idx,
+				.type = face->type,
+				.first_index = set->n_indices,
+			};
+			last_key = key;
+		}
+
+		u32* out = set->indices + set->n_indices;
+		size_t count;
+		if(face->type == PATCH) {
+			i32 p = face_patch[order[i]];
+			count = patches->patches[p].lods[patch_level].n_indices;
+			for(size_t k = 0; k < count; k++)
+				out[k] = patch_indices[patch_first_index[p] + k] + bsp->n_vertices;
+		} else {
+			count = face->n_mesh_vertices;
+			const struct q3mesh_vert* mv = bsp->mesh_verts + face->first_mesh_vertex_idx;
+			for(size_t k = 0; k < count; k++)
+				out[k] = face->first_vertex_idx + mv[k].idx;
+		}
+		set->n_indices += count;
+		set->batches[set->n_batches - 1].n_indices += count;
+	}
+
+	free(order);
+	free(face_patch);
+	free(patch_first_index);
+	free(patch_vertices);
+	free(patch_indices);
+	q3patch_free(patches);
+	return set;
+}
+
+void q3batch_free(struct q3batch_set* set) {
+	if(!set)
+		return;
+	free(set->vertices);
+	free(set->indices);
+	free(set->batches);
+	free(set);
+}
+
+int q3batch_write(const struct q3batch_set* set, FILE* out) {
+	struct q3batch_file_header header = {
+		.magic = Q3BATCH_MAGIC,
+		.version = Q3BATCH_VERSION,
+		.n_batches = set->n_batches,
+		.n_vertices = set->n_vertices,
+		.n_indices = set->n_indices,
+	};
+
+	if(fwrite(&header, sizeof(header), 1, out) != 1)
+		return EOF;
+	if(set->n_batches && fwrite(set->batches, sizeof(struct q3batch), set->n_batches, out) != set->n_batches)
+		return EOF;
+	if(set->n_vertices && fwrite(set->vertices, sizeof(struct q3vertex), set->n_vertices, out) != set->n_vertices)
+		return EOF;
+	if(set->n_indices && fwrite(set->indices, sizeof(u32), set->n_indices, out) != set->n_indices)
+		return EOF;
+	return 0;
+}
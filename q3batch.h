@@ -0,0 +1,60 @@
+#ifndef Q3_BATCH_H_
+#define Q3_BATCH_H_
+
+#include <stdio.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* "Q3DB" */
+#define Q3BATCH_MAGIC 0x42443351U
+#define Q3BATCH_VERSION 1
+
+/* one draw call worth of faces sharing texture, lightmap and surface type */
+struct q3batch {
+	i32 texture_idx;
+	i32 lightmap_idx;
+	i32 type;
+	u32 first_index;
+	u32 n_indices;
+};
+
+struct q3batch_set {
+	/* the map's vertices, followed by tessellated patch vertices if any */
+	size_t n_vertices;
+	struct q3vertex* vertices;
+	/* indices straight into vertices */
+	size_t n_indices;
+	u32* indices;
+	size_t n_batches;
+	struct q3batch* batches;
+	/* faces that would each have been a draw call on their own */
+	size_t n_faces;
+};
+
+/* on disk, followed by the batches, the vertices, then the indices, all little endian */
+struct q3batch_file_header {
+	u32 magic;
+	u32 version;
+	u32 n_batches;
+	u32 n_vertices;
+	u32 n_indices;
+};
+
+/* patch_level 0 leaves patches out, otherwise they're tessellated at that level and batched too */
+struct q3batch_set* q3batch_build(const struct q3bsp* bsp, u32 patch_level);
+void q3batch_free(struct q3batch_set* set);
+
+/* sorts n face indices by (texture, lightmap, type), LSD radix on the packed key */
+void q3batch_sort_faces(const struct q3bsp* bsp, u32* faces, size_t n);
+
+/* returns 0 on success, like fclose */
+int q3batch_write(const struct q3batch_set* set, FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
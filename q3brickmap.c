@@ -0,0 +1,181 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "q3brickmap.h"
+#include "q3parallel.h"
+
+#define BRICK_SAMPLES (Q3BRICKMAP_SIZE * Q3BRICKMAP_SIZE * Q3BRICKMAP_SIZE)
+/* hulls gathered per brick before giving up and evaluating every sample through the tree */
+#define GATHER_CAP 1024
+
+static inline float half_diagonal(const struct q3brickmap* map) {
+	return map->cell_size * 0.8660254f;
+}
+
+static inline vec3 cell_corner(const struct q3brickmap* map, size_t cell) {
+	size_t x = cell % map->dims[0], y = cell / map->dims[0] % map->dims[1], z = cell / map->dims[0] / map->dims[1];
+	return (vec3) {
+		map->origin.x + x * map->cell_size,
+		map->origin.y + y * map->cell_size,
+		map->origin.z + z * map->cell_size,
+	};
+}
+
+struct coarse_job {
+	const struct q3sdf* sdf;
+	struct q3brickmap* map;
+};
+
+/* one z slab of cells */
+static void bake_coarse(void* user, size_t z) {
+	const struct coarse_job* job = user;
+	struct q3brickmap* map = job->map;
+	const float half = half_diagonal(map), reach = 4.0f * map->cell_size;
+	size_t slab = (size_t)map->dims[0] * map->dims[1];
+	for(size_t i = z * slab; i < (z + 1) * slab; i++) {
+		vec3 c = cell_corner(map, i);
+		c = (vec3) { c.x + map->cell_size * 0.5f, c.y + map->cell_size * 0.5f, c.z + map->cell_size * 0.5f };
+		float d = q3sdf_eval(job->sdf, c, reach, NULL);
+		/* anything in the cell is within half a diagonal of the centre, so its distance is too */
+		map->coarse[i] = d >= 0.0f? d - half : d + half;
+		map->cells[i] = fabsf(d) < half + map->range? 0 : Q3BRICKMAP_NONE;
+	}
+}
+
+struct brick_job {
+	const struct q3sdf* sdf;
+	struct q3brickmap* map;
+	const u32* brick_cell;
+};
+
+static void bake_brick(void* user, size_t b) {
+	const struct brick_job* job = user;
+	struct q3brickmap* map = job->map;
+	const float range = map->range;
+	vec3 corner = cell_corner(map, job->brick_cell[b]);
+	vec3 centre = { corner.x + map->cell_size * 0.5f, corner.y + map->cell_size * 0.5f, corner.z + map->cell_size * 0.5f };
+
+	/* only hulls that reach some sample within range matter, so a short list does for the whole brick */
+	u32* hulls = malloc(sizeof(u32) * GATHER_CAP);
+	size_t n_hulls = q3sdf_gather(job->sdf, centre, half_diagonal(map) + range, hulls, GATHER_CAP);
+
+	u8* out = map->samples + b * BRICK_SAMPLES;
+	for(int z = 0; z < Q3BRICKMAP_SIZE; z++) {
+		for(int y = 0; y < Q3BRICKMAP_SIZE; y++) {
+			for(int x = 0; x < Q3BRICKMAP_SIZE; x++) {
+				vec3 p = { corner.x + x * map->voxel_size, corner.y + y * map->voxel_size, corner.z + z * map->voxel_size };
+				float d = range;
+				if(n_hulls > GATHER_CAP) {
+					d = q3sdf_eval(job->sdf, p, range, NULL);
+				} else {
+					for(size_t h = 0; h < n_hulls; h++)
+						d = fminf(d, q3sdf_hull(job->sdf, hulls[h], p));
+				}
+				d = fmaxf(d, -range);
+				*out++ = (u8)lrintf((d / range * 0.5f + 0.5f) * 255.0f);
+			}
+		}
+	}
+	free(hulls);
+}
+
+struct q3brickmap* q3brickmap_bake(const struct q3sdf* sdf, float voxel_size) {
+	const struct q3bsp* bsp = sdf->bsp;
+	struct q3brickmap* map = calloc(1, sizeof(struct q3brickmap));
+	map->voxel_size = voxel_size > 0.0f? voxel_size : 8.0f;
+	map->cell_size = map->voxel_size * (Q3BRICKMAP_SIZE - 1);
+	/* samples further than this are clamped, so steps near surfaces stay short but precise */
+	map->range = map->voxel_size * 2.0f;
+
+	/* the world model's bounds and a cell of air all round */
+	vec3 mins = bsp->n_models? bsp->models[0].mins : (vec3) { 0.0f, 0.0f, 0.0f };
+	vec3 maxs = bsp->n_models? bsp->models[0].maxs : (vec3) { 0.0f, 0.0f, 0.0f };
+	map->origin = (vec3) { mins.x - map->cell_size, mins.y - map->cell_size, mins.z - map->cell_size };
+	for(int k = 0; k < 3; k++) {
+		map->dims[k] = (u32)ceilf(((&maxs.x)[k] - (&mins.x)[k]) / map->cell_size) + 2;
+	}
+	size_t n_cells = (size_t)map->dims[0] * map->dims[1] * map->dims[2];
+	map->cells = malloc(sizeof(u32) * n_cells);
+	map->coarse = malloc(sizeof(float) * n_cells);
+
+	struct coarse_job coarse = { sdf, map };
+	q3_parallel_for(map->dims[2], bake_coarse, &coarse);
+
+	u32* brick_cell = malloc(sizeof(u32) * n_cells);
+	for(size_t i = 0; i < n_cells; i++) {
+		if(map->cells[i] == Q3BRICKMAP_NONE)
+			continue;
+		brick_cell[map->n_bricks] = i;
+		map->cells[i] = map->n_bricks++;
+	}
+	map->samples = malloc(BRICK_SAMPLES * (map->n_bricks? map->n_bricks : 1));
+
+	struct brick_job bricks = { sdf, map, brick_cell };
+	q3_parallel_for(map->n_bricks, bake_brick, &bricks);
+	free(brick_cell);
+	return map;
+}
+
+void q3brickmap_free(struct q3brickmap* map) {
+	if(!map)
+		return;
+	free(map->cells);
+	free(map->coarse);
+	free(map->samples);
+	free(map);
+}
+
+size_t q3brickmap_bytes(const struct q3brickmap* map) {
+	size_t n_cells = (size_t)map->dims[0] * map->dims[1] * map->dims[2];
+	return n_cells * (sizeof(u32) + sizeof(float)) + map->n_bricks * BRICK_SAMPLES;
+}
+
+float q3brickmap_sample(const struct q3brickmap* map, vec3 p) {
+	float f[3] = {
+		(p.x - map->origin.x) / map->cell_size,
+		(p.y - map->origin.y) / map->cell_size,
+		(p.z - map->origin.z) / map->cell_size,
+	};
+
+	/* nothing solid within the padding cell either */
+	float out2 = 0.0f;
+	for(int k = 0; k < 3; k++) {
+		float o = fmaxf(-f[k], f[k] - map->dims[k]);
+		if(o > 0.0f)
+			out2 += o * o;
+	}
+	if(out2 > 0.0f)
+		return (sqrtf(out2) + 1.0f) * map->cell_size;
+
+	u32 c[3];
+	for(int k = 0; k < 3; k++) {
+		c[k] = (u32)f[k];
+		if(c[k] >= map->dims[k])
+			c[k] = map->dims[k] - 1;
+	}
+	size_t cell = ((size_t)c[2] * map->dims[1] + c[1]) * map->dims[0] + c[0];
+	u32 brick = map->cells[cell];
+	if(brick == Q3BRICKMAP_NONE)
+		return map->coarse[cell];
+
+	int i[3];
+	float t[3];
+	for(int k = 0; k < 3; k++) {
+		float local = (f[k] - c[k]) * (Q3BRICKMAP_SIZE - 1);
+		i[k] = (int)local;
+		if(i[k] > Q3BRICKMAP_SIZE - 2)
+			i[k] = Q3BRICKMAP_SIZE - 2;
+		t[k] = local - i[k];
+	}
+
+	const u8* s = map->samples + (size_t)brick * BRICK_SAMPLES + (i[2] * Q3BRICKMAP_SIZE + i[1]) * Q3BRICKMAP_SIZE + i[0];
+	const int sy = Q3BRICKMAP_SIZE, sz = Q3BRICKMAP_SIZE * Q3BRICKMAP_SIZE;
+	float x00 = s[0] + (s[1] - s[0]) * t[0];
+	float x10 = s[sy] + (s[sy + 1] - s[sy]) * t[0];
+	float x01 = s[sz] + (s[sz + 1] - s[sz]) * t[0];
+	float x11 = s[sz + sy] + (s[sz + sy + 1] - s[sz + sy]) * t[0];
+	float y0 = x00 + (x10 - x00) * t[1];
+	float y1 = x01 + (x11 - x01) * t[1];
+	float v = y0 + (y1 - y0) * t[2];
+	return (v / 255.0f * 2.0f - 1.0f) * map->range;
+}
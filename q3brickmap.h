@@ -0,0 +1,47 @@
+#ifndef Q3_BRICKMAP_H_
+#define Q3_BRICKMAP_H_
+
+#include "q3bsp.h"
+#include "q3sdf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* samples along a brick's side, neighbouring bricks share a face of them */
+#define Q3BRICKMAP_SIZE 8
+#define Q3BRICKMAP_NONE 0xFFFFFFFFU
+
+/*
+	A coarse grid of cells Q3BRICKMAP_SIZE - 1 voxels wide. Cells near a surface get a brick of
+	distances quantized to 8 bits over [-range, range], everywhere else the cell only keeps a
+	bound on the distance anywhere inside it, which is still safe to step by.
+*/
+struct q3brickmap {
+	vec3 origin;
+	float voxel_size;
+	float cell_size;
+	u32 dims[3];
+	float range;
+
+	/* per cell, its brick or Q3BRICKMAP_NONE, and the bound for cells without one */
+	u32* cells;
+	float* coarse;
+
+	size_t n_bricks;
+	/* Q3BRICKMAP_SIZE^3 per brick, x fastest */
+	u8* samples;
+};
+
+/* evaluates every cell centre, then fills the bricks near surfaces, both in parallel */
+struct q3brickmap* q3brickmap_bake(const struct q3sdf* sdf, float voxel_size);
+void q3brickmap_free(struct q3brickmap* map);
+size_t q3brickmap_bytes(const struct q3brickmap* map);
+
+/* trilinear inside bricks and the cell's bound elsewhere, outside the grid it's the distance to it */
+float q3brickmap_sample(const struct q3brickmap* map, vec3 p);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -24,10 +24,10 @@ static void q3bsp_load_lumps(struct q3bsp_header* header,  struct q3bsp* bsp) {
 	bsp->leafs = (struct q3leaf*)(struct leaf*)(bsp->file_data + header->leafs.offset);
 	 
 	bsp->n_leaf_faces = header->leaf_faces.len / sizeof(struct q3leaf_faces);
-	bsp->faces = (struct q3face*)(bsp->file_data + header->faces.offset);
+	bsp->leaf_faces = (struct q3leaf_faces*)(bsp->file_data + header->leaf_faces.offset);
 	 
 	bsp->n_leaf_brushes = header->leaf_brushes.len / sizeof(struct q3leaf_brush);
-	bsp->leaf_brushes = (struct q3leaf_brush*)(bsp->file_data + header->brushes.offset);
+	bsp->leaf_brushes = (struct q3leaf_brush*)(bsp->file_data + header->leaf_brushes.offset);
 	 
 	bsp->n_models = header->models.len / sizeof(struct q3model);
 	bsp->models = (struct q3model*)(bsp->file_data + header->models.offset);
@@ -57,7 +57,8 @@ static void q3bsp_load_lumps(struct q3bsp_header* header,  struct q3bsp* bsp) {
 	bsp->lightvols = (struct q3lightvol*)(bsp->file_data + header->lightvols.offset);
 
 		 
-	bsp->vis_data = (struct q3vis_data*)(bsp->file_data + header->vis_data.offset);
+	/* vis is optional, maps compiled without -vis leave the lump empty */
+	bsp->vis_data = header->vis_data.len? (struct q3vis_data*)(bsp->file_data + header->vis_data.offset) : NULL;
 }
 
 struct q3bsp* q3bsp_load(const char* fname) {
@@ -59,8 +59,9 @@ typedef struct bvec2 {
 	u8 theta;
 } bvec2;
 
+/* 3 bytes on disk, so no u32 view like rgba has */
 typedef union rgb {
-	u32 color;
+	u8 color[3];
 	struct {
 		u8 r;
 		u8 g;
@@ -255,7 +256,7 @@ struct q3bsp {
 	size_t	n_leafs;
 	struct	q3leaf* leafs;
 	size_t	n_leaf_faces;
-	struct	q3leaf_face* leaf_faces;
+	struct	q3leaf_faces* leaf_faces;
 	size_t	n_leaf_brushes;
 	struct	q3leaf_brush* leaf_brushes;
 	size_t	n_models;
@@ -1,10 +1,28 @@
+#include "q3area.h"
+#include "q3atlas.h"
+#include "q3batch.h"
 #include "q3bsp.h"
+#include "q3color.h"
+#include "q3export.h"
+#include "q3halfedge.h"
+#include "q3hull.h"
+#include "q3lightgrid.h"
+#include "q3meshlet.h"
+#include "q3meshopt.h"
+#include "q3patch.h"
+#include "q3patchlod.h"
+#include "q3quant.h"
+#include "q3svo.h"
+#include "q3time.h"
+#include "q3vis.h"
 
 #include "crossline.h"
 
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
 
 #define TOKEN_MATCH(token, in) (strncmp(token, in, sizeof(token)-1) == 0)
 
@@ -114,6 +132,767 @@ void view(struct q3bsp* bsp, const char* input) {
 	}	
 }
 
+static void count_cluster(void* user, i32 cluster) {
+	(void)cluster;
+	(*(size_t*)user)++;
+}
+
+void stats_vis(struct q3bsp* bsp) {
+	if(!bsp->vis_data) {
+		printf("No vis data\n");
+		return;
+	}
+
+	const struct q3vis_data* vis = bsp->vis_data;
+	double t0 = q3_seconds();
+	struct q3vis_rle* rle = q3vis_compress(vis);
+	double t_compress = q3_seconds() - t0;
+
+	size_t raw = sizeof(*vis) + (size_t)vis->n_vectors * vis->sz_vectors;
+	size_t packed = q3vis_rle_size(rle);
+	printf("Clusters: %u (%u bytes per row)\n", vis->n_vectors, vis->sz_vectors);
+	printf("Raw: %zu bytes, RLE: %zu bytes (%.1f%%), compressed in %.3f ms\n",
+		raw, packed, 100.0 * packed / raw, t_compress * 1e3);
+
+	/* every pair, both ways, checking they agree as we go */
+	size_t n = (size_t)vis->n_vectors * vis->n_vectors, mismatches = 0, hits = 0;
+	t0 = q3_seconds();
+	for(i32 a = 0; a < (i32)vis->n_vectors; a++)
+		for(i32 b = 0; b < (i32)vis->n_vectors; b++)
+			hits += q3vis_cluster_visible(vis, a, b);
+	double t_raw = q3_seconds() - t0;
+
+	size_t rle_hits = 0;
+	t0 = q3_seconds();
+	for(i32 a = 0; a < (i32)vis->n_vectors; a++)
+		for(i32 b = 0; b < (i32)vis->n_vectors; b++)
+			rle_hits += q3vis_rle_cluster_visible(rle, a, b);
+	double t_rle = q3_seconds() - t0;
+
+	for(i32 a = 0; a < (i32)vis->n_vectors; a++)
+		for(i32 b = 0; b < (i32)vis->n_vectors; b++)
+			mismatches += q3vis_rle_cluster_visible(rle, a, b) != q3vis_cluster_visible(vis, a, b);
+
+	size_t iterated = 0;
+	t0 = q3_seconds();
+	for(i32 a = 0; a < (i32)vis->n_vectors; a++)
+		q3vis_rle_for_each_visible(rle, a, count_cluster, &iterated);
+	double t_iter = q3_seconds() - t0;
+
+	printf("Point query: raw %.2f ns, RLE %.2f ns\n", t_raw * 1e9 / n, t_rle * 1e9 / n);
+	printf("Row iteration: %.2f us per row, %zu visible pairs\n", t_iter * 1e6 / vis->n_vectors, iterated);
+	if(mismatches || iterated != hits || rle_hits != hits)
+		printf("MISMATCH: %zu point queries, %zu/%zu iterated\n", mismatches, iterated, hits);
+
+	q3vis_rle_free(rle);
+}
+
+void stats_areas(struct q3bsp* bsp) {
+	double t0 = q3_seconds();
+	struct q3area_graph* graph = q3area_build(bsp);
+	double t_build = q3_seconds() - t0;
+
+	size_t components = 0;
+	for(u32 i = 0; i < graph->n_areas; i++)
+		components += graph->label[i] == i;
+
+	printf("Areas: %u, Portals: %zu, built in %.3f ms\n", graph->n_areas, graph->n_portals, t_build * 1e3);
+	printf("Connected groups with doors closed: %zu\n", components);
+
+	if(graph->n_portals) {
+		/* toggle random doors, a portal's open count never goes below zero */
+		const size_t n_ops = 100000;
+		u32 seed = 1;
+		t0 = q3_seconds();
+		for(size_t i = 0; i < n_ops; i++) {
+			seed = seed * 1103515245 + 12345;
+			size_t p = (seed >> 8) % graph->n_portals;
+			q3area_adjust_portal(graph, p, graph->portals[p].open == 0);
+		}
+		double t_ops = q3_seconds() - t0;
+		printf("Open/close: %.1f ns per operation\n", t_ops * 1e9 / n_ops);
+	}
+
+	if(graph->n_areas) {
+		size_t n = 0, connected = 0;
+		t0 = q3_seconds();
+		for(u32 a = 0; a < graph->n_areas; a++)
+			for(u32 b = 0; b < graph->n_areas; b++, n++)
+				connected += q3area_connected(graph, a, b);
+		double t_query = q3_seconds() - t0;
+		printf("Queries: %.2f ns, %zu/%zu pairs connected\n", t_query * 1e9 / n, connected, n);
+	}
+
+	q3area_free(graph);
+}
+
+void stats_lightgrid(struct q3bsp* bsp) {
+	struct q3lightgrid grid;
+	if(!q3lightgrid_init(bsp, &grid)) {
+		printf("Light grid doesn't match the world bounds (%zu light volumes)\n", bsp->n_lightvols);
+		return;
+	}
+
+	size_t valid = 0;
+	for(size_t i = 0; i < grid.n_cells; i++)
+		valid += grid.cells[i].valid != 0.0f;
+	printf("Grid: %d x %d x %d cells of ", grid.bounds[0], grid.bounds[1], grid.bounds[2]);
+	print_vec3(&grid.cell_size);
+	printf(", %zu outside solid\n", valid);
+
+	/* random points across the world model, roughly one frame's worth of entities */
+	const size_t n = 4096, rounds = 64;
+	vec3* points = malloc(sizeof(vec3) * n);
+	struct q3light_sample* scalar = malloc(sizeof(struct q3light_sample) * n);
+	struct q3light_sample* batched = malloc(sizeof(struct q3light_sample) * n);
+	const struct q3model* world = bsp->models;
+	u32 seed = 1;
+	for(size_t i = 0; i < n; i++) {
+		float r[3];
+		for(int k = 0; k < 3; k++) {
+			seed = seed * 1103515245 + 12345;
+			r[k] = (seed >> 8) / (float)(1 << 24);
+		}
+		points[i] = (vec3) {
+			world->mins.x + r[0] * (world->maxs.x - world->mins.x),
+			world->mins.y + r[1] * (world->maxs.y - world->mins.y),
+			world->mins.z + r[2] * (world->maxs.z - world->mins.z),
+		};
+	}
+
+	double t0 = q3_seconds();
+	for(size_t r = 0; r < rounds; r++)
+		for(size_t i = 0; i < n; i++)
+			q3lightgrid_sample(&grid, points[i], scalar + i);
+	double t_scalar = q3_seconds() - t0;
+
+	t0 = q3_seconds();
+	for(size_t r = 0; r < rounds; r++)
+		q3lightgrid_sample_n(&grid, points, n, batched);
+	double t_batched = q3_seconds() - t0;
+
+	float err = 0.0f;
+	for(size_t i = 0; i < n; i++) {
+		const float* a = &scalar[i].ambient.x;
+		const float* b = &batched[i].ambient.x;
+		for(int k = 0; k < 9; k++)
+			err = fmaxf(err, fabsf(a[k] - b[k]));
+	}
+
+	printf("Scalar: %.1f ns per sample, batched: %.1f ns per sample, max difference %g\n",
+		t_scalar * 1e9 / (n * rounds), t_batched * 1e9 / (n * rounds), err);
+
+	free(points);
+	free(scalar);
+	free(batched);
+	q3lightgrid_free(&grid);
+}
+
+void stats_atlas(struct q3bsp* bsp, const char* input) {
+	u32 size = 1024;
+	sscanf(input, "%u", &size);
+
+	double t0 = q3_seconds();
+	struct q3atlas* atlas = q3atlas_build(bsp, size, size);
+	double t_build = q3_seconds() - t0;
+
+	/* remap a copy so the loaded map keeps its original coordinates */
+	struct q3vertex* original = bsp->vertices;
+	bsp->vertices = malloc(sizeof(struct q3vertex) * bsp->n_vertices);
+	memcpy(bsp->vertices, original, sizeof(struct q3vertex) * bsp->n_vertices);
+	t0 = q3_seconds();
+	size_t remapped = q3atlas_remap_vertices(atlas, bsp);
+	double t_remap = q3_seconds() - t0;
+	free(bsp->vertices);
+	bsp->vertices = original;
+
+	printf("%zu lightmaps into %zu pages of %ux%u, packed in %.3f ms\n",
+		bsp->n_lightmaps, atlas->n_pages, atlas->width, atlas->height, t_build * 1e3);
+	printf("%zu/%zu vertices remapped in %.3f ms\n", remapped, bsp->n_vertices, t_remap * 1e3);
+
+	q3atlas_free(atlas);
+}
+
+void stats_color(struct q3bsp* bsp) {
+	if(!bsp->n_lightmaps) {
+		printf("No lightmaps\n");
+		return;
+	}
+
+	struct q3color_params params;
+	q3color_params_init(&params, 2, 1.3f);
+
+	const size_t texels = bsp->n_lightmaps * 128 * 128, rounds = 8;
+	u32* scalar = malloc(texels * sizeof(float[4]));
+	u32* simd = malloc(texels * sizeof(float[4]));
+	const rgb* in = &bsp->lightmaps[0].map[0][0];
+
+	for(int format = Q3COLOR_RGBA8; format <= Q3COLOR_LINEAR_F32; format++) {
+		size_t texel_size = format == Q3COLOR_RGBA8? sizeof(u32) : sizeof(float[4]);
+		double t0 = q3_seconds();
+		for(size_t r = 0; r < rounds; r++)
+			q3color_convert_rgb_scalar(&params, in, texels, scalar, format);
+		double t_scalar = (q3_seconds() - t0) / rounds;
+
+		t0 = q3_seconds();
+		for(size_t r = 0; r < rounds; r++)
+			q3color_convert_rgb(&params, in, texels, simd, format);
+		double t_simd = (q3_seconds() - t0) / rounds;
+
+		t0 = q3_seconds();
+		for(size_t r = 0; r < rounds; r++)
+			q3color_convert_lightmaps(&params, bsp->lightmaps, bsp->n_lightmaps, simd, format);
+		double t_parallel = (q3_seconds() - t0) / rounds;
+
+		printf("%s: scalar %.2f ns/texel, SIMD %.2f ns/texel, SIMD+threads %.2f ns/texel (%.0f Mtexel/s)%s\n",
+			format == Q3COLOR_RGBA8? "RGBA8" : "Linear float",
+			t_scalar * 1e9 / texels, t_simd * 1e9 / texels, t_parallel * 1e9 / texels, texels / t_parallel * 1e-6,
+			memcmp(scalar, simd, texels * texel_size)? " MISMATCH" : "");
+	}
+
+	rgba* a = malloc(sizeof(rgba) * bsp->n_vertices);
+	rgba* b = malloc(sizeof(rgba) * bsp->n_vertices);
+	double t0 = q3_seconds();
+	q3color_convert_vertices(&params, bsp->vertices, bsp->n_vertices, a);
+	double t_vertices = q3_seconds() - t0;
+	for(size_t i = 0; i < bsp->n_vertices; i++) {
+		rgb c = { .r = bsp->vertices[i].color.r, .g = bsp->vertices[i].color.g, .b = bsp->vertices[i].color.b };
+		q3color_convert_rgb_scalar(&params, &c, 1, b + i, Q3COLOR_RGBA8);
+		b[i].a = bsp->vertices[i].color.a;
+	}
+	printf("Vertex colors: %.2f ns/vertex%s\n", t_vertices * 1e9 / bsp->n_vertices,
+		memcmp(a, b, sizeof(rgba) * bsp->n_vertices)? " MISMATCH" : "");
+
+	free(a);
+	free(b);
+	free(scalar);
+	free(simd);
+}
+
+void stats_patches(struct q3bsp* bsp, const char* input) {
+	double t0 = q3_seconds();
+	struct q3patch_set* set = q3patch_init(bsp);
+	double t_init = q3_seconds() - t0;
+
+	size_t links = 0;
+	for(size_t i = 0; i < set->n_patches; i++)
+		for(int e = 0; e < 4; e++)
+			links += set->patches[i].links[e].patch >= 0;
+	printf("Patches: %zu, shared edges: %zu, linked in %.3f ms\n", set->n_patches, links / 2, t_init * 1e3);
+
+	/* levels to try, default to a few powers of two */
+	u32 levels[8] = { 2, 4, 8, 16 };
+	int n_levels = sscanf(input, "%u %u %u %u %u %u %u %u", levels, levels + 1, levels + 2, levels + 3,
+		levels + 4, levels + 5, levels + 6, levels + 7);
+	if(n_levels <= 0)
+		n_levels = 4;
+
+	for(int l = 0; l < n_levels; l++) {
+		size_t v0 = set->n_vertices, i0 = set->n_indices;
+		t0 = q3_seconds();
+		q3patch_tessellate_all(set, levels[l]);
+		double t = q3_seconds() - t0;
+		printf("Level %u: %zu vertices, %zu triangles in %.3f ms (pool now %zu KiB)\n", levels[l],
+			set->n_vertices - v0, (set->n_indices - i0) / 3, t * 1e3,
+			(set->n_vertices * sizeof(struct q3vertex) + set->n_indices * sizeof(u32)) / 1024);
+	}
+
+	q3patch_free(set);
+}
+
+void stats_adaptive(struct q3bsp* bsp) {
+	struct q3patch_set* set = q3patch_init(bsp);
+	struct q3patchlod* lod = q3patchlod_init(set, false);
+
+	printf("Curvature only:\n");
+	const float tolerances[] = { 16.0f, 8.0f, 4.0f, 2.0f, 1.0f, 0.5f, 0.25f };
+	for(size_t i = 0; i < sizeof(tolerances) / sizeof(*tolerances); i++) {
+		double t0 = q3_seconds();
+		size_t redone = q3patchlod_update(lod, tolerances[i], NULL);
+		double t = q3_seconds() - t0;
+		printf("    tolerance %6.2f: %7zu triangles, measured error %.3f, %zu patches redone in %.3f ms\n",
+			tolerances[i], q3patchlod_triangles(lod), q3patchlod_measure_error(lod), redone, t * 1e3);
+	}
+
+	/* walk the eye corner to corner across the world at 1 pixel on a 256 high 90 degree view */
+	const struct q3model* world = bsp->models;
+	struct q3patchlod_view view = { .projection = 128.0f };
+	const size_t steps = 32;
+	size_t triangles = 0, redone = 0;
+	double t_update = 0.0;
+	for(size_t i = 0; i < steps; i++) {
+		float f = (float)i / (steps - 1);
+		view.eye = (vec3) {
+			world->mins.x + f * (world->maxs.x - world->mins.x),
+			world->mins.y + f * (world->maxs.y - world->mins.y),
+			(world->mins.z + world->maxs.z) * 0.5f,
+		};
+		double t0 = q3_seconds();
+		redone += q3patchlod_update(lod, 1.0f, &view);
+		t_update += q3_seconds() - t0;
+		triangles += q3patchlod_triangles(lod);
+	}
+	printf("View dependent (1 px, %zu steps): %.0f triangles, %.1f patches redone, %.3f ms per step\n",
+		steps, (double)triangles / steps, (double)redone / steps, t_update * 1e3 / steps);
+
+	q3patchlod_free(lod);
+	q3patch_free(set);
+}
+
+void stats_batches(struct q3bsp* bsp, const char* input) {
+	u32 patch_level = 4;
+	sscanf(input, "%u", &patch_level);
+
+	double t0 = q3_seconds();
+	struct q3batch_set* set = q3batch_build(bsp, patch_level);
+	double t = q3_seconds() - t0;
+
+	printf("Draw calls: %zu faces -> %zu batches (%.1f faces per batch), built in %.3f ms\n",
+		set->n_faces, set->n_batches, set->n_batches? (double)set->n_faces / set->n_batches : 0.0, t * 1e3);
+	printf("Vertex buffer: %zu vertices (%zu KiB), index buffer: %zu indices (%zu KiB)\n",
+		set->n_vertices, set->n_vertices * sizeof(struct q3vertex) / 1024, set->n_indices, set->n_indices * sizeof(u32) / 1024);
+
+	q3batch_free(set);
+}
+
+void stats_meshopt(struct q3bsp* bsp, const char* input) {
+	u32 patch_level = 4;
+	sscanf(input, "%u", &patch_level);
+
+	struct q3batch_set* set = q3batch_build(bsp, patch_level);
+	size_t vertices = set->n_vertices;
+	float acmr16 = q3meshopt_acmr(set->indices, set->n_indices, set->n_vertices, 16);
+	float acmr32 = q3meshopt_acmr(set->indices, set->n_indices, set->n_vertices, 32);
+
+	double t0 = q3_seconds();
+	q3meshopt_optimize_batches(set);
+	double t = q3_seconds() - t0;
+
+	printf("Vertices: %zu -> %zu (%zu KiB -> %zu KiB)\n", vertices, set->n_vertices,
+		vertices * sizeof(struct q3vertex) / 1024, set->n_vertices * sizeof(struct q3vertex) / 1024);
+	printf("ACMR (16 entry FIFO): %.3f -> %.3f\n", acmr16, q3meshopt_acmr(set->indices, set->n_indices, set->n_vertices, 16));
+	printf("ACMR (32 entry FIFO): %.3f -> %.3f\n", acmr32, q3meshopt_acmr(set->indices, set->n_indices, set->n_vertices, 32));
+	printf("Optimized %zu triangles in %.3f ms\n", set->n_indices / 3, t * 1e3);
+
+	q3batch_free(set);
+}
+
+void stats_quant(struct q3bsp* bsp) {
+	const int reps = 16;
+	struct q3quant_stream* stream = q3quant_encode(bsp);
+	double t0 = q3_seconds();
+	for(int r = 0; r < reps; r++)
+		q3quant_free(q3quant_encode(bsp));
+	double t_encode = (q3_seconds() - t0) / reps;
+
+	struct q3vertex* decoded = malloc(sizeof(struct q3vertex) * (bsp->n_vertices? bsp->n_vertices : 1));
+	t0 = q3_seconds();
+	for(int r = 0; r < reps; r++)
+		q3quant_decode(stream, decoded);
+	double t_decode = (q3_seconds() - t0) / reps;
+	free(decoded);
+
+	struct q3quant_error err;
+	q3quant_measure(stream, bsp->vertices, &err);
+
+	size_t n = bsp->n_vertices? bsp->n_vertices : 1;
+	printf("Vertices: %zu, %zu -> %zu bytes each (%zu KiB -> %zu KiB)\n", bsp->n_vertices,
+		sizeof(struct q3vertex), sizeof(struct q3qvertex), bsp->n_vertices * sizeof(struct q3vertex) / 1024,
+		(bsp->n_vertices * sizeof(struct q3qvertex) + stream->n_models * sizeof(struct q3quant_bounds)) / 1024);
+	printf("Encode %.2f ns, decode %.2f ns per vertex\n", t_encode * 1e9 / n, t_decode * 1e9 / n);
+	printf("Position error: max %.4f, mean %.4f units\n", err.max_pos, err.mean_pos);
+	printf("Normal error: max %.4f, mean %.4f degrees\n", err.max_norm, err.mean_norm);
+	printf("Texture coordinate error: max %g, lightmap coordinate error: max %g\n", err.max_tex, err.max_lightmap);
+
+	q3quant_free(stream);
+}
+
+void stats_meshlets(struct q3bsp* bsp) {
+	double t0 = q3_seconds();
+	struct q3meshlet_set* set = q3meshlet_build(bsp);
+	double t = q3_seconds() - t0;
+
+	size_t histogram[Q3MESHLET_MAX_VERTICES / 8] = { 0 };
+	size_t coned = 0;
+	double radius = 0.0;
+	for(size_t i = 0; i < set->n_meshlets; i++) {
+		const struct q3meshlet* m = set->meshlets + i;
+		histogram[(m->n_vertices - 1) / 8]++;
+		coned += m->cone_cutoff < 1.0f;
+		radius += m->radius;
+	}
+	size_t n = set->n_meshlets? set->n_meshlets : 1;
+	printf("Meshlets: %zu from %zu triangles in %.3f ms\n", set->n_meshlets, set->n_triangles, t * 1e3);
+	printf("Per meshlet: %.1f vertices, %.1f triangles, radius %.1f, %.1f%% with a usable normal cone\n",
+		(double)set->n_vertex_refs / n, (double)set->n_triangles / n, radius / n, 100.0 * coned / n);
+	printf("Vertices per meshlet:\n");
+	for(size_t i = 0; i < sizeof(histogram) / sizeof(*histogram); i++)
+		printf("    %2zu-%2zu: %zu\n", i * 8 + 1, i * 8 + 8, histogram[i]);
+
+	/* same corner to corner walk as stats adaptive, against per triangle backface tests */
+	const struct q3model* world = bsp->models;
+	const size_t steps = 32;
+	size_t culled = 0, culled_triangles = 0, backfacing = 0;
+	for(size_t s = 0; s < steps && bsp->n_models; s++) {
+		float f = (float)s / (steps - 1);
+		vec3 eye = {
+			world->mins.x + f * (world->maxs.x - world->mins.x),
+			world->mins.y + f * (world->maxs.y - world->mins.y),
+			(world->mins.z + world->maxs.z) * 0.5f,
+		};
+		for(size_t i = 0; i < set->n_meshlets; i++) {
+			const struct q3meshlet* m = set->meshlets + i;
+			if(q3meshlet_backfacing(m, eye)) {
+				culled++;
+				culled_triangles += m->n_triangles;
+			}
+			const u32* refs = set->vertex_refs + m->first_vertex;
+			const u8* tri = set->triangles + m->first_triangle * 3;
+			for(u32 k = 0; k < m->n_triangles; k++, tri += 3) {
+				vec3 a = bsp->vertices[refs[tri[0]]].pos, b = bsp->vertices[refs[tri[1]]].pos, c = bsp->vertices[refs[tri[2]]].pos;
+				vec3 u = { c.x - a.x, c.y - a.y, c.z - a.z }, v = { b.x - a.x, b.y - a.y, b.z - a.z };
+				vec3 nrm = { u.y * v.z - u.z * v.y, u.z * v.x - u.x * v.z, u.x * v.y - u.y * v.x };
+				backfacing += nrm.x * (a.x - eye.x) + nrm.y * (a.y - eye.y) + nrm.z * (a.z - eye.z) >= 0.0f;
+			}
+		}
+	}
+	size_t n_triangles = set->n_triangles? set->n_triangles : 1;
+	printf("Cone culling over %zu viewpoints: %.1f%% of meshlets, %.1f%% of triangles (%.1f%% are backfacing)\n", steps,
+		100.0 * culled / (n * steps), 100.0 * culled_triangles / (n_triangles * steps), 100.0 * backfacing / (n_triangles * steps));
+
+	q3meshlet_free(set);
+}
+
+void stats_hulls(struct q3bsp* bsp, const char* input) {
+	/* solid only unless asked for "all" */
+	u32 contents = TOKEN_MATCH(" all", input)? ~0U : Q3HULL_CONTENTS_SOLID;
+
+	double t0 = q3_seconds();
+	struct q3hull_set* set = q3hull_build(bsp, contents);
+	double t = q3_seconds() - t0;
+
+	/* how far any hull vertex pokes out past its own brush's sides */
+	float worst = 0.0f;
+	for(size_t i = 0; i < set->n_hulls; i++) {
+		const struct q3hull* h = set->hulls + i;
+		const struct q3brush* brush = bsp->brushes + h->brush;
+		for(u32 s = 0; s < brush->n_brushsides; s++) {
+			const struct plane* p = bsp->planes + bsp->brush_sides[brush->first_brushside_idx + s].plane_idx;
+			for(u32 k = 0; k < h->n_vertices; k++) {
+				const vec3* v = set->vertices + h->first_vertex + k;
+				worst = fmaxf(worst, v->x * p->norm.x + v->y * p->norm.y + v->z * p->norm.z - p->dist);
+			}
+		}
+	}
+
+	size_t n = set->n_hulls? set->n_hulls : 1;
+	printf("Hulls: %zu from %s brushes in %.3f ms, %zu came out empty\n", set->n_hulls,
+		contents == ~0U? "all" : "solid", t * 1e3, set->n_degenerate);
+	printf("Per hull: %.1f vertices, %.1f faces, %zu redundant sides dropped\n",
+		(double)set->n_vertices / n, (double)set->n_faces / n, set->n_redundant);
+	printf("Worst vertex outside its brush: %g units\n", worst);
+
+	q3hull_free(set);
+}
+
+static vec3 halfedge_normal(const struct q3halfedge_mesh* mesh, u32 triangle) {
+	vec3 a = mesh->positions[mesh->halfedges[triangle * 3].vertex];
+	vec3 b = mesh->positions[mesh->halfedges[triangle * 3 + 1].vertex];
+	vec3 c = mesh->positions[mesh->halfedges[triangle * 3 + 2].vertex];
+	vec3 u = { c.x - a.x, c.y - a.y, c.z - a.z }, v = { b.x - a.x, b.y - a.y, b.z - a.z };
+	vec3 n = { u.y * v.z - u.z * v.y, u.z * v.x - u.x * v.z, u.x * v.y - u.y * v.x };
+	float len = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+	return len > 0.0f? (vec3) { n.x / len, n.y / len, n.z / len } : n;
+}
+
+void stats_halfedges(struct q3bsp* bsp, const char* input) {
+	float epsilon = 0.01f;
+	sscanf(input, "%f", &epsilon);
+
+	double t0 = q3_seconds();
+	struct q3halfedge_mesh* mesh = q3halfedge_build(bsp, epsilon);
+	double t = q3_seconds() - t0;
+
+	/* the sort of thing it's for, creases between manifold neighbours */
+	size_t creases = 0;
+	const float crease = cosf(30.0f * 3.14159265f / 180.0f);
+	for(size_t h = 0; h < mesh->n_triangles * 3; h++) {
+		u32 twin = mesh->halfedges[h].twin;
+		if(twin == Q3HALFEDGE_NONE || twin < h)
+			continue;
+		vec3 a = halfedge_normal(mesh, h / 3), b = halfedge_normal(mesh, twin / 3);
+		creases += a.x * b.x + a.y * b.y + a.z * b.z < crease;
+	}
+
+	printf("Welded %zu vertices to %zu positions (epsilon %g), %zu triangles, %zu degenerate dropped\n",
+		mesh->n_map_vertices, mesh->n_positions, epsilon, mesh->n_triangles, mesh->n_degenerate);
+	printf("Edges: %zu, %zu boundary, %zu non-manifold, %zu creases over 30 degrees\n",
+		mesh->n_edges, mesh->n_boundary, mesh->n_nonmanifold, creases);
+	printf("Built in %.3f ms\n", t * 1e3);
+
+	q3halfedge_free(mesh);
+}
+
+static vec3 voxels_random_point(const struct q3model* world, u32* seed) {
+	float r[3];
+	for(int k = 0; k < 3; k++) {
+		*seed = *seed * 1103515245 + 12345;
+		r[k] = (*seed >> 8) / (float)(1 << 24);
+	}
+	return (vec3) {
+		world->mins.x + r[0] * (world->maxs.x - world->mins.x),
+		world->mins.y + r[1] * (world->maxs.y - world->mins.y),
+		world->mins.z + r[2] * (world->maxs.z - world->mins.z),
+	};
+}
+
+void stats_voxels(struct q3bsp* bsp, const char* input) {
+	float voxel_size = 16.0f;
+	sscanf(input, "%f", &voxel_size);
+	if(!bsp->n_models || voxel_size <= 0.0f) {
+		fprintf(stderr, "Nothing to voxelize\n");
+		return;
+	}
+
+	double t0 = q3_seconds();
+	struct q3svo* svo = q3svo_build(bsp, voxel_size, Q3SVO_CONTENTS_SOLID);
+	double t_build = q3_seconds() - t0;
+
+	size_t n_voxels = (size_t)svo->dims[0] * svo->dims[1] * svo->dims[2];
+	size_t dense = (n_voxels + 7) / 8;
+	printf("Voxels: %u x %u x %u of %g units, %zu solid (%.1f%%), depth %u, built in %.3f ms\n",
+		svo->dims[0], svo->dims[1], svo->dims[2], svo->voxel_size, svo->n_solid_voxels,
+		100.0 * svo->n_solid_voxels / (n_voxels? n_voxels : 1), svo->depth, t_build * 1e3);
+	printf("Octree: %zu nodes, %zu bytes, dense bits would be %zu bytes\n",
+		svo->n_nodes, svo->n_nodes * sizeof(struct q3svo_node), dense);
+
+	/* at voxel centres the octree has to match the brushes exactly, elsewhere it's off by up to half a voxel */
+	const size_t n = 1 << 16;
+	const struct q3model* world = bsp->models;
+	vec3* points = malloc(sizeof(vec3) * n);
+	u32 seed = 1;
+	for(size_t i = 0; i < n; i++) {
+		vec3 p = voxels_random_point(world, &seed);
+		points[i] = (vec3) {
+			svo->origin.x + (floorf((p.x - svo->origin.x) / svo->voxel_size) + 0.5f) * svo->voxel_size,
+			svo->origin.y + (floorf((p.y - svo->origin.y) / svo->voxel_size) + 0.5f) * svo->voxel_size,
+			svo->origin.z + (floorf((p.z - svo->origin.z) / svo->voxel_size) + 0.5f) * svo->voxel_size,
+		};
+	}
+
+	size_t solid_brush = 0, solid_svo = 0, mismatched = 0;
+	t0 = q3_seconds();
+	for(size_t i = 0; i < n; i++)
+		solid_brush += q3svo_brush_solid(bsp, Q3SVO_CONTENTS_SOLID, points[i]);
+	double t_brush = q3_seconds() - t0;
+	t0 = q3_seconds();
+	for(size_t i = 0; i < n; i++)
+		solid_svo += q3svo_point_solid(svo, points[i]);
+	double t_svo = q3_seconds() - t0;
+	for(size_t i = 0; i < n; i++)
+		mismatched += q3svo_point_solid(svo, points[i]) != q3svo_brush_solid(bsp, Q3SVO_CONTENTS_SOLID, points[i]);
+	printf("Point queries: %zu/%zu solid (%zu by the brushes), %zu disagree, %.1f ns vs %.1f ns through the BSP tree\n",
+		solid_svo, n, solid_brush, mismatched, t_svo * 1e9 / n, t_brush * 1e9 / n);
+
+	/* line of sight between random points, checked against stepping through the voxels */
+	const size_t n_segments = 1 << 14;
+	vec3* ends = malloc(sizeof(vec3) * n_segments * 2);
+	for(size_t i = 0; i < n_segments * 2; i++)
+		ends[i] = voxels_random_point(world, &seed);
+	size_t blocked = 0, stepped_disagree = 0;
+	t0 = q3_seconds();
+	for(size_t i = 0; i < n_segments; i++)
+		blocked += q3svo_segment_solid(svo, ends[i * 2], ends[i * 2 + 1], NULL);
+	double t_segment = q3_seconds() - t0;
+	for(size_t i = 0; i < n_segments; i++) {
+		vec3 a = ends[i * 2], b = ends[i * 2 + 1];
+		float frac;
+		bool hit = q3svo_segment_solid(svo, a, b, &frac);
+		float dx = b.x - a.x, dy = b.y - a.y, dz = b.z - a.z;
+		size_t steps = (size_t)(sqrtf(dx * dx + dy * dy + dz * dz) / (svo->voxel_size * 0.25f)) + 1;
+		float first = 1.0f;
+		for(size_t s = 0; s <= steps; s++) {
+			float t = (float)s / steps;
+			if(q3svo_point_solid(svo, (vec3) { a.x + dx * t, a.y + dy * t, a.z + dz * t })) {
+				first = t;
+				break;
+			}
+		}
+		/* stepping can skip a corner it only grazes, but never finds a hit before the real one */
+		stepped_disagree += first < 1.0f && (!hit || first + 1.0f / steps < frac);
+	}
+	printf("Segment queries: %zu/%zu blocked, %.1f ns each, %zu hit earlier by stepping\n",
+		blocked, n_segments, t_segment * 1e9 / n_segments, stepped_disagree);
+
+	free(ends);
+	free(points);
+	q3svo_free(svo);
+}
+
+void stats(struct q3bsp* bsp, const char* input) {
+	if(TOKEN_MATCH("vis", input))
+		stats_vis(bsp);
+	else if(TOKEN_MATCH("areas", input))
+		stats_areas(bsp);
+	else if(TOKEN_MATCH("lightgrid", input))
+		stats_lightgrid(bsp);
+	else if(TOKEN_MATCH("color", input))
+		stats_color(bsp);
+	else if(TOKEN_MATCH("patches", input))
+		stats_patches(bsp, input + sizeof("patches") - 1);
+	else if(TOKEN_MATCH("adaptive", input))
+		stats_adaptive(bsp);
+	else if(TOKEN_MATCH("batches", input))
+		stats_batches(bsp, input + sizeof("batches") - 1);
+	else if(TOKEN_MATCH("meshopt", input))
+		stats_meshopt(bsp, input + sizeof("meshopt") - 1);
+	else if(TOKEN_MATCH("meshlets", input))
+		stats_meshlets(bsp);
+	else if(TOKEN_MATCH("halfedges", input))
+		stats_halfedges(bsp, input + sizeof("halfedges") - 1);
+	else if(TOKEN_MATCH("hulls", input))
+		stats_hulls(bsp, input + sizeof("hulls") - 1);
+	else if(TOKEN_MATCH("voxels", input))
+		stats_voxels(bsp, input + sizeof("voxels") - 1);
+	else if(TOKEN_MATCH("quant", input))
+		stats_quant(bsp);
+	else if(TOKEN_MATCH("atlas", input))
+		stats_atlas(bsp, input + sizeof("atlas") - 1);
+	else
+		fprintf(stderr, "Unrecognized stats: '%s'\n", input);
+}
+
+/* writes <prefix>_<page>.ppm */
+void export_atlas(struct q3bsp* bsp, const char* input) {
+	char prefix[200] = "lightmap";
+	u32 size = 1024;
+	sscanf(input, "%199s %u", prefix, &size);
+
+	struct q3atlas* atlas = q3atlas_build(bsp, size, size);
+	for(size_t i = 0; i < atlas->n_pages; i++) {
+		char name[256];
+		snprintf(name, sizeof(name), "%s_%zu.ppm", prefix, i);
+		size_t len;
+		u8* ppm = q3atlas_encode_page(atlas, i, Q3ATLAS_PPM, &len);
+		FILE* out = fopen(name, "wb");
+		if(!out) {
+			perror(name);
+		} else {
+			fwrite(ppm, len, 1, out);
+			fclose(out);
+			printf("Wrote %s\n", name);
+		}
+		free(ppm);
+	}
+	q3atlas_free(atlas);
+}
+
+void export_batches(struct q3bsp* bsp, const char* input) {
+	char name[256] = "batches.q3db";
+	u32 patch_level = 4;
+	sscanf(input, "%255s %u", name, &patch_level);
+
+	struct q3batch_set* set = q3batch_build(bsp, patch_level);
+	FILE* out = fopen(name, "wb");
+	if(!out) {
+		perror(name);
+	} else {
+		if(q3batch_write(set, out) || fclose(out))
+			perror(name);
+		else
+			printf("Wrote %zu batches to %s\n", set->n_batches, name);
+	}
+	q3batch_free(set);
+}
+
+void export_meshlets(struct q3bsp* bsp, const char* input) {
+	char name[256] = "meshlets.q3ml";
+	sscanf(input, "%255s", name);
+
+	struct q3meshlet_set* set = q3meshlet_build(bsp);
+	FILE* out = fopen(name, "wb");
+	if(!out) {
+		perror(name);
+	} else {
+		if(q3meshlet_write(set, out) || fclose(out))
+			perror(name);
+		else
+			printf("Wrote %zu meshlets to %s\n", set->n_meshlets, name);
+	}
+	q3meshlet_free(set);
+}
+
+void export_quantized(struct q3bsp* bsp, const char* input) {
+	char name[256] = "vertices.q3qv";
+	sscanf(input, "%255s", name);
+
+	struct q3quant_stream* stream = q3quant_encode(bsp);
+	FILE* out = fopen(name, "wb");
+	if(!out) {
+		perror(name);
+	} else {
+		if(q3quant_write(stream, out) || fclose(out))
+			perror(name);
+		else
+			printf("Wrote %zu vertices to %s\n", stream->n_vertices, name);
+	}
+	q3quant_free(stream);
+}
+
+/* <file> [patch level] [atlas size], lightmap pages go to <file without extension>_lightmap_<page>.ppm */
+void export_mesh(struct q3bsp* bsp, const char* input, enum q3export_format format) {
+	char name[200] = "";
+	u32 patch_level = 4, atlas_size = 1024;
+	sscanf(input, "%199s %u %u", name, &patch_level, &atlas_size);
+	if(!*name)
+		strcpy(name, format == Q3EXPORT_OBJ? "map.obj" : "map.glb");
+
+	char prefix[256];
+	snprintf(prefix, sizeof(prefix), "%s", name);
+	char* dot = strrchr(prefix, '.');
+	if(dot && !strchr(dot, '/'))
+		*dot = '\0';
+	strncat(prefix, "_lightmap", sizeof(prefix) - strlen(prefix) - 1);
+
+	FILE* out = fopen(name, "wb");
+	if(!out) {
+		perror(name);
+		return;
+	}
+	struct q3export_stats st;
+	double t0 = q3_seconds();
+	int err = q3export_write(bsp, out, format, patch_level, prefix, atlas_size, &st);
+	err |= fclose(out);
+	double t = q3_seconds() - t0;
+	if(err) {
+		perror(name);
+		return;
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Wrote %s: %zu nodes, %zu vertices, %zu triangles\n", name, st.n_nodes, st.n_vertices, st.n_triangles);
+	printf("%.2f MB in %.3f ms (%.1f MB/s), exporter peak %zu KiB, process peak %ld KiB\n",
+		st.bytes / 1e6, t * 1e3, t > 0.0? st.bytes / 1e6 / t : 0.0, st.peak_memory / 1024, usage.ru_maxrss);
+}
+
+void export(struct q3bsp* bsp, const char* input) {
+	if(TOKEN_MATCH("atlas", input))
+		export_atlas(bsp, input + sizeof("atlas") - 1);
+	else if(TOKEN_MATCH("batches", input))
+		export_batches(bsp, input + sizeof("batches") - 1);
+	else if(TOKEN_MATCH("meshlets", input))
+		export_meshlets(bsp, input + sizeof("meshlets") - 1);
+	else if(TOKEN_MATCH("quantized", input))
+		export_quantized(bsp, input + sizeof("quantized") - 1);
+	else if(TOKEN_MATCH("obj", input))
+		export_mesh(bsp, input + sizeof("obj") - 1, Q3EXPORT_OBJ);
+	else if(TOKEN_MATCH("glb", input))
+		export_mesh(bsp, input + sizeof("glb") - 1, Q3EXPORT_GLB);
+	else
+		fprintf(stderr, "Unrecognized export: '%s'\n", input);
+}
+
 int main(int argc, char* argv[]) {
 	if(argc < 2 || argc > 2) {
 		fprintf(stderr, "Usage: %s file.bsp\n", argv[0]);
@@ -163,6 +942,18 @@ int main(int argc, char* argv[]) {
 			else
 				input += 2;
 			view(bsp, input);
+		} else if(TOKEN_MATCH("stats", input) || TOKEN_MATCH("s", input)) {
+			if(input[1] == 't')
+				input += sizeof("stats");
+			else
+				input += 2;
+			stats(bsp, input);
+		} else if(TOKEN_MATCH("export", input) || TOKEN_MATCH("x", input)) {
+			if(input[1] == 'x')
+				input += sizeof("export");
+			else
+				input += 2;
+			export(bsp, input);
 		} else {
 			printf("not recognized\n");
 		}
@@ -0,0 +1,231 @@
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "q3color.h"
+#include "q3parallel.h"
+
+#define TEXELS (128 * 128)
+
+void q3color_params_init(struct q3color_params* params, u32 shift, float gamma) {
+	params->shift = shift;
+	params->gamma = gamma;
+	params->identity_gamma = gamma == 1.0f;
+	for(u32 i = 0; i < 256; i++) {
+		u32 v = i;
+		if(!params->identity_gamma) {
+			float f = 255.0f * powf(i / 255.0f, 1.0f / gamma) + 0.5f;
+			v = f > 255.0f? 255 : (u32)f;
+		}
+		params->gamma_lut[i] = v;
+	}
+}
+
+/* R_ColorShiftLightingBytes: shift up, and if that overflowed scale all three back so hue survives */
+static inline void shift_clamp(u32 shift, u32 c[3]) {
+	u32 r = c[0] << shift, g = c[1] << shift, b = c[2] << shift;
+	if((r | g | b) > 255) {
+		u32 max = r > g? r : g;
+		max = max > b? max : b;
+		r = r * 255 / max;
+		g = g * 255 / max;
+		b = b * 255 / max;
+	}
+	c[0] = r;
+	c[1] = g;
+	c[2] = b;
+}
+
+static inline void convert_one(const struct q3color_params* params, u32 r, u32 g, u32 b, u32 a, void* out, size_t i, enum q3color_format format) {
+	if(format == Q3COLOR_LINEAR_F32) {
+		/* no integer truncation here, this is the exact scaled value */
+		float c[3] = { (float)(r << params->shift), (float)(g << params->shift), (float)(b << params->shift) };
+		float max = fmaxf(fmaxf(c[0], c[1]), c[2]);
+		float scale = max > 255.0f? 1.0f / max : 1.0f / 255.0f;
+		float* f = (float*)out + i * 4;
+		f[0] = c[0] * scale;
+		f[1] = c[1] * scale;
+		f[2] = c[2] * scale;
+		f[3] = a / 255.0f;
+		return;
+	}
+
+	u32 c[3] = { r, g, b };
+	shift_clamp(params->shift, c);
+	((u32*)out)[i] = params->gamma_lut[c[0]]
+		| params->gamma_lut[c[1]] << 8
+		| params->gamma_lut[c[2]] << 16
+		| a << 24;
+}
+
+void q3color_convert_rgb_scalar(const struct q3color_params* params, const rgb* in, size_t n, void* out, enum q3color_format format) {
+	for(size_t i = 0; i < n; i++)
+		convert_one(params, in[i].r, in[i].g, in[i].b, 255, out, i, format);
+}
+
+#if defined(__AVX2__)
+#define LANES 8
+
+/* px is 8 RGBA texels, 0xAABBGGRR */
+static inline void convert8(const struct q3color_params* params, __m256i px, void* out, size_t i, enum q3color_format format) {
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	const __m128i count = _mm_cvtsi32_si128(params->shift);
+	__m256 r = _mm256_cvtepi32_ps(_mm256_sll_epi32(_mm256_and_si256(px, mask), count));
+	__m256 g = _mm256_cvtepi32_ps(_mm256_sll_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask), count));
+	__m256 b = _mm256_cvtepi32_ps(_mm256_sll_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask), count));
+	__m256i a = _mm256_srli_epi32(px, 24);
+	__m256 max = _mm256_max_ps(_mm256_max_ps(r, g), b);
+	__m256 over = _mm256_cmp_ps(max, _mm256_set1_ps(255.0f), _CMP_GT_OQ);
+
+	if(format == Q3COLOR_LINEAR_F32) {
+		__m256 scale = _mm256_blendv_ps(_mm256_set1_ps(1.0f / 255.0f), _mm256_div_ps(_mm256_set1_ps(1.0f), max), over);
+		r = _mm256_mul_ps(r, scale);
+		g = _mm256_mul_ps(g, scale);
+		b = _mm256_mul_ps(b, scale);
+		__m256 af = _mm256_mul_ps(_mm256_cvtepi32_ps(a), _mm256_set1_ps(1.0f / 255.0f));
+
+		/* 4x8 transpose back to RGBA per texel */
+		__m256 rg_lo = _mm256_unpacklo_ps(r, g), rg_hi = _mm256_unpackhi_ps(r, g);
+		__m256 ba_lo = _mm256_unpacklo_ps(b, af), ba_hi = _mm256_unpackhi_ps(b, af);
+		__m256 t0 = _mm256_castpd_ps(_mm256_unpacklo_pd(_mm256_castps_pd(rg_lo), _mm256_castps_pd(ba_lo)));
+		__m256 t1 = _mm256_castpd_ps(_mm256_unpackhi_pd(_mm256_castps_pd(rg_lo), _mm256_castps_pd(ba_lo)));
+		__m256 t2 = _mm256_castpd_ps(_mm256_unpacklo_pd(_mm256_castps_pd(rg_hi), _mm256_castps_pd(ba_hi)));
+		__m256 t3 = _mm256_castpd_ps(_mm256_unpackhi_pd(_mm256_castps_pd(rg_hi), _mm256_castps_pd(ba_hi)));
+		float* f = (float*)out + i * 4;
+		_mm256_storeu_ps(f + 0, _mm256_permute2f128_ps(t0, t1, 0x20));
+		_mm256_storeu_ps(f + 8, _mm256_permute2f128_ps(t2, t3, 0x20));
+		_mm256_storeu_ps(f + 16, _mm256_permute2f128_ps(t0, t1, 0x31));
+		_mm256_storeu_ps(f + 24, _mm256_permute2f128_ps(t2, t3, 0x31));
+		return;
+	}
+
+	/* c*255/max is exact before the divide, so truncating matches the integer version */
+	const __m256 k255 = _mm256_set1_ps(255.0f);
+	__m256i ri = _mm256_cvttps_epi32(_mm256_blendv_ps(r, _mm256_div_ps(_mm256_mul_ps(r, k255), max), over));
+	__m256i gi = _mm256_cvttps_epi32(_mm256_blendv_ps(g, _mm256_div_ps(_mm256_mul_ps(g, k255), max), over));
+	__m256i bi = _mm256_cvttps_epi32(_mm256_blendv_ps(b, _mm256_div_ps(_mm256_mul_ps(b, k255), max), over));
+	if(!params->identity_gamma) {
+		const int* lut = (const int*)params->gamma_lut;
+		ri = _mm256_i32gather_epi32(lut, ri, 4);
+		gi = _mm256_i32gather_epi32(lut, gi, 4);
+		bi = _mm256_i32gather_epi32(lut, bi, 4);
+	}
+	__m256i res = _mm256_or_si256(_mm256_or_si256(ri, _mm256_slli_epi32(gi, 8)),
+		_mm256_or_si256(_mm256_slli_epi32(bi, 16), _mm256_slli_epi32(a, 24)));
+	_mm256_storeu_si256((__m256i*)((u32*)out + i), res);
+}
+
+static size_t convert_rgb_lanes(const struct q3color_params* params, const rgb* in, size_t n, void* out, enum q3color_format format) {
+	/* spread 4 packed texels per 128 bit lane out to 32 bits each, alpha filled in after */
+	const __m256i expand = _mm256_setr_epi8(
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+	const u8* bytes = (const u8*)in;
+	size_t i = 0;
+	/* each half loads 16 bytes for 12, so stop early enough not to read past the end */
+	for(; i + LANES + 2 <= n; i += LANES) {
+		__m256i raw = _mm256_loadu2_m128i((const __m128i*)(bytes + i * 3 + 12), (const __m128i*)(bytes + i * 3));
+		__m256i px = _mm256_or_si256(_mm256_shuffle_epi8(raw, expand), alpha);
+		convert8(params, px, out, i, format);
+	}
+	return i;
+}
+
+static size_t convert_vertex_lanes(const struct q3color_params* params, const struct q3vertex* in, size_t n, rgba* out) {
+	/* struct q3vertex is 11 u32s, color is the last */
+	const __m256i stride = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(sizeof(struct q3vertex) / 4));
+	size_t i = 0;
+	for(; i + LANES <= n; i += LANES) {
+		__m256i px = _mm256_i32gather_epi32((const int*)&in[i].color, stride, 4);
+		convert8(params, px, out, i, Q3COLOR_RGBA8);
+	}
+	return i;
+}
+
+#elif defined(__SSE2__)
+#define LANES 4
+
+/*
+	Without pshufb and gathers, unpacking texels and the gamma ramp eat all the gain on
+	the byte path, so SSE2 only takes the float path and RGBA8 stays scalar.
+*/
+static inline void convert4(const struct q3color_params* params, __m128i px, float* out) {
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const __m128i count = _mm_cvtsi32_si128(params->shift);
+	__m128 r = _mm_cvtepi32_ps(_mm_sll_epi32(_mm_and_si128(px, mask), count));
+	__m128 g = _mm_cvtepi32_ps(_mm_sll_epi32(_mm_and_si128(_mm_srli_epi32(px, 8), mask), count));
+	__m128 b = _mm_cvtepi32_ps(_mm_sll_epi32(_mm_and_si128(_mm_srli_epi32(px, 16), mask), count));
+	__m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(px, 24)), _mm_set1_ps(1.0f / 255.0f));
+	__m128 max = _mm_max_ps(_mm_max_ps(r, g), b);
+	__m128 over = _mm_cmpgt_ps(max, _mm_set1_ps(255.0f));
+
+	__m128 scale = _mm_or_ps(_mm_and_ps(over, _mm_div_ps(_mm_set1_ps(1.0f), max)),
+		_mm_andnot_ps(over, _mm_set1_ps(1.0f / 255.0f)));
+	r = _mm_mul_ps(r, scale);
+	g = _mm_mul_ps(g, scale);
+	b = _mm_mul_ps(b, scale);
+	_MM_TRANSPOSE4_PS(r, g, b, a);
+	_mm_storeu_ps(out + 0, r);
+	_mm_storeu_ps(out + 4, g);
+	_mm_storeu_ps(out + 8, b);
+	_mm_storeu_ps(out + 12, a);
+}
+
+static inline u32 load_rgb(const rgb* c) {
+	return c->r | c->g << 8 | c->b << 16 | 0xFF000000U;
+}
+
+static size_t convert_rgb_lanes(const struct q3color_params* params, const rgb* in, size_t n, void* out, enum q3color_format format) {
+	if(format != Q3COLOR_LINEAR_F32)
+		return 0;
+
+	size_t i = 0;
+	for(; i + LANES <= n; i += LANES)
+		convert4(params, _mm_setr_epi32(load_rgb(in + i), load_rgb(in + i + 1), load_rgb(in + i + 2), load_rgb(in + i + 3)), (float*)out + i * 4);
+	return i;
+}
+
+#endif
+
+void q3color_convert_rgb(const struct q3color_params* params, const rgb* in, size_t n, void* out, enum q3color_format format) {
+	size_t i = 0;
+#ifdef LANES
+	i = convert_rgb_lanes(params, in, n, out, format);
+#endif
+	for(; i < n; i++)
+		convert_one(params, in[i].r, in[i].g, in[i].b, 255, out, i, format);
+}
+
+struct lightmap_job {
+	const struct q3color_params* params;
+	const struct q3lightmap* lightmaps;
+	void* out;
+	enum q3color_format format;
+};
+
+static void convert_lightmap(void* user, size_t i) {
+	const struct lightmap_job* job = user;
+	size_t texel_size = job->format == Q3COLOR_RGBA8? sizeof(u32) : sizeof(float[4]);
+	q3color_convert_rgb(job->params, &job->lightmaps[i].map[0][0], TEXELS,
+		(u8*)job->out + i * TEXELS * texel_size, job->format);
+}
+
+void q3color_convert_lightmaps(const struct q3color_params* params, const struct q3lightmap* lightmaps, size_t n, void* out, enum q3color_format format) {
+	struct lightmap_job job = { params, lightmaps, out, format };
+	q3_parallel_for(n, convert_lightmap, &job);
+}
+
+void q3color_convert_vertices(const struct q3color_params* params, const struct q3vertex* vertices, size_t n, rgba* out) {
+	size_t i = 0;
+#if defined(__AVX2__)
+	i = convert_vertex_lanes(params, vertices, n, out);
+#endif
+	for(; i < n; i++) {
+		const rgba c = vertices[i].color;
+		convert_one(params, c.r, c.g, c.b, c.a, out, i, Q3COLOR_RGBA8);
+	}
+}
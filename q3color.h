@@ -0,0 +1,46 @@
+#ifndef Q3_COLOR_H_
+#define Q3_COLOR_H_
+
+#include <stdbool.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum q3color_format {
+	/* display ready bytes with the gamma ramp applied */
+	Q3COLOR_RGBA8,
+	/* 4 floats per texel in 0-1, overbright and clamp only, no gamma */
+	Q3COLOR_LINEAR_F32,
+};
+
+struct q3color_params {
+	/* r_mapOverBrightBits - r_overBrightBits, 2 - 1 with hardware gamma or 2 - 0 without */
+	u32 shift;
+	float gamma;
+	bool identity_gamma;
+	/* same ramp as R_SetColorMappings, kept as u32 so AVX2 can gather from it */
+	u32 gamma_lut[256];
+};
+
+void q3color_params_init(struct q3color_params* params, u32 shift, float gamma);
+
+/*
+	n texels of packed RGB into out, which holds n u32s for RGBA8 or 4n floats for LINEAR_F32.
+	Picks AVX2, SSE2 or scalar at compile time, _scalar is always the plain C version.
+*/
+void q3color_convert_rgb(const struct q3color_params* params, const rgb* in, size_t n, void* out, enum q3color_format format);
+void q3color_convert_rgb_scalar(const struct q3color_params* params, const rgb* in, size_t n, void* out, enum q3color_format format);
+
+/* every lightmap, one task per lightmap, out is laid out block after block */
+void q3color_convert_lightmaps(const struct q3color_params* params, const struct q3lightmap* lightmaps, size_t n, void* out, enum q3color_format format);
+
+/* vertex colors keep their alpha */
+void q3color_convert_vertices(const struct q3color_params* params, const struct q3vertex* vertices, size_t n, rgba* out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
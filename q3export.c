@@ -0,0 +1,524 @@
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "q3atlas.h"
+#include "q3export.h"
+#include "q3patch.h"
+
+#define GLB_MAGIC 0x46546C67U
+#define GLB_JSON 0x4E4F534AU
+#define GLB_BIN 0x004E4942U
+
+/* everything goes out through here, with no FILE it only counts */
+struct sink {
+	FILE* out;
+	u8* buf;
+	size_t len, cap;
+	u64 written;
+	bool failed;
+};
+
+static void sink_flush(struct sink* s) {
+	if(s->out && s->len && fwrite(s->buf, s->len, 1, s->out) != 1)
+		s->failed = true;
+	s->len = 0;
+}
+
+static void sink_put(struct sink* s, const void* data, size_t n) {
+	s->written += n;
+	if(!s->out)
+		return;
+	const u8* p = data;
+	while(n) {
+		size_t k = s->cap - s->len < n? s->cap - s->len : n;
+		memcpy(s->buf + s->len, p, k);
+		s->len += k;
+		p += k;
+		n -= k;
+		if(s->len == s->cap)
+			sink_flush(s);
+	}
+}
+
+static void sink_puts(struct sink* s, const char* str) {
+	sink_put(s, str, strlen(str));
+}
+
+static void sink_printf(struct sink* s, const char* fmt, ...) {
+	char line[256];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	if(n > 0)
+		sink_put(s, line, (size_t)n < sizeof(line)? (size_t)n : sizeof(line) - 1);
+}
+
+/* one (model, atlas page) pair, a glTF primitive */
+struct group {
+	u32 n_vertices, n_indices;
+	vec3 mins, maxs;
+};
+
+struct writer {
+	const struct q3bsp* bsp;
+	struct q3patch_set* patches;
+	u32 patch_level;
+	const struct q3atlas* atlas;
+	size_t n_pages;
+	struct sink sink;
+	/* the current face, grown to the largest one seen */
+	struct q3vertex* vertices;
+	u32* indices;
+	size_t cap_vertices, cap_indices;
+	/* bytes held by the exporter */
+	size_t live, peak;
+};
+
+static void* track(struct writer* w, void* p, size_t old_size, size_t new_size) {
+	p = realloc(p, new_size? new_size : 1);
+	w->live += new_size - old_size;
+	if(w->live > w->peak)
+		w->peak = w->live;
+	return p;
+}
+
+static void untrack(struct writer* w, void* p, size_t size) {
+	free(p);
+	w->live -= size;
+}
+
+static void reserve(struct writer* w, size_t n_vertices, size_t n_indices) {
+	if(n_vertices > w->cap_vertices) {
+		w->vertices = track(w, w->vertices, sizeof(struct q3vertex) * w->cap_vertices, sizeof(struct q3vertex) * n_vertices);
+		w->cap_vertices = n_vertices;
+	}
+	if(n_indices > w->cap_indices) {
+		w->indices = track(w, w->indices, sizeof(u32) * w->cap_indices, sizeof(u32) * n_indices);
+		w->cap_indices = n_indices;
+	}
+}
+
+static u32 face_page(const struct writer* w, const struct q3face* face) {
+	if(!w->atlas || face->lightmap_idx < 0 || (size_t)face->lightmap_idx >= w->atlas->n_slots)
+		return 0;
+	return w->atlas->slots[face->lightmap_idx].page;
+}
+
+/* patches are in face order */
+static const struct q3patch* find_patch(const struct q3patch_set* set, size_t face) {
+	size_t lo = 0, hi = set->n_patches;
+	while(lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if((size_t)set->patches[mid].face < face)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < set->n_patches && (size_t)set->patches[lo].face == face? set->patches + lo : NULL;
+}
+
+/* loads a face into the scratch buffers ready to write, false if it has no triangles */
+static bool face_geometry(struct writer* w, size_t f, size_t* n_vertices, size_t* n_indices) {
+	const struct q3bsp* bsp = w->bsp;
+	const struct q3face* face = bsp->faces + f;
+	size_t nv, ni;
+
+	if(face->type == POLYGON || face->type == MESH) {
+		if(face->first_vertex_idx < 0 || (size_t)face->first_vertex_idx + face->n_vertices > bsp->n_vertices)
+			return false;
+		if(face->first_mesh_vertex_idx < 0 || (size_t)face->first_mesh_vertex_idx + face->n_mesh_vertices > bsp->n_mesh_verts)
+			return false;
+		nv = face->n_vertices;
+		ni = face->n_mesh_vertices - face->n_mesh_vertices % 3;
+		reserve(w, nv, ni);
+		memcpy(w->vertices, bsp->vertices + face->first_vertex_idx, sizeof(struct q3vertex) * nv);
+		for(size_t k = 0; k < ni; k++) {
+			i32 idx = bsp->mesh_verts[face->first_mesh_vertex_idx + k].idx;
+			if(idx < 0 || (size_t)idx >= nv)
+				return false;
+			w->indices[k] = idx;
+		}
+	} else if(face->type == PATCH && w->patches) {
+		/* tessellated once up front, every pass over the faces only copies */
+		const struct q3patch* p = find_patch(w->patches, f);
+		if(!p || !p->lods[w->patch_level].n_vertices)
+			return false;
+		const struct q3patch_mesh* m = p->lods + w->patch_level;
+		nv = m->n_vertices;
+		ni = m->n_indices;
+		reserve(w, nv, ni);
+		memcpy(w->vertices, w->patches->vertices + m->first_vertex, sizeof(struct q3vertex) * nv);
+		memcpy(w->indices, w->patches->indices + m->first_index, sizeof(u32) * ni);
+	} else {
+		return false;
+	}
+	if(!ni)
+		return false;
+
+	/* quake's front faces wind clockwise */
+	for(size_t k = 0; k < ni; k += 3) {
+		u32 t = w->indices[k + 1];
+		w->indices[k + 1] = w->indices[k + 2];
+		w->indices[k + 2] = t;
+	}
+
+	const struct q3atlas_slot* slot = NULL;
+	if(w->atlas && face->lightmap_idx >= 0 && (size_t)face->lightmap_idx < w->atlas->n_slots)
+		slot = w->atlas->slots + face->lightmap_idx;
+	for(size_t k = 0; k < nv; k++) {
+		struct q3vertex* v = w->vertices + k;
+		if(slot) {
+			v->lightmap_coords.s = (slot->x + v->lightmap_coords.s * Q3LIGHTMAP_SIZE) / w->atlas->width;
+			v->lightmap_coords.t = (slot->y + v->lightmap_coords.t * Q3LIGHTMAP_SIZE) / w->atlas->height;
+		}
+		/* Z up to Y up */
+		v->pos = (vec3) { v->pos.x, v->pos.z, -v->pos.y };
+		v->norm = (vec3) { v->norm.x, v->norm.z, -v->norm.y };
+	}
+
+	*n_vertices = nv;
+	*n_indices = ni;
+	return true;
+}
+
+/* files are referenced relative to the file naming them, which sits in the prefix's directory */
+static const char* base_name(const char* path) {
+	const char* slash = strrchr(path, '/');
+	const char* backslash = strrchr(path, '\\');
+	if(backslash > slash)
+		slash = backslash;
+	return slash? slash + 1 : path;
+}
+
+static int write_sidecars(struct writer* w, const char* prefix, enum q3export_format format) {
+	char name[256];
+	for(size_t i = 0; i < w->atlas->n_pages; i++) {
+		size_t len;
+		u8* ppm = q3atlas_encode_page(w->atlas, i, Q3ATLAS_PPM, &len);
+		track(w, NULL, 0, len);
+		snprintf(name, sizeof(name), "%s_%zu.ppm", prefix, i);
+		FILE* out = fopen(name, "wb");
+		int failed = !out || fwrite(ppm, len, 1, out) != 1;
+		if(out)
+			failed |= fclose(out) != 0;
+		untrack(w, ppm, len);
+		/* the pixels aren't needed again, only the slots */
+		untrack(w, w->atlas->pages[i], (size_t)w->atlas->width * w->atlas->height * 3);
+		w->atlas->pages[i] = NULL;
+		if(failed)
+			return EOF;
+	}
+
+	if(format != Q3EXPORT_OBJ)
+		return 0;
+	snprintf(name, sizeof(name), "%s.mtl", prefix);
+	FILE* out = fopen(name, "w");
+	if(!out)
+		return EOF;
+	for(size_t i = 0; i < w->atlas->n_pages; i++)
+		fprintf(out, "newmtl lightmap_%zu\nmap_Kd %s_%zu.ppm\n", i, base_name(prefix), i);
+	return fclose(out);
+}
+
+static void write_obj(struct writer* w, const char* prefix, struct q3export_stats* stats) {
+	const struct q3bsp* bsp = w->bsp;
+	struct sink* s = &w->sink;
+	sink_puts(s, "# q3bsp export\n");
+	if(w->atlas)
+		sink_printf(s, "mtllib %s.mtl\n", base_name(prefix));
+
+	/* obj indices are global and one based */
+	u64 base = 1;
+	for(size_t m = 0; m < bsp->n_models; m++) {
+		const struct q3model* model = bsp->models + m;
+		sink_printf(s, "o model_%zu\n", m);
+		for(size_t page = 0; page < w->n_pages; page++) {
+			bool named = false;
+			for(u32 i = 0; i < model->n_faces; i++) {
+				size_t f = model->face_start_idx + i, nv, ni;
+				if(face_page(w, bsp->faces + f) != page || !face_geometry(w, f, &nv, &ni))
+					continue;
+				if(w->atlas && !named) {
+					sink_printf(s, "usemtl lightmap_%zu\n", page);
+					named = true;
+				}
+
+				/* only one set of texture coordinates fits, the lightmap is the image we have */
+				for(size_t k = 0; k < nv; k++) {
+					const struct q3vertex* v = w->vertices + k;
+					vec2 uv = w->atlas? v->lightmap_coords : v->tex_coords;
+					sink_printf(s, "v %.7g %.7g %.7g\nvt %.7g %.7g\nvn %.4f %.4f %.4f\n",
+						v->pos.x, v->pos.y, v->pos.z, uv.s, 1.0f - uv.t, v->norm.x, v->norm.y, v->norm.z);
+				}
+				for(size_t k = 0; k < ni; k += 3) {
+					u64 a = base + w->indices[k], b = base + w->indices[k + 1], c = base + w->indices[k + 2];
+					sink_printf(s, "f %llu/%llu/%llu %llu/%llu/%llu %llu/%llu/%llu\n",
+						(unsigned long long)a, (unsigned long long)a, (unsigned long long)a,
+						(unsigned long long)b, (unsigned long long)b, (unsigned long long)b,
+						(unsigned long long)c, (unsigned long long)c, (unsigned long long)c);
+				}
+				base += nv;
+				stats->n_vertices += nv;
+				stats->n_triangles += ni / 3;
+			}
+		}
+	}
+}
+
+static void json_float(struct sink* s, float f) {
+	sink_printf(s, "%.9g", f);
+}
+
+static void json_vec3(struct sink* s, vec3 v) {
+	sink_puts(s, "[");
+	json_float(s, v.x);
+	sink_puts(s, ",");
+	json_float(s, v.y);
+	sink_puts(s, ",");
+	json_float(s, v.z);
+	sink_puts(s, "]");
+}
+
+/* vertices go out as struct q3vertex, 44 bytes with these attribute offsets */
+static void write_gltf_json(struct writer* w, struct sink* s, const struct group* groups, u64 bin_len, const char* prefix) {
+	const struct q3bsp* bsp = w->bsp;
+	sink_puts(s, "{\"asset\":{\"version\":\"2.0\",\"generator\":\"q3bspload\"},\"scene\":0,\"scenes\":[{\"nodes\":[");
+	for(size_t m = 0; m < bsp->n_models; m++)
+		sink_printf(s, "%s%zu", m? "," : "", m);
+	sink_puts(s, "]}],\"nodes\":[");
+
+	/* models without any triangles get a node but no mesh */
+	size_t n_meshes = 0;
+	for(size_t m = 0; m < bsp->n_models; m++) {
+		bool empty = true;
+		for(size_t page = 0; page < w->n_pages; page++)
+			empty &= !groups[m * w->n_pages + page].n_indices;
+		sink_printf(s, "%s{\"name\":\"model_%zu\"", m? "," : "", m);
+		if(!empty)
+			sink_printf(s, ",\"mesh\":%zu", n_meshes++);
+		sink_puts(s, "}");
+	}
+
+	sink_puts(s, "],\"meshes\":[");
+	size_t accessor = 0;
+	bool first_mesh = true;
+	for(size_t m = 0; m < bsp->n_models; m++) {
+		bool first = true;
+		for(size_t page = 0; page < w->n_pages; page++) {
+			if(!groups[m * w->n_pages + page].n_indices)
+				continue;
+			if(first)
+				sink_printf(s, "%s{\"name\":\"model_%zu\",\"primitives\":[", first_mesh? "" : ",", m);
+			sink_printf(s, "%s{\"attributes\":{\"POSITION\":%zu,\"NORMAL\":%zu,\"TEXCOORD_0\":%zu,\"TEXCOORD_1\":%zu,\"COLOR_0\":%zu},\"indices\":%zu",
+				first? "" : ",", accessor, accessor + 1, accessor + 2, accessor + 3, accessor + 4, accessor + 5);
+			if(w->atlas)
+				sink_printf(s, ",\"material\":%zu", page);
+			sink_puts(s, "}");
+			accessor += 6;
+			first = first_mesh = false;
+		}
+		if(!first)
+			sink_puts(s, "]}");
+	}
+	sink_puts(s, "]");
+
+	if(w->atlas) {
+		sink_puts(s, ",\"materials\":[");
+		for(size_t page = 0; page < w->n_pages; page++) {
+			sink_printf(s, "%s{\"name\":\"lightmap_%zu\",\"extras\":{\"lightmap\":\"", page? "," : "", page);
+			sink_puts(s, base_name(prefix));
+			sink_printf(s, "_%zu.ppm\"}}", page);
+		}
+		sink_puts(s, "]");
+	}
+
+	if(!bin_len) {
+		sink_puts(s, "}");
+		return;
+	}
+
+	sink_printf(s, ",\"buffers\":[{\"byteLength\":%llu}],\"bufferViews\":[", (unsigned long long)bin_len);
+	u64 offset = 0;
+	bool first = true;
+	for(size_t g = 0; g < bsp->n_models * w->n_pages; g++) {
+		if(!groups[g].n_indices)
+			continue;
+		u64 vertex_len = (u64)groups[g].n_vertices * sizeof(struct q3vertex), index_len = (u64)groups[g].n_indices * sizeof(u32);
+		sink_printf(s, "%s{\"buffer\":0,\"byteOffset\":%llu,\"byteLength\":%llu,\"byteStride\":%zu,\"target\":34962}",
+			first? "" : ",", (unsigned long long)offset, (unsigned long long)vertex_len, sizeof(struct q3vertex));
+		sink_printf(s, ",{\"buffer\":0,\"byteOffset\":%llu,\"byteLength\":%llu,\"target\":34963}",
+			(unsigned long long)(offset + vertex_len), (unsigned long long)index_len);
+		offset += vertex_len + index_len;
+		first = false;
+	}
+
+	sink_puts(s, "],\"accessors\":[");
+	size_t view = 0;
+	first = true;
+	for(size_t g = 0; g < bsp->n_models * w->n_pages; g++) {
+		const struct group* gr = groups + g;
+		if(!gr->n_indices)
+			continue;
+		sink_printf(s, "%s{\"bufferView\":%zu,\"byteOffset\":%zu,\"componentType\":5126,\"count\":%u,\"type\":\"VEC3\",\"min\":",
+			first? "" : ",", view, offsetof(struct q3vertex, pos), gr->n_vertices);
+		json_vec3(s, gr->mins);
+		sink_puts(s, ",\"max\":");
+		json_vec3(s, gr->maxs);
+		sink_puts(s, "}");
+		sink_printf(s, ",{\"bufferView\":%zu,\"byteOffset\":%zu,\"componentType\":5126,\"count\":%u,\"type\":\"VEC3\"}",
+			view, offsetof(struct q3vertex, norm), gr->n_vertices);
+		sink_printf(s, ",{\"bufferView\":%zu,\"byteOffset\":%zu,\"componentType\":5126,\"count\":%u,\"type\":\"VEC2\"}",
+			view, offsetof(struct q3vertex, tex_coords), gr->n_vertices);
+		sink_printf(s, ",{\"bufferView\":%zu,\"byteOffset\":%zu,\"componentType\":5126,\"count\":%u,\"type\":\"VEC2\"}",
+			view, offsetof(struct q3vertex, lightmap_coords), gr->n_vertices);
+		sink_printf(s, ",{\"bufferView\":%zu,\"byteOffset\":%zu,\"componentType\":5121,\"normalized\":true,\"count\":%u,\"type\":\"VEC4\"}",
+			view, offsetof(struct q3vertex, color), gr->n_vertices);
+		sink_printf(s, ",{\"bufferView\":%zu,\"componentType\":5125,\"count\":%u,\"type\":\"SCALAR\"}", view + 1, gr->n_indices);
+		view += 2;
+		first = false;
+	}
+	sink_puts(s, "]}");
+}
+
+/* EOF with errno at EFBIG if the file wouldn't fit GLB's 32 bit lengths */
+static int write_glb(struct writer* w, const char* prefix, struct q3export_stats* stats) {
+	const struct q3bsp* bsp = w->bsp;
+	size_t n_groups = bsp->n_models * w->n_pages;
+	size_t groups_size = sizeof(struct group) * n_groups;
+	struct group* groups = track(w, NULL, 0, groups_size);
+	memset(groups, 0, groups_size);
+
+	/* the json has to come first and needs counts and bounds, so the faces get walked once to size things */
+	u64 bin_len = 0;
+	for(size_t m = 0; m < bsp->n_models; m++) {
+		const struct q3model* model = bsp->models + m;
+		for(u32 i = 0; i < model->n_faces; i++) {
+			size_t f = model->face_start_idx + i, nv, ni;
+			if(!face_geometry(w, f, &nv, &ni))
+				continue;
+			struct group* g = groups + m * w->n_pages + face_page(w, bsp->faces + f);
+			for(size_t k = 0; k < nv; k++) {
+				vec3 p = w->vertices[k].pos;
+				if(!g->n_vertices && !k) {
+					g->mins = g->maxs = p;
+					continue;
+				}
+				g->mins = (vec3) { fminf(g->mins.x, p.x), fminf(g->mins.y, p.y), fminf(g->mins.z, p.z) };
+				g->maxs = (vec3) { fmaxf(g->maxs.x, p.x), fmaxf(g->maxs.y, p.y), fmaxf(g->maxs.z, p.z) };
+			}
+			g->n_vertices += nv;
+			g->n_indices += ni;
+			bin_len += nv * sizeof(struct q3vertex) + ni * sizeof(u32);
+		}
+	}
+
+	struct sink counter = { 0 };
+	write_gltf_json(w, &counter, groups, bin_len, prefix);
+	u64 json_len = (counter.written + 3) & ~3ULL;
+	u64 total = 12 + 8 + json_len + (bin_len? 8 + bin_len : 0);
+	if(total > UINT32_MAX) {
+		untrack(w, groups, groups_size);
+		errno = EFBIG;
+		return EOF;
+	}
+
+	struct sink* s = &w->sink;
+	u32 header[3] = { GLB_MAGIC, 2, (u32)total };
+	sink_put(s, header, sizeof(header));
+	u32 chunk[2] = { (u32)json_len, GLB_JSON };
+	sink_put(s, chunk, sizeof(chunk));
+	write_gltf_json(w, s, groups, bin_len, prefix);
+	sink_put(s, "   ", json_len - counter.written);
+
+	if(bin_len) {
+		chunk[0] = (u32)bin_len;
+		chunk[1] = GLB_BIN;
+		sink_put(s, chunk, sizeof(chunk));
+	}
+
+	/* each primitive is its vertices then its indices, so its faces are walked twice */
+	for(size_t m = 0; m < bsp->n_models; m++) {
+		const struct q3model* model = bsp->models + m;
+		for(size_t page = 0; page < w->n_pages; page++) {
+			if(!groups[m * w->n_pages + page].n_indices)
+				continue;
+			for(int pass = 0; pass < 2; pass++) {
+				u32 base = 0;
+				for(u32 i = 0; i < model->n_faces; i++) {
+					size_t f = model->face_start_idx + i, nv, ni;
+					if(face_page(w, bsp->faces + f) != page || !face_geometry(w, f, &nv, &ni))
+						continue;
+					if(!pass) {
+						sink_put(s, w->vertices, sizeof(struct q3vertex) * nv);
+						stats->n_vertices += nv;
+						stats->n_triangles += ni / 3;
+					} else {
+						for(size_t k = 0; k < ni; k++)
+							w->indices[k] += base;
+						sink_put(s, w->indices, sizeof(u32) * ni);
+					}
+					base += nv;
+				}
+			}
+		}
+	}
+
+	untrack(w, groups, groups_size);
+	return 0;
+}
+
+int q3export_write(const struct q3bsp* bsp, FILE* out, enum q3export_format format, u32 patch_level,
+	const char* lightmap_prefix, u32 atlas_size, struct q3export_stats* stats) {
+	memset(stats, 0, sizeof(*stats));
+	struct writer w = {
+		.bsp = bsp,
+		.patch_level = patch_level > Q3PATCH_MAX_LEVEL? Q3PATCH_MAX_LEVEL : patch_level,
+		.n_pages = 1,
+	};
+	w.sink.out = out;
+	w.sink.cap = Q3EXPORT_CHUNK_SIZE;
+	w.sink.buf = track(&w, NULL, 0, w.sink.cap);
+
+	if(w.patch_level) {
+		w.patches = q3patch_init(bsp);
+		q3patch_tessellate_all(w.patches, w.patch_level);
+		track(&w, NULL, 0, sizeof(struct q3patch) * w.patches->n_patches
+			+ sizeof(struct q3vertex) * w.patches->cap_vertices + sizeof(u32) * w.patches->cap_indices);
+	}
+
+	int err = 0;
+	struct q3atlas* atlas = NULL;
+	if(lightmap_prefix && bsp->n_lightmaps) {
+		atlas = q3atlas_build(bsp, atlas_size, atlas_size);
+		track(&w, NULL, 0, (size_t)atlas->width * atlas->height * 3 * atlas->n_pages + sizeof(struct q3atlas_slot) * atlas->n_slots);
+		w.atlas = atlas;
+		w.n_pages = atlas->n_pages? atlas->n_pages : 1;
+		err = write_sidecars(&w, lightmap_prefix, format);
+	}
+
+	if(!err) {
+		if(format == Q3EXPORT_OBJ)
+			write_obj(&w, lightmap_prefix, stats);
+		else
+			err = write_glb(&w, lightmap_prefix, stats);
+		sink_flush(&w.sink);
+		err |= w.sink.failed? EOF : 0;
+	}
+
+	stats->n_nodes = bsp->n_models;
+	stats->bytes = w.sink.written;
+	stats->peak_memory = w.peak;
+
+	q3atlas_free(atlas);
+	q3patch_free(w.patches);
+	free(w.sink.buf);
+	free(w.vertices);
+	free(w.indices);
+	return err;
+}
@@ -0,0 +1,52 @@
+#ifndef Q3_EXPORT_H_
+#define Q3_EXPORT_H_
+
+#include <stdio.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* output is buffered and written in pieces this big */
+#define Q3EXPORT_CHUNK_SIZE (64 * 1024)
+
+enum q3export_format {
+	Q3EXPORT_OBJ,
+	/* binary glTF 2.0 */
+	Q3EXPORT_GLB,
+};
+
+struct q3export_stats {
+	/* one per model, the world first */
+	size_t n_nodes;
+	size_t n_vertices;
+	size_t n_triangles;
+	u64 bytes;
+	/* the exporter's own buffers at their largest, the loaded map not included */
+	size_t peak_memory;
+};
+
+/*
+	Walks models and their faces and writes them out as it goes, so memory stays at one chunk
+	plus the largest face and the map's patches no matter the size of the map. Patches are
+	tessellated once up front at patch_level (0 leaves them out), billboards are skipped. Geometry is converted to Y up with
+	counter clockwise front faces.
+
+	With a lightmap_prefix the lightmaps are packed into atlas_size pages written next to the output
+	as <prefix>_<page>.ppm, and faces are grouped per page. OBJ then gets a <prefix>.mtl and uses
+	atlas coordinates for vt, glTF keeps texture coordinates in TEXCOORD_0 and puts the atlas ones in
+	TEXCOORD_1, naming each page's file in its material's extras (glTF images can't be PPM). Those
+	references use only the prefix's file name, relative to the output's directory.
+
+	Returns 0 on success, like fclose. A GLB that would pass the format's 4 GiB limit isn't
+	written and fails with errno set to EFBIG.
+*/
+int q3export_write(const struct q3bsp* bsp, FILE* out, enum q3export_format format, u32 patch_level,
+	const char* lightmap_prefix, u32 atlas_size, struct q3export_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,232 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "q3halfedge.h"
+#include "q3parallel.h"
+
+#define EMPTY 0xFFFFFFFFU
+
+static u32 hash_cell(i32 x, i32 y, i32 z) {
+	return ((u32)x * 73856093U) ^ ((u32)y * 19349663U) ^ ((u32)z * 83492791U);
+}
+
+/* cells are epsilon wide so anything within epsilon is in the same or a neighbouring one */
+static void weld_positions(const struct q3bsp* bsp, float epsilon, struct q3halfedge_mesh* mesh) {
+	size_t n = bsp->n_vertices;
+	float inv = epsilon > 0.0f? 1.0f / epsilon : 1.0f;
+	float eps2 = epsilon > 0.0f? epsilon * epsilon : 0.0f;
+
+	size_t cap = 1;
+	while(cap < n * 2)
+		cap <<= 1;
+	u32* table = malloc(sizeof(u32) * cap);
+	memset(table, 0xFF, sizeof(u32) * cap);
+	i32 (*cells)[3] = malloc(sizeof(i32[3]) * (n? n : 1));
+	mesh->positions = malloc(sizeof(vec3) * (n? n : 1));
+	mesh->weld = malloc(sizeof(u32) * (n? n : 1));
+	mesh->n_map_vertices = n;
+
+	for(size_t i = 0; i < n; i++) {
+		vec3 p = bsp->vertices[i].pos;
+		i32 c[3] = { (i32)floorf(p.x * inv), (i32)floorf(p.y * inv), (i32)floorf(p.z * inv) };
+		u32 found = EMPTY;
+		for(int d = 0; d < 27 && found == EMPTY; d++) {
+			i32 x = c[0] + d % 3 - 1, y = c[1] + d / 3 % 3 - 1, z = c[2] + d / 9 - 1;
+			for(size_t slot = hash_cell(x, y, z) & (cap - 1); table[slot] != EMPTY; slot = (slot + 1) & (cap - 1)) {
+				u32 id = table[slot];
+				if(cells[id][0] != x || cells[id][1] != y || cells[id][2] != z)
+					continue;
+				vec3 q = mesh->positions[id];
+				float dx = p.x - q.x, dy = p.y - q.y, dz = p.z - q.z;
+				if(dx * dx + dy * dy + dz * dz <= eps2) {
+					found = id;
+					break;
+				}
+			}
+		}
+
+		if(found == EMPTY) {
+			found = mesh->n_positions++;
+			mesh->positions[found] = p;
+			memcpy(cells[found], c, sizeof(c));
+			size_t slot = hash_cell(c[0], c[1], c[2]) & (cap - 1);
+			while(table[slot] != EMPTY)
+				slot = (slot + 1) & (cap - 1);
+			table[slot] = found;
+		}
+		mesh->weld[i] = found;
+	}
+
+	free(cells);
+	free(table);
+}
+
+struct edge_key {
+	/* lower welded vertex in the high half */
+	u64 key;
+	u32 halfedge;
+};
+
+struct link_job {
+	struct q3halfedge_mesh* mesh;
+	struct edge_key* keys;
+	struct edge_key* scratch;
+	/* n_buckets + 1 offsets into keys */
+	const size_t* offsets;
+	/* edges, boundary, nonmanifold per bucket */
+	size_t (*counts)[3];
+};
+
+/* LSD radix, a byte at a time, skipping bytes every key in the bucket agrees on */
+static void sort_keys(struct edge_key* keys, struct edge_key* scratch, size_t n) {
+	for(int shift = 0; shift < 64; shift += 8) {
+		size_t count[256] = { 0 };
+		for(size_t i = 0; i < n; i++)
+			count[(keys[i].key >> shift) & 0xFF]++;
+		if(count[(keys[0].key >> shift) & 0xFF] == n)
+			continue;
+		size_t sum = 0;
+		for(int b = 0; b < 256; b++) {
+			size_t c = count[b];
+			count[b] = sum;
+			sum += c;
+		}
+		for(size_t i = 0; i < n; i++)
+			scratch[count[(keys[i].key >> shift) & 0xFF]++] = keys[i];
+		memcpy(keys, scratch, sizeof(struct edge_key) * n);
+	}
+}
+
+static void link_bucket(void* user, size_t b) {
+	const struct link_job* job = user;
+	struct q3halfedge_mesh* mesh = job->mesh;
+	struct edge_key* keys = job->keys + job->offsets[b];
+	size_t n = job->offsets[b + 1] - job->offsets[b];
+	if(!n)
+		return;
+	sort_keys(keys, job->scratch + job->offsets[b], n);
+
+	size_t* counts = job->counts[b];
+	for(size_t i = 0; i < n;) {
+		size_t j = i + 1;
+		while(j < n && keys[j].key == keys[i].key)
+			j++;
+		counts[0]++;
+
+		u32 h0 = keys[i].halfedge;
+		if(j - i == 1) {
+			mesh->flags[h0] |= Q3HALFEDGE_BOUNDARY;
+			counts[1]++;
+		} else if(j - i == 2 && mesh->halfedges[h0].vertex == mesh->halfedges[q3halfedge_next(keys[i + 1].halfedge)].vertex) {
+			u32 h1 = keys[i + 1].halfedge;
+			mesh->halfedges[h0].twin = h1;
+			mesh->halfedges[h1].twin = h0;
+		} else {
+			for(size_t k = i; k < j; k++)
+				mesh->flags[keys[k].halfedge] |= Q3HALFEDGE_NONMANIFOLD;
+			counts[2]++;
+		}
+		i = j;
+	}
+}
+
+struct q3halfedge_mesh* q3halfedge_build(const struct q3bsp* bsp, float epsilon) {
+	struct q3halfedge_mesh* mesh = calloc(1, sizeof(struct q3halfedge_mesh));
+	weld_positions(bsp, epsilon, mesh);
+
+	size_t max_triangles = 0;
+	for(size_t i = 0; i < bsp->n_faces; i++) {
+		const struct q3face* face = bsp->faces + i;
+		if(face->type == POLYGON || face->type == MESH)
+			max_triangles += face->n_mesh_vertices / 3;
+	}
+	mesh->faces = malloc(sizeof(u32) * (max_triangles? max_triangles : 1));
+	mesh->halfedges = malloc(sizeof(struct q3halfedge) * (max_triangles? max_triangles * 3 : 1));
+
+	for(size_t i = 0; i < bsp->n_faces; i++) {
+		const struct q3face* face = bsp->faces + i;
+		if(face->type != POLYGON && face->type != MESH)
+			continue;
+		if(face->first_vertex_idx < 0 || (size_t)face->first_vertex_idx + face->n_vertices > bsp->n_vertices)
+			continue;
+		if(face->first_mesh_vertex_idx < 0 || (size_t)face->first_mesh_vertex_idx + face->n_mesh_vertices > bsp->n_mesh_verts)
+			continue;
+		for(u32 t = 0; t + 2 < face->n_mesh_vertices; t += 3) {
+			u32 v[3];
+			bool valid = true;
+			for(int k = 0; k < 3; k++) {
+				i32 idx = bsp->mesh_verts[face->first_mesh_vertex_idx + t + k].idx;
+				valid &= idx >= 0 && (u32)idx < face->n_vertices;
+				v[k] = valid? mesh->weld[face->first_vertex_idx + idx] : 0;
+			}
+			if(!valid)
+				continue;
+			if(v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) {
+				mesh->n_degenerate++;
+				continue;
+			}
+			struct q3halfedge* h = mesh->halfedges + mesh->n_triangles * 3;
+			for(int k = 0; k < 3; k++)
+				h[k] = (struct q3halfedge) { v[k], Q3HALFEDGE_NONE };
+			mesh->faces[mesh->n_triangles++] = i;
+		}
+	}
+
+	size_t n = mesh->n_triangles * 3;
+	mesh->flags = calloc(n? n : 1, 1);
+
+	/* buckets by lower vertex, so every copy of an edge lands in the same one */
+	size_t n_buckets = q3_n_threads() * 8;
+	size_t* offsets = calloc(n_buckets + 1, sizeof(size_t));
+	u32* bucket = malloc(sizeof(u32) * (n? n : 1));
+	for(size_t h = 0; h < n; h++) {
+		u32 a = mesh->halfedges[h].vertex, b = mesh->halfedges[q3halfedge_next(h)].vertex;
+		bucket[h] = (u64)(a < b? a : b) * n_buckets / (mesh->n_positions? mesh->n_positions : 1);
+		offsets[bucket[h] + 1]++;
+	}
+	for(size_t b = 0; b < n_buckets; b++)
+		offsets[b + 1] += offsets[b];
+
+	struct edge_key* keys = malloc(sizeof(struct edge_key) * (n? n : 1));
+	size_t* at = malloc(sizeof(size_t) * n_buckets);
+	memcpy(at, offsets, sizeof(size_t) * n_buckets);
+	for(size_t h = 0; h < n; h++) {
+		u32 a = mesh->halfedges[h].vertex, b = mesh->halfedges[q3halfedge_next(h)].vertex;
+		keys[at[bucket[h]]++] = (struct edge_key) { (u64)(a < b? a : b) << 32 | (a < b? b : a), h };
+	}
+
+	struct link_job job = {
+		.mesh = mesh,
+		.keys = keys,
+		.scratch = malloc(sizeof(struct edge_key) * (n? n : 1)),
+		.offsets = offsets,
+		.counts = calloc(n_buckets, sizeof(size_t[3])),
+	};
+	q3_parallel_for(n_buckets, link_bucket, &job);
+	for(size_t b = 0; b < n_buckets; b++) {
+		mesh->n_edges += job.counts[b][0];
+		mesh->n_boundary += job.counts[b][1];
+		mesh->n_nonmanifold += job.counts[b][2];
+	}
+
+	free(job.counts);
+	free(job.scratch);
+	free(at);
+	free(keys);
+	free(bucket);
+	free(offsets);
+	return mesh;
+}
+
+void q3halfedge_free(struct q3halfedge_mesh* mesh) {
+	if(!mesh)
+		return;
+	free(mesh->positions);
+	free(mesh->weld);
+	free(mesh->faces);
+	free(mesh->halfedges);
+	free(mesh->flags);
+	free(mesh);
+}
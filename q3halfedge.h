@@ -0,0 +1,67 @@
+#ifndef Q3_HALFEDGE_H_
+#define Q3_HALFEDGE_H_
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define Q3HALFEDGE_NONE 0xFFFFFFFFU
+
+enum q3halfedge_flags {
+	/* no triangle on the other side */
+	Q3HALFEDGE_BOUNDARY = 1,
+	/* three or more triangles share the edge, or two that wind it the same way */
+	Q3HALFEDGE_NONMANIFOLD = 2,
+};
+
+/*
+	Halfedge h belongs to triangle h / 3 and runs from its vertex to the next one's, so next and
+	prev are implicit. Winding is quake's, clockwise seen from the front.
+*/
+struct q3halfedge {
+	u32 vertex;
+	/* the opposite halfedge, Q3HALFEDGE_NONE unless the edge is manifold */
+	u32 twin;
+};
+
+struct q3halfedge_mesh {
+	/* welded positions, and which of them each map vertex went to */
+	size_t n_positions;
+	vec3* positions;
+	size_t n_map_vertices;
+	u32* weld;
+
+	size_t n_triangles;
+	/* the face each triangle came from */
+	u32* faces;
+	struct q3halfedge* halfedges;
+	u8* flags;
+
+	/* undirected edge counts, plus triangles left out for collapsing under the weld */
+	size_t n_edges;
+	size_t n_boundary;
+	size_t n_nonmanifold;
+	size_t n_degenerate;
+};
+
+static inline u32 q3halfedge_next(u32 h) {
+	return h % 3 == 2? h - 2 : h + 1;
+}
+
+static inline u32 q3halfedge_prev(u32 h) {
+	return h % 3 == 0? h + 2 : h - 1;
+}
+
+/*
+	Welds map vertices closer than epsilon through a spatial hash, then pairs up halfedges of all
+	POLYGON and MESH triangles by sorting their edge keys, buckets sorted and linked in parallel.
+*/
+struct q3halfedge_mesh* q3halfedge_build(const struct q3bsp* bsp, float epsilon);
+void q3halfedge_free(struct q3halfedge_mesh* mesh);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
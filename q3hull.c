@@ -0,0 +1,327 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "q3hull.h"
+#include "q3parallel.h"
+
+/* well past MAX_WORLD_COORD */
+#define BIG 131072.0
+/* points this close to a plane count as on it */
+#define ON_EPSILON 0.01
+/* vertices closer than this are welded, wider than ON_EPSILON so clipping slivers collapse */
+#define WELD_EPSILON 0.05
+/* planes this alike are the same plane */
+#define NORMAL_EPSILON 0.00001
+#define DIST_EPSILON 0.01
+
+/* clipping runs in doubles, q3map's windings do too */
+struct dvec3 {
+	double x, y, z;
+};
+
+static inline double ddot(struct dvec3 a, struct dvec3 b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline struct dvec3 dcross(struct dvec3 a, struct dvec3 b) {
+	return (struct dvec3) { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+struct dplane {
+	struct dvec3 norm;
+	double dist;
+};
+
+/* a square on the plane big enough to cover the whole world */
+static size_t base_winding(struct dplane p, struct dvec3* out) {
+	struct dvec3 up = fabs(p.norm.z) > fabs(p.norm.x) && fabs(p.norm.z) > fabs(p.norm.y)? (struct dvec3) { 1.0, 0.0, 0.0 } : (struct dvec3) { 0.0, 0.0, 1.0 };
+	double d = ddot(up, p.norm);
+	up = (struct dvec3) { up.x - p.norm.x * d, up.y - p.norm.y * d, up.z - p.norm.z * d };
+	double len = sqrt(ddot(up, up));
+	up = (struct dvec3) { up.x / len * BIG, up.y / len * BIG, up.z / len * BIG };
+	struct dvec3 right = dcross(up, p.norm);
+	struct dvec3 org = { p.norm.x * p.dist, p.norm.y * p.dist, p.norm.z * p.dist };
+
+	/* counter clockwise seen from the front */
+	out[0] = (struct dvec3) { org.x - right.x - up.x, org.y - right.y - up.y, org.z - right.z - up.z };
+	out[1] = (struct dvec3) { org.x + right.x - up.x, org.y + right.y - up.y, org.z + right.z - up.z };
+	out[2] = (struct dvec3) { org.x + right.x + up.x, org.y + right.y + up.y, org.z + right.z + up.z };
+	out[3] = (struct dvec3) { org.x - right.x + up.x, org.y - right.y + up.y, org.z - right.z + up.z };
+	return 4;
+}
+
+/* keeps the part of the winding behind the plane, points within ON_EPSILON stay as they are */
+static size_t clip_winding(const struct dvec3* in, size_t n, struct dplane p, struct dvec3* out) {
+	size_t n_out = 0;
+	for(size_t i = 0; i < n; i++) {
+		struct dvec3 a = in[i], b = in[(i + 1) % n];
+		double da = ddot(a, p.norm) - p.dist, db = ddot(b, p.norm) - p.dist;
+		int sa = da > ON_EPSILON? 1 : da < -ON_EPSILON? -1 : 0;
+		int sb = db > ON_EPSILON? 1 : db < -ON_EPSILON? -1 : 0;
+		if(sa <= 0)
+			out[n_out++] = a;
+		if(sa && sb && sa != sb) {
+			double t = da / (da - db);
+			struct dvec3 m = { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t };
+			/* snap exactly onto axial planes so neighbours agree */
+			if(p.norm.x == 1.0 || p.norm.x == -1.0)
+				m.x = p.norm.x * p.dist;
+			if(p.norm.y == 1.0 || p.norm.y == -1.0)
+				m.y = p.norm.y * p.dist;
+			if(p.norm.z == 1.0 || p.norm.z == -1.0)
+				m.z = p.norm.z * p.dist;
+			out[n_out++] = m;
+		}
+	}
+	return n_out;
+}
+
+/* one brush's hull before it's spliced into the set */
+struct brush_out {
+	bool valid;
+	u32 redundant;
+	u32 n_vertices, n_faces, n_indices;
+	vec3* vertices;
+	struct q3hull_face* faces;
+	u32* indices;
+	vec3 mins, maxs;
+};
+
+struct build_job {
+	const struct q3bsp* bsp;
+	const u32* brushes;
+	struct brush_out* out;
+};
+
+static u32 weld(struct brush_out* o, struct dvec3 p) {
+	vec3 v = { p.x, p.y, p.z };
+	for(u32 i = 0; i < o->n_vertices; i++) {
+		vec3 d = { o->vertices[i].x - v.x, o->vertices[i].y - v.y, o->vertices[i].z - v.z };
+		if(d.x * d.x + d.y * d.y + d.z * d.z < WELD_EPSILON * WELD_EPSILON)
+			return i;
+	}
+	o->vertices[o->n_vertices] = v;
+	return o->n_vertices++;
+}
+
+static void build_brush(void* user, size_t i) {
+	const struct build_job* job = user;
+	const struct q3bsp* bsp = job->bsp;
+	const struct q3brush* brush = bsp->brushes + job->brushes[i];
+	struct brush_out* o = job->out + i;
+	u32 n_sides = brush->n_brushsides;
+
+	struct dplane* planes = malloc(sizeof(struct dplane) * (n_sides? n_sides : 1));
+	u32 n_planes = 0;
+	for(u32 s = 0; s < n_sides; s++) {
+		i32 side = brush->first_brushside_idx + s;
+		if(side < 0 || (size_t)side >= bsp->n_brush_sides)
+			continue;
+		i32 plane_idx = bsp->brush_sides[side].plane_idx;
+		if(plane_idx < 0 || (size_t)plane_idx >= bsp->n_planes)
+			continue;
+		const struct plane* p = bsp->planes + plane_idx;
+		struct dplane dp = { { p->norm.x, p->norm.y, p->norm.z }, p->dist };
+
+		/* a plane repeated, exactly or nearly, would give the same face twice */
+		bool duplicate = false;
+		for(u32 k = 0; k < n_planes && !duplicate; k++)
+			duplicate = fabs(planes[k].norm.x - dp.norm.x) < NORMAL_EPSILON && fabs(planes[k].norm.y - dp.norm.y) < NORMAL_EPSILON
+				&& fabs(planes[k].norm.z - dp.norm.z) < NORMAL_EPSILON && fabs(planes[k].dist - dp.dist) < DIST_EPSILON;
+		if(duplicate) {
+			o->redundant++;
+			continue;
+		}
+		planes[n_planes++] = dp;
+	}
+
+	/* every clip can add at most one point */
+	u32 max_points = n_planes + 4;
+	struct dvec3* a = malloc(sizeof(struct dvec3) * max_points);
+	struct dvec3* b = malloc(sizeof(struct dvec3) * max_points);
+	o->vertices = malloc(sizeof(vec3) * (n_planes? n_planes * max_points : 1));
+	o->faces = malloc(sizeof(struct q3hull_face) * (n_planes? n_planes : 1));
+
+	/* clipping decides which sides survive and where the corners are, these are each side's own welded corners */
+	u32* corners = malloc(sizeof(u32) * (n_planes? n_planes * max_points : 1));
+	u32* n_corners = calloc(n_planes? n_planes : 1, sizeof(u32));
+	for(u32 s = 0; s < n_planes; s++) {
+		size_t n = base_winding(planes[s], a);
+		for(u32 k = 0; k < n_planes && n; k++) {
+			if(k == s)
+				continue;
+			n = clip_winding(a, n, planes[k], b);
+			struct dvec3* t = a;
+			a = b;
+			b = t;
+		}
+		u32* own = corners + s * max_points;
+		for(size_t k = 0; k < n; k++) {
+			u32 v = weld(o, a[k]), j = 0;
+			while(j < n_corners[s] && own[j] != v)
+				j++;
+			if(j == n_corners[s])
+				own[n_corners[s]++] = v;
+		}
+		/* slivers thinner than the weld collapse to a line */
+		if(n_corners[s] < 3)
+			n_corners[s] = 0;
+	}
+
+	/*
+		Faces are then rebuilt from their own corners plus any other corner on their plane. Windings
+		clipped with epsilons can disagree about a corner on a sliver edge, this way the faces either
+		side of an edge always share the same corners.
+	*/
+	o->indices = malloc(sizeof(u32) * (n_planes && o->n_vertices? n_planes * o->n_vertices : 1));
+	u32* ring = malloc(sizeof(u32) * (o->n_vertices? o->n_vertices : 1));
+	double* angle = malloc(sizeof(double) * (o->n_vertices? o->n_vertices : 1));
+	for(u32 s = 0; s < n_planes; s++) {
+		if(!n_corners[s]) {
+			o->redundant++;
+			continue;
+		}
+		struct dplane p = planes[s];
+		u32 count = 0;
+		struct dvec3 c = { 0.0, 0.0, 0.0 };
+		for(u32 k = 0; k < o->n_vertices; k++) {
+			struct dvec3 v = { o->vertices[k].x, o->vertices[k].y, o->vertices[k].z };
+			bool own = false;
+			for(u32 j = 0; j < n_corners[s] && !own; j++)
+				own = corners[s * max_points + j] == k;
+			if(!own && fabs(ddot(v, p.norm) - p.dist) > ON_EPSILON)
+				continue;
+			ring[count++] = k;
+			c = (struct dvec3) { c.x + v.x, c.y + v.y, c.z + v.z };
+		}
+		if(count < 3) {
+			o->redundant++;
+			continue;
+		}
+		c = (struct dvec3) { c.x / count, c.y / count, c.z / count };
+
+		/* counter clockwise around the normal, insertion sort as there are only a handful */
+		struct dvec3 u = fabs(p.norm.x) < 0.9? (struct dvec3) { 1.0, 0.0, 0.0 } : (struct dvec3) { 0.0, 1.0, 0.0 };
+		u = dcross(dcross(p.norm, u), p.norm);
+		struct dvec3 v = dcross(p.norm, u);
+		for(u32 k = 0; k < count; k++) {
+			const vec3* q = o->vertices + ring[k];
+			struct dvec3 d = { q->x - c.x, q->y - c.y, q->z - c.z };
+			double t = atan2(ddot(d, v), ddot(d, u));
+			u32 id = ring[k], j = k;
+			for(; j > 0 && angle[j - 1] > t; j--) {
+				angle[j] = angle[j - 1];
+				ring[j] = ring[j - 1];
+			}
+			angle[j] = t;
+			ring[j] = id;
+		}
+
+		memcpy(o->indices + o->n_indices, ring, sizeof(u32) * count);
+		o->faces[o->n_faces++] = (struct q3hull_face) {
+			.norm = { p.norm.x, p.norm.y, p.norm.z },
+			.dist = p.dist,
+			.first_index = o->n_indices,
+			.n_indices = count,
+		};
+		o->n_indices += count;
+	}
+	free(angle);
+	free(ring);
+	free(n_corners);
+	free(corners);
+
+	/* anything that closes a volume needs at least a tetrahedron's worth */
+	o->valid = o->n_faces >= 4 && o->n_vertices >= 4;
+	if(o->valid) {
+		o->mins = o->maxs = o->vertices[0];
+		for(u32 k = 1; k < o->n_vertices; k++) {
+			vec3 v = o->vertices[k];
+			o->mins = (vec3) { fminf(o->mins.x, v.x), fminf(o->mins.y, v.y), fminf(o->mins.z, v.z) };
+			o->maxs = (vec3) { fmaxf(o->maxs.x, v.x), fmaxf(o->maxs.y, v.y), fmaxf(o->maxs.z, v.z) };
+		}
+		/* a face still touching BIG means the sides never closed */
+		o->valid = o->maxs.x - o->mins.x < BIG && o->maxs.y - o->mins.y < BIG && o->maxs.z - o->mins.z < BIG;
+	}
+
+	free(b);
+	free(a);
+	free(planes);
+}
+
+struct q3hull_set* q3hull_build(const struct q3bsp* bsp, u32 contents) {
+	struct q3hull_set* set = calloc(1, sizeof(struct q3hull_set));
+
+	u32* brushes = malloc(sizeof(u32) * (bsp->n_brushes? bsp->n_brushes : 1));
+	size_t n = 0;
+	for(size_t i = 0; i < bsp->n_brushes; i++) {
+		i32 tex = bsp->brushes[i].texture_idx;
+		u32 c = tex >= 0 && (size_t)tex < bsp->n_textures? (u32)bsp->textures[tex].contents : 0;
+		if(contents == ~0U || (c & contents))
+			brushes[n++] = i;
+	}
+
+	struct brush_out* out = calloc(n? n : 1, sizeof(struct brush_out));
+	struct build_job job = { bsp, brushes, out };
+	q3_parallel_for(n, build_brush, &job);
+
+	for(size_t i = 0; i < n; i++) {
+		set->n_redundant += out[i].redundant;
+		if(!out[i].valid) {
+			set->n_degenerate++;
+			continue;
+		}
+		set->n_hulls++;
+		set->n_vertices += out[i].n_vertices;
+		set->n_faces += out[i].n_faces;
+		set->n_indices += out[i].n_indices;
+	}
+	set->hulls = malloc(sizeof(struct q3hull) * (set->n_hulls? set->n_hulls : 1));
+	set->vertices = malloc(sizeof(vec3) * (set->n_vertices? set->n_vertices : 1));
+	set->faces = malloc(sizeof(struct q3hull_face) * (set->n_faces? set->n_faces : 1));
+	set->indices = malloc(sizeof(u32) * (set->n_indices? set->n_indices : 1));
+
+	size_t h = 0, v = 0, f = 0, idx = 0;
+	for(size_t i = 0; i < n; i++) {
+		struct brush_out* o = out + i;
+		if(o->valid) {
+			set->hulls[h++] = (struct q3hull) {
+				.brush = brushes[i],
+				.mins = o->mins,
+				.maxs = o->maxs,
+				.first_vertex = v,
+				.n_vertices = o->n_vertices,
+				.first_face = f,
+				.n_faces = o->n_faces,
+			};
+			memcpy(set->vertices + v, o->vertices, sizeof(vec3) * o->n_vertices);
+			for(u32 k = 0; k < o->n_faces; k++) {
+				set->faces[f + k] = o->faces[k];
+				set->faces[f + k].first_index += idx;
+			}
+			memcpy(set->indices + idx, o->indices, sizeof(u32) * o->n_indices);
+			v += o->n_vertices;
+			f += o->n_faces;
+			idx += o->n_indices;
+		}
+		free(o->vertices);
+		free(o->faces);
+		free(o->indices);
+	}
+
+	free(out);
+	free(brushes);
+	return set;
+}
+
+void q3hull_free(struct q3hull_set* set) {
+	if(!set)
+		return;
+	free(set->hulls);
+	free(set->vertices);
+	free(set->faces);
+	free(set->indices);
+	free(set);
+}
@@ -0,0 +1,58 @@
+#ifndef Q3_HULL_H_
+#define Q3_HULL_H_
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the q3map content bit for solid brushes */
+#define Q3HULL_CONTENTS_SOLID 1
+
+/* one polygon of a hull, indices run counter clockwise seen from outside */
+struct q3hull_face {
+	vec3 norm;
+	float dist;
+	u32 first_index;
+	u32 n_indices;
+};
+
+/* a brush as an explicit convex polytope, ranges are into the set's arrays */
+struct q3hull {
+	i32 brush;
+	vec3 mins, maxs;
+	u32 first_vertex;
+	u32 n_vertices;
+	u32 first_face;
+	u32 n_faces;
+};
+
+struct q3hull_set {
+	size_t n_hulls;
+	struct q3hull* hulls;
+	size_t n_vertices;
+	vec3* vertices;
+	size_t n_faces;
+	struct q3hull_face* faces;
+	/* relative to the hull's first_vertex */
+	size_t n_indices;
+	u32* indices;
+
+	/* sides that never touched the volume, bevels mostly, and brushes that came out empty */
+	size_t n_redundant;
+	size_t n_degenerate;
+};
+
+/*
+	Converts every brush whose texture has any of the contents bits set (~0 for all of them),
+	one task per brush. Each side's plane gets a huge polygon that is clipped by every other side,
+	whatever survives is a face. Sides that clip away to nothing are dropped as redundant.
+*/
+struct q3hull_set* q3hull_build(const struct q3bsp* bsp, u32 contents);
+void q3hull_free(struct q3hull_set* set);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,284 @@
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "q3lightgrid.h"
+
+/* floats per cell, for indexing the cells as one flat float array */
+#define CELL_FLOATS (sizeof(struct q3lightgrid_cell) / sizeof(float))
+
+vec3 q3lightgrid_decode_dir(bvec2 dir) {
+	/* same as R_SetupEntityLightingGrid: first byte is longitude from +z, second is latitude, 256 steps a turn */
+	const float scale = 2.0f * (float)M_PI / 256.0f;
+	float lng = dir.phi * scale;
+	float lat = dir.theta * scale;
+	return (vec3) {
+		cosf(lat) * sinf(lng),
+		sinf(lat) * sinf(lng),
+		cosf(lng),
+	};
+}
+
+/* "gridsize" only ever appears on worldspawn, which is always the first entity */
+static void grid_size(const struct q3bsp* bsp, vec3* size) {
+	*size = (vec3) { Q3LIGHTGRID_CELL_X, Q3LIGHTGRID_CELL_Y, Q3LIGHTGRID_CELL_Z };
+
+	const char* end = strchr(bsp->entities, '}');
+	const char* key = strstr(bsp->entities, "\"gridsize\"");
+	if(!key || (end && key > end))
+		return;
+
+	vec3 v;
+	if(sscanf(key + sizeof("\"gridsize\"") - 1, " \"%f %f %f\"", &v.x, &v.y, &v.z) == 3 && v.x > 0 && v.y > 0 && v.z > 0)
+		*size = v;
+}
+
+bool q3lightgrid_init(const struct q3bsp* bsp, struct q3lightgrid* grid) {
+	memset(grid, 0, sizeof(*grid));
+	if(!bsp->n_models)
+		return false;
+
+	grid_size(bsp, &grid->cell_size);
+	grid->inv_cell_size = (vec3) { 1.0f / grid->cell_size.x, 1.0f / grid->cell_size.y, 1.0f / grid->cell_size.z };
+
+	/* grid covers the world model snapped inwards to whole cells, as in R_LoadLightGrid */
+	const vec3 mins = bsp->models[0].mins;
+	const vec3 maxs = bsp->models[0].maxs;
+	vec3 origin = {
+		grid->cell_size.x * ceilf(mins.x / grid->cell_size.x),
+		grid->cell_size.y * ceilf(mins.y / grid->cell_size.y),
+		grid->cell_size.z * ceilf(mins.z / grid->cell_size.z),
+	};
+	grid->origin = origin;
+	grid->bounds[0] = (i32)(floorf(maxs.x / grid->cell_size.x) - origin.x / grid->cell_size.x) + 1;
+	grid->bounds[1] = (i32)(floorf(maxs.y / grid->cell_size.y) - origin.y / grid->cell_size.y) + 1;
+	grid->bounds[2] = (i32)(floorf(maxs.z / grid->cell_size.z) - origin.z / grid->cell_size.z) + 1;
+
+	size_t n = (size_t)grid->bounds[0] * grid->bounds[1] * grid->bounds[2];
+	if(n == 0 || n != bsp->n_lightvols)
+		return false;
+
+	grid->n_cells = n;
+	grid->cells = aligned_alloc(64, (n * sizeof(struct q3lightgrid_cell) + 63) & ~(size_t)63);
+	for(size_t i = 0; i < n; i++) {
+		const struct q3lightvol* vol = bsp->lightvols + i;
+		struct q3lightgrid_cell* cell = grid->cells + i;
+		for(int c = 0; c < 3; c++) {
+			cell->ambient[c] = vol->ambient.color[c] / 255.0f;
+			cell->directed[c] = vol->directional.color[c] / 255.0f;
+		}
+		vec3 dir = q3lightgrid_decode_dir(vol->dir);
+		cell->dir[0] = dir.x;
+		cell->dir[1] = dir.y;
+		cell->dir[2] = dir.z;
+		cell->valid = (vol->ambient.r | vol->ambient.g | vol->ambient.b)? 1.0f : 0.0f;
+		cell->pad[0] = cell->pad[1] = 0.0f;
+	}
+
+	return true;
+}
+
+void q3lightgrid_free(struct q3lightgrid* grid) {
+	free(grid->cells);
+	grid->cells = NULL;
+	grid->n_cells = 0;
+}
+
+/* cell coordinate along one axis, clamped so the +1 neighbour stays inside the grid */
+static void axis(float v, i32 bounds, i32* pos, i32* next, float* frac) {
+	v = fminf(fmaxf(v, 0.0f), (float)(bounds - 1));
+	float f = floorf(v);
+	*pos = (i32)f;
+	*next = *pos + 1 < bounds? *pos + 1 : *pos;
+	*frac = v - f;
+}
+
+static void finish(float acc[9], float total, struct q3light_sample* out) {
+	float inv = total > 0.0f? 1.0f / total : 0.0f;
+	out->ambient = (vec3) { acc[0] * inv, acc[1] * inv, acc[2] * inv };
+	out->directed = (vec3) { acc[3] * inv, acc[4] * inv, acc[5] * inv };
+	float len = sqrtf(acc[6] * acc[6] + acc[7] * acc[7] + acc[8] * acc[8]);
+	float ilen = len > 0.0f? 1.0f / len : 0.0f;
+	out->dir = (vec3) { acc[6] * ilen, acc[7] * ilen, acc[8] * ilen };
+}
+
+void q3lightgrid_sample(const struct q3lightgrid* grid, vec3 p, struct q3light_sample* out) {
+	i32 pos[3], next[3];
+	float frac[3];
+	axis((p.x - grid->origin.x) * grid->inv_cell_size.x, grid->bounds[0], pos + 0, next + 0, frac + 0);
+	axis((p.y - grid->origin.y) * grid->inv_cell_size.y, grid->bounds[1], pos + 1, next + 1, frac + 1);
+	axis((p.z - grid->origin.z) * grid->inv_cell_size.z, grid->bounds[2], pos + 2, next + 2, frac + 2);
+
+	const i32 sy = grid->bounds[0], sz = grid->bounds[0] * grid->bounds[1];
+	float acc[9] = { 0 }, total = 0.0f;
+	for(int c = 0; c < 8; c++) {
+		i32 x = c & 1? next[0] : pos[0];
+		i32 y = c & 2? next[1] : pos[1];
+		i32 z = c & 4? next[2] : pos[2];
+		float f = (c & 1? frac[0] : 1.0f - frac[0])
+			* (c & 2? frac[1] : 1.0f - frac[1])
+			* (c & 4? frac[2] : 1.0f - frac[2]);
+
+		const struct q3lightgrid_cell* cell = grid->cells + x + y * sy + z * sz;
+		f *= cell->valid;
+		const float* v = cell->ambient;
+		for(int k = 0; k < 9; k++)
+			acc[k] += f * v[k];
+		total += f;
+	}
+
+	finish(acc, total, out);
+}
+
+#if defined(__AVX2__)
+#define LANES 8
+
+static void sample_lanes(const struct q3lightgrid* grid, const vec3* p, struct q3light_sample* out) {
+	const float* base = (const float*)grid->cells;
+	/* points are AoS, so gather with a stride of 3 floats */
+	const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	const float* pf = (const float*)p;
+	const __m256 vp[3] = {
+		_mm256_i32gather_ps(pf + 0, stride, 4),
+		_mm256_i32gather_ps(pf + 1, stride, 4),
+		_mm256_i32gather_ps(pf + 2, stride, 4),
+	};
+	const float origin[3] = { grid->origin.x, grid->origin.y, grid->origin.z };
+	const float inv[3] = { grid->inv_cell_size.x, grid->inv_cell_size.y, grid->inv_cell_size.z };
+
+	__m256i pos[3], next[3];
+	__m256 frac[3];
+	for(int a = 0; a < 3; a++) {
+		__m256 hi = _mm256_set1_ps((float)(grid->bounds[a] - 1));
+		__m256 v = _mm256_mul_ps(_mm256_sub_ps(vp[a], _mm256_set1_ps(origin[a])), _mm256_set1_ps(inv[a]));
+		v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), hi);
+		__m256 f = _mm256_floor_ps(v);
+		frac[a] = _mm256_sub_ps(v, f);
+		pos[a] = _mm256_cvttps_epi32(f);
+		next[a] = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_add_ps(f, _mm256_set1_ps(1.0f)), hi));
+	}
+
+	const __m256i sy = _mm256_set1_epi32(grid->bounds[0]);
+	const __m256i sz = _mm256_set1_epi32(grid->bounds[0] * grid->bounds[1]);
+	const __m256i cell_floats = _mm256_set1_epi32(CELL_FLOATS);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256 acc[9], total = _mm256_setzero_ps();
+	for(int k = 0; k < 9; k++)
+		acc[k] = _mm256_setzero_ps();
+
+	for(int c = 0; c < 8; c++) {
+		__m256i x = c & 1? next[0] : pos[0];
+		__m256i y = c & 2? next[1] : pos[1];
+		__m256i z = c & 4? next[2] : pos[2];
+		__m256 f = _mm256_mul_ps(
+			_mm256_mul_ps(c & 1? frac[0] : _mm256_sub_ps(one, frac[0]), c & 2? frac[1] : _mm256_sub_ps(one, frac[1])),
+			c & 4? frac[2] : _mm256_sub_ps(one, frac[2]));
+
+		__m256i idx = _mm256_add_epi32(x, _mm256_add_epi32(_mm256_mullo_epi32(y, sy), _mm256_mullo_epi32(z, sz)));
+		idx = _mm256_mullo_epi32(idx, cell_floats);
+		f = _mm256_mul_ps(f, _mm256_i32gather_ps(base + 9, idx, 4));
+		for(int k = 0; k < 9; k++)
+			acc[k] = _mm256_add_ps(acc[k], _mm256_mul_ps(f, _mm256_i32gather_ps(base + k, idx, 4)));
+		total = _mm256_add_ps(total, f);
+	}
+
+	float a[9][LANES], t[LANES];
+	for(int k = 0; k < 9; k++)
+		_mm256_storeu_ps(a[k], acc[k]);
+	_mm256_storeu_ps(t, total);
+	for(int l = 0; l < LANES; l++) {
+		float v[9];
+		for(int k = 0; k < 9; k++)
+			v[k] = a[k][l];
+		finish(v, t[l], out + l);
+	}
+}
+
+#elif defined(__SSE2__)
+#define LANES 4
+
+/* SSE2 has no gather, so pull the lanes out and load them one by one */
+static inline __m128 gather4(const float* base, __m128i idx) {
+	i32 i[4];
+	_mm_storeu_si128((__m128i*)i, idx);
+	return _mm_setr_ps(base[i[0]], base[i[1]], base[i[2]], base[i[3]]);
+}
+
+static inline __m128 floor4(__m128 v) {
+	/* inputs are clamped to >= 0 so truncation is floor */
+	return _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+}
+
+static void sample_lanes(const struct q3lightgrid* grid, const vec3* p, struct q3light_sample* out) {
+	const float* base = (const float*)grid->cells;
+	const __m128 vp[3] = {
+		_mm_setr_ps(p[0].x, p[1].x, p[2].x, p[3].x),
+		_mm_setr_ps(p[0].y, p[1].y, p[2].y, p[3].y),
+		_mm_setr_ps(p[0].z, p[1].z, p[2].z, p[3].z),
+	};
+	const float origin[3] = { grid->origin.x, grid->origin.y, grid->origin.z };
+	const float inv[3] = { grid->inv_cell_size.x, grid->inv_cell_size.y, grid->inv_cell_size.z };
+
+	/* index math stays in float, exact for any grid below 2^24 cells */
+	__m128 pos[3], next[3], frac[3];
+	for(int a = 0; a < 3; a++) {
+		__m128 hi = _mm_set1_ps((float)(grid->bounds[a] - 1));
+		__m128 v = _mm_mul_ps(_mm_sub_ps(vp[a], _mm_set1_ps(origin[a])), _mm_set1_ps(inv[a]));
+		v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), hi);
+		pos[a] = floor4(v);
+		frac[a] = _mm_sub_ps(v, pos[a]);
+		next[a] = _mm_min_ps(_mm_add_ps(pos[a], _mm_set1_ps(1.0f)), hi);
+	}
+
+	const __m128 sy = _mm_set1_ps((float)grid->bounds[0]);
+	const __m128 sz = _mm_set1_ps((float)grid->bounds[0] * grid->bounds[1]);
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128 acc[9], total = _mm_setzero_ps();
+	for(int k = 0; k < 9; k++)
+		acc[k] = _mm_setzero_ps();
+
+	for(int c = 0; c < 8; c++) {
+		__m128 x = c & 1? next[0] : pos[0];
+		__m128 y = c & 2? next[1] : pos[1];
+		__m128 z = c & 4? next[2] : pos[2];
+		__m128 f = _mm_mul_ps(
+			_mm_mul_ps(c & 1? frac[0] : _mm_sub_ps(one, frac[0]), c & 2? frac[1] : _mm_sub_ps(one, frac[1])),
+			c & 4? frac[2] : _mm_sub_ps(one, frac[2]));
+
+		__m128i idx = _mm_cvttps_epi32(_mm_add_ps(x, _mm_add_ps(_mm_mul_ps(y, sy), _mm_mul_ps(z, sz))));
+		/* times 12 floats per cell */
+		idx = _mm_add_epi32(_mm_slli_epi32(idx, 3), _mm_slli_epi32(idx, 2));
+		f = _mm_mul_ps(f, gather4(base + 9, idx));
+		for(int k = 0; k < 9; k++)
+			acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(f, gather4(base + k, idx)));
+		total = _mm_add_ps(total, f);
+	}
+
+	float a[9][LANES], t[LANES];
+	for(int k = 0; k < 9; k++)
+		_mm_storeu_ps(a[k], acc[k]);
+	_mm_storeu_ps(t, total);
+	for(int l = 0; l < LANES; l++) {
+		float v[9];
+		for(int k = 0; k < 9; k++)
+			v[k] = a[k][l];
+		finish(v, t[l], out + l);
+	}
+}
+#endif
+
+void q3lightgrid_sample_n(const struct q3lightgrid* grid, const vec3* p, size_t n, struct q3light_sample* out) {
+	size_t i = 0;
+#ifdef LANES
+	for(; i + LANES <= n; i += LANES)
+		sample_lanes(grid, p + i, out + i);
+#endif
+	/* tail */
+	for(; i < n; i++)
+		q3lightgrid_sample(grid, p[i], out + i);
+}
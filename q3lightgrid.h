@@ -0,0 +1,57 @@
+#ifndef Q3_LIGHTGRID_H_
+#define Q3_LIGHTGRID_H_
+
+#include <stdbool.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* q3map's default gridsize, worldspawn can override it with "gridsize" */
+#define Q3LIGHTGRID_CELL_X 64.0f
+#define Q3LIGHTGRID_CELL_Y 64.0f
+#define Q3LIGHTGRID_CELL_Z 128.0f
+
+/* one lightvol decoded to floats, padded to 48 bytes so SIMD can gather by index */
+struct q3lightgrid_cell {
+	float ambient[3];
+	float directed[3];
+	float dir[3];
+	/* 0 for samples inside solid, which have all-black ambient */
+	float valid;
+	float pad[2];
+};
+
+struct q3lightgrid {
+	vec3 origin;
+	vec3 cell_size;
+	vec3 inv_cell_size;
+	i32 bounds[3];
+	size_t n_cells;
+	struct q3lightgrid_cell* cells;
+};
+
+/* colors are in 0-1 without overbright applied, dir points towards the light */
+struct q3light_sample {
+	vec3 ambient;
+	vec3 directed;
+	vec3 dir;
+};
+
+/* false if the lump doesn't match the grid implied by model 0 */
+bool q3lightgrid_init(const struct q3bsp* bsp, struct q3lightgrid* grid);
+void q3lightgrid_free(struct q3lightgrid* grid);
+
+vec3 q3lightgrid_decode_dir(bvec2 dir);
+
+/* trilinear over the 8 surrounding samples, skipping the ones in solid */
+void q3lightgrid_sample(const struct q3lightgrid* grid, vec3 p, struct q3light_sample* out);
+/* same thing, 8 points at a time with AVX2 or 4 with SSE */
+void q3lightgrid_sample_n(const struct q3lightgrid* grid, const vec3* p, size_t n, struct q3light_sample* out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
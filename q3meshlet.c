@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "q3meshlet.h"
+#include "q3parallel.h"
+
+/* once half full, a triangle bending further than this off the meshlet's average normal starts a new one */
+#define CONE_SPLIT 0.25f
+/* cones any wider than this never cull anything */
+#define CONE_MIN_DOT 0.1f
+
+static inline vec3 sub(vec3 a, vec3 b) {
+	return (vec3) { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+static inline float dot(vec3 a, vec3 b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline vec3 normalize(vec3 v) {
+	float len = sqrtf(dot(v, v));
+	return len > 0.0f? (vec3) { v.x / len, v.y / len, v.z / len } : (vec3) { 0.0f, 0.0f, 0.0f };
+}
+
+/* quake's front faces wind clockwise */
+static vec3 triangle_normal(vec3 a, vec3 b, vec3 c) {
+	vec3 u = sub(c, a), v = sub(b, a);
+	return normalize((vec3) { u.y * v.z - u.z * v.y, u.z * v.x - u.x * v.z, u.x * v.y - u.y * v.x });
+}
+
+/* spreads the low 10 bits out to every third bit */
+static u32 part1by2(u32 x) {
+	x &= 0x3FF;
+	x = (x | (x << 16)) & 0x030000FF;
+	x = (x | (x << 8)) & 0x0300F00F;
+	x = (x | (x << 4)) & 0x030C30C3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+/* output of one model, concatenated once every model is done */
+struct model_out {
+	size_t n_meshlets, cap_meshlets;
+	struct q3meshlet* meshlets;
+	size_t n_vertex_refs, cap_vertex_refs;
+	u32* vertex_refs;
+	size_t n_triangles, cap_triangles;
+	u8* triangles;
+};
+
+struct build_job {
+	const struct q3bsp* bsp;
+	struct model_out* out;
+};
+
+static bool face_usable(const struct q3bsp* bsp, const struct q3face* face) {
+	return (face->type == POLYGON || face->type == MESH) && face->n_mesh_vertices >= 3
+		&& face->first_vertex_idx >= 0 && (size_t)face->first_vertex_idx + face->n_vertices <= bsp->n_vertices
+		&& face->first_mesh_vertex_idx >= 0 && (size_t)face->first_mesh_vertex_idx + face->n_mesh_vertices <= bsp->n_mesh_verts;
+}
+
+/* Ritter's sphere, seeded with the most distant pair of axis extremes */
+static void bounding_sphere(const struct q3bsp* bsp, const u32* refs, u32 n, vec3* center, float* radius) {
+	u32 lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+	for(u32 i = 1; i < n; i++) {
+		const float* p = &bsp->vertices[refs[i]].pos.x;
+		for(int k = 0; k < 3; k++) {
+			if(p[k] < (&bsp->vertices[refs[lo[k]]].pos.x)[k])
+				lo[k] = i;
+			if(p[k] > (&bsp->vertices[refs[hi[k]]].pos.x)[k])
+				hi[k] = i;
+		}
+	}
+	int axis = 0;
+	float best = -1.0f;
+	for(int k = 0; k < 3; k++) {
+		vec3 d = sub(bsp->vertices[refs[hi[k]]].pos, bsp->vertices[refs[lo[k]]].pos);
+		if(dot(d, d) > best) {
+			best = dot(d, d);
+			axis = k;
+		}
+	}
+
+	vec3 a = bsp->vertices[refs[lo[axis]]].pos, b = bsp->vertices[refs[hi[axis]]].pos;
+	vec3 c = { (a.x + b.x) * 0.5f, (a.y + b.y) * 0.5f, (a.z + b.z) * 0.5f };
+	float r = sqrtf(best) * 0.5f;
+	for(u32 i = 0; i < n; i++) {
+		vec3 d = sub(bsp->vertices[refs[i]].pos, c);
+		float dist = sqrtf(dot(d, d));
+		if(dist > r) {
+			/* grow just enough to take the point, moving the centre towards it */
+			float grow = (dist - r) * 0.5f;
+			r += grow;
+			c = (vec3) { c.x + d.x / dist * grow, c.y + d.y / dist * grow, c.z + d.z / dist * grow };
+		}
+	}
+	*center = c;
+	*radius = r;
+}
+
+static void finish_meshlet(const struct q3bsp* bsp, struct model_out* out, struct q3meshlet* m) {
+	const u32* refs = out->vertex_refs + m->first_vertex;
+	const u8* tris = out->triangles + m->first_triangle * 3;
+	bounding_sphere(bsp, refs, m->n_vertices, &m->center, &m->radius);
+
+	vec3 sum = { 0.0f, 0.0f, 0.0f };
+	for(u32 t = 0; t < m->n_triangles; t++) {
+		vec3 n = triangle_normal(bsp->vertices[refs[tris[3 * t]]].pos, bsp->vertices[refs[tris[3 * t + 1]]].pos,
+			bsp->vertices[refs[tris[3 * t + 2]]].pos);
+		sum = (vec3) { sum.x + n.x, sum.y + n.y, sum.z + n.z };
+	}
+	vec3 axis = normalize(sum);
+
+	float min_dot = 1.0f;
+	for(u32 t = 0; t < m->n_triangles; t++) {
+		vec3 n = triangle_normal(bsp->vertices[refs[tris[3 * t]]].pos, bsp->vertices[refs[tris[3 * t + 1]]].pos,
+			bsp->vertices[refs[tris[3 * t + 2]]].pos);
+		/* degenerate triangles face nowhere and don't constrain the cone */
+		if(dot(n, n) > 0.0f)
+			min_dot = fminf(min_dot, dot(n, axis));
+	}
+
+	m->cone_axis = axis;
+	m->cone_apex = m->center;
+	if(min_dot <= CONE_MIN_DOT || dot(axis, axis) == 0.0f) {
+		m->cone_cutoff = 1.0f;
+		return;
+	}
+
+	/* slide the apex back along the axis until it's behind every triangle's plane */
+	float max_t = 0.0f;
+	for(u32 t = 0; t < m->n_triangles; t++) {
+		vec3 p0 = bsp->vertices[refs[tris[3 * t]]].pos;
+		vec3 n = triangle_normal(p0, bsp->vertices[refs[tris[3 * t + 1]]].pos, bsp->vertices[refs[tris[3 * t + 2]]].pos);
+		float dn = dot(axis, n);
+		if(dot(n, n) == 0.0f || dn <= 0.0f)
+			continue;
+		max_t = fmaxf(max_t, dot(sub(m->center, p0), n) / dn);
+	}
+	m->cone_apex = (vec3) { m->center.x - axis.x * max_t, m->center.y - axis.y * max_t, m->center.z - axis.z * max_t };
+	m->cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+}
+
+struct triangle_key {
+	u64 key;
+	/* the face and the triangle's first mesh vert, which keep faces together on ties */
+	u32 face;
+	u32 first;
+	u32 v[3];
+};
+
+static int cmp_triangle_key(const void* a, const void* b) {
+	const struct triangle_key* x = a;
+	const struct triangle_key* y = b;
+	if(x->key != y->key)
+		return x->key < y->key? -1 : 1;
+	if(x->face != y->face)
+		return x->face < y->face? -1 : 1;
+	return x->first < y->first? -1 : x->first > y->first;
+}
+
+static void build_model(void* user, size_t model_idx) {
+	const struct build_job* job = user;
+	const struct q3bsp* bsp = job->bsp;
+	const struct q3model* model = bsp->models + model_idx;
+	struct model_out* out = job->out + model_idx;
+
+	size_t n_tris = 0;
+	u32 v_lo = ~0U, v_hi = 0;
+	for(u32 i = 0; i < model->n_faces; i++) {
+		u32 f = model->face_start_idx + i;
+		if(f >= bsp->n_faces || !face_usable(bsp, bsp->faces + f))
+			continue;
+		const struct q3face* face = bsp->faces + f;
+		n_tris += face->n_mesh_vertices / 3;
+		if((u32)face->first_vertex_idx < v_lo)
+			v_lo = face->first_vertex_idx;
+		if(face->first_vertex_idx + face->n_vertices > v_hi)
+			v_hi = face->first_vertex_idx + face->n_vertices;
+	}
+
+	/*
+		Triangles are grouped by which axis their normal leans along, then walked in morton order
+		of their face's centre, so meshlets stay compact and get narrow normal cones. This goes per
+		triangle rather than per face as a single MESH face can point every which way.
+	*/
+	struct triangle_key* order = malloc(sizeof(struct triangle_key) * (n_tris? n_tris : 1));
+	size_t n = 0;
+	vec3 size = sub(model->maxs, model->mins);
+	for(u32 i = 0; i < model->n_faces; i++) {
+		u32 f = model->face_start_idx + i;
+		if(f >= bsp->n_faces || !face_usable(bsp, bsp->faces + f))
+			continue;
+		const struct q3face* face = bsp->faces + f;
+		vec3 c = { 0.0f, 0.0f, 0.0f };
+		for(u32 k = 0; k < face->n_vertices; k++) {
+			vec3 p = bsp->vertices[face->first_vertex_idx + k].pos;
+			c = (vec3) { c.x + p.x, c.y + p.y, c.z + p.z };
+		}
+		u32 q[3];
+		for(int k = 0; k < 3; k++) {
+			float extent = (&size.x)[k] > 0.0f? (&size.x)[k] : 1.0f;
+			float t = ((&c.x)[k] / face->n_vertices - (&model->mins.x)[k]) / extent;
+			q[k] = (u32)fminf(fmaxf(t * 1023.0f, 0.0f), 1023.0f);
+		}
+		u32 morton = part1by2(q[0]) | part1by2(q[1]) << 1 | part1by2(q[2]) << 2;
+
+		for(u32 t = 0; t + 2 < face->n_mesh_vertices; t += 3) {
+			struct triangle_key* tk = order + n;
+			bool valid = true;
+			for(int k = 0; k < 3; k++) {
+				i32 idx = bsp->mesh_verts[face->first_mesh_vertex_idx + t + k].idx;
+				valid &= idx >= 0 && (u32)idx < face->n_vertices;
+				tk->v[k] = face->first_vertex_idx + idx;
+			}
+			if(!valid)
+				continue;
+			vec3 nrm = triangle_normal(bsp->vertices[tk->v[0]].pos, bsp->vertices[tk->v[1]].pos, bsp->vertices[tk->v[2]].pos);
+			int axis = fabsf(nrm.x) >= fabsf(nrm.y) && fabsf(nrm.x) >= fabsf(nrm.z)? 0 : fabsf(nrm.y) >= fabsf(nrm.z)? 1 : 2;
+			u64 direction = axis * 2 + ((&nrm.x)[axis] < 0.0f);
+			tk->key = direction << 32 | morton;
+			tk->face = f;
+			tk->first = t;
+			n++;
+		}
+	}
+	qsort(order, n, sizeof(struct triangle_key), cmp_triangle_key);
+
+	/* worst cases, one meshlet per triangle and three fresh vertices each */
+	out->cap_meshlets = n? n : 1;
+	out->cap_vertex_refs = n? n * 3 : 1;
+	out->cap_triangles = n? n * 3 : 1;
+	out->meshlets = malloc(sizeof(struct q3meshlet) * out->cap_meshlets);
+	out->vertex_refs = malloc(sizeof(u32) * out->cap_vertex_refs);
+	out->triangles = malloc(out->cap_triangles);
+
+	/* local slot of each map vertex in the current meshlet, valid while stamp matches */
+	size_t range = v_hi > v_lo? v_hi - v_lo : 1;
+	u8* slot = malloc(range);
+	u32* stamp = calloc(range, sizeof(u32));
+
+	struct q3meshlet* m = NULL;
+	vec3 normal_sum = { 0.0f, 0.0f, 0.0f };
+	u64 direction = 0;
+	for(size_t i = 0; i < n; i++) {
+		const u32* v = order[i].v;
+		vec3 normal = triangle_normal(bsp->vertices[v[0]].pos, bsp->vertices[v[1]].pos, bsp->vertices[v[2]].pos);
+
+		u32 fresh = 0;
+		if(m) {
+			for(int k = 0; k < 3; k++)
+				fresh += stamp[v[k] - v_lo] != out->n_meshlets && (k < 1 || v[k] != v[0]) && (k < 2 || v[k] != v[1]);
+		}
+		bool full = !m || m->n_vertices + fresh > Q3MESHLET_MAX_VERTICES || m->n_triangles + 1 > Q3MESHLET_MAX_TRIANGLES;
+		bool bent = m && (order[i].key >> 32 != direction
+			|| (m->n_triangles >= Q3MESHLET_MAX_TRIANGLES / 2 && dot(normalize(normal_sum), normal) < CONE_SPLIT));
+		if(full || bent) {
+			if(m)
+				finish_meshlet(bsp, out, m);
+			m = out->meshlets + out->n_meshlets++;
+			*m = (struct q3meshlet) {
+				.model = model_idx,
+				.first_vertex = out->n_vertex_refs,
+				.first_triangle = out->n_triangles,
+			};
+			normal_sum = (vec3) { 0.0f, 0.0f, 0.0f };
+			direction = order[i].key >> 32;
+		}
+
+		u8* tri = out->triangles + out->n_triangles * 3;
+		for(int k = 0; k < 3; k++) {
+			u32 local = v[k] - v_lo;
+			if(stamp[local] != out->n_meshlets) {
+				stamp[local] = out->n_meshlets;
+				slot[local] = m->n_vertices++;
+				out->vertex_refs[out->n_vertex_refs++] = v[k];
+			}
+			tri[k] = slot[local];
+		}
+		out->n_triangles++;
+		m->n_triangles++;
+		normal_sum = (vec3) { normal_sum.x + normal.x, normal_sum.y + normal.y, normal_sum.z + normal.z };
+	}
+	if(m)
+		finish_meshlet(bsp, out, m);
+
+	free(stamp);
+	free(slot);
+	free(order);
+}
+
+struct q3meshlet_set* q3meshlet_build(const struct q3bsp* bsp) {
+	struct q3meshlet_set* set = calloc(1, sizeof(struct q3meshlet_set));
+	struct model_out* out = calloc(bsp->n_models? bsp->n_models : 1, sizeof(struct model_out));
+	struct build_job job = { bsp, out };
+	q3_parallel_for(bsp->n_models, build_model, &job);
+
+	for(size_t i = 0; i < bsp->n_models; i++) {
+		set->n_meshlets += out[i].n_meshlets;
+		set->n_vertex_refs += out[i].n_vertex_refs;
+		set->n_triangles += out[i].n_triangles;
+	}
+	set->meshlets = malloc(sizeof(struct q3meshlet) * (set->n_meshlets? set->n_meshlets : 1));
+	set->vertex_refs = malloc(sizeof(u32) * (set->n_vertex_refs? set->n_vertex_refs : 1));
+	set->triangles = malloc(set->n_triangles? set->n_triangles * 3 : 1);
+
+	size_t n_meshlets = 0, n_refs = 0, n_triangles = 0;
+	for(size_t i = 0; i < bsp->n_models; i++) {
+		struct model_out* o = out + i;
+		for(size_t k = 0; k < o->n_meshlets; k++) {
+			struct q3meshlet* m = set->meshlets + n_meshlets + k;
+			*m = o->meshlets[k];
+			m->first_vertex += n_refs;
+			m->first_triangle += n_triangles;
+		}
+		memcpy(set->vertex_refs + n_refs, o->vertex_refs, sizeof(u32) * o->n_vertex_refs);
+		memcpy(set->triangles + n_triangles * 3, o->triangles, o->n_triangles * 3);
+		n_meshlets += o->n_meshlets;
+		n_refs += o->n_vertex_refs;
+		n_triangles += o->n_triangles;
+		free(o->meshlets);
+		free(o->vertex_refs);
+		free(o->triangles);
+	}
+
+	free(out);
+	return set;
+}
+
+void q3meshlet_free(struct q3meshlet_set* set) {
+	if(!set)
+		return;
+	free(set->meshlets);
+	free(set->vertex_refs);
+	free(set->triangles);
+	free(set);
+}
+
+int q3meshlet_write(const struct q3meshlet_set* set, FILE* out) {
+	struct q3meshlet_file_header header = {
+		.magic = Q3MESHLET_MAGIC,
+		.version = Q3MESHLET_VERSION,
+		.n_meshlets = set->n_meshlets,
+		.n_vertex_refs = set->n_vertex_refs,
+		.n_triangles = set->n_triangles,
+	};
+	if(fwrite(&header, sizeof(header), 1, out) != 1)
+		return EOF;
+	if(set->n_meshlets && fwrite(set->meshlets, sizeof(struct q3meshlet), set->n_meshlets, out) != set->n_meshlets)
+		return EOF;
+	if(set->n_vertex_refs && fwrite(set->vertex_refs, sizeof(u32), set->n_vertex_refs, out) != set->n_vertex_refs)
+		return EOF;
+	if(set->n_triangles && fwrite(set->triangles, 3, set->n_triangles, out) != set->n_triangles)
+		return EOF;
+	return 0;
+}
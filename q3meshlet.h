@@ -0,0 +1,73 @@
+#ifndef Q3_MESHLET_H_
+#define Q3_MESHLET_H_
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* "Q3ML" */
+#define Q3MESHLET_MAGIC 0x4C4D3351U
+#define Q3MESHLET_VERSION 1
+
+#define Q3MESHLET_MAX_VERTICES 64
+#define Q3MESHLET_MAX_TRIANGLES 124
+
+struct q3meshlet {
+	u32 model;
+	/* into vertex_refs and triangles, triangles are 3 bytes each */
+	u32 first_vertex;
+	u32 first_triangle;
+	u32 n_vertices;
+	u32 n_triangles;
+	vec3 center;
+	float radius;
+	/* backfacing from anywhere inside the cone, a cutoff of 1 never culls */
+	vec3 cone_apex;
+	vec3 cone_axis;
+	float cone_cutoff;
+};
+
+struct q3meshlet_set {
+	size_t n_meshlets;
+	struct q3meshlet* meshlets;
+	/* map vertex index of each meshlet's local vertices */
+	size_t n_vertex_refs;
+	u32* vertex_refs;
+	/* local vertex numbers, with quake's winding */
+	size_t n_triangles;
+	u8* triangles;
+};
+
+/* on disk, followed by the meshlets, the vertex refs, then the triangles, all little endian */
+struct q3meshlet_file_header {
+	u32 magic;
+	u32 version;
+	u32 n_meshlets;
+	u32 n_vertex_refs;
+	u32 n_triangles;
+};
+
+/* POLYGON and MESH faces, one task per model */
+struct q3meshlet_set* q3meshlet_build(const struct q3bsp* bsp);
+void q3meshlet_free(struct q3meshlet_set* set);
+
+/* true if every triangle in the meshlet faces away from eye */
+static inline bool q3meshlet_backfacing(const struct q3meshlet* m, vec3 eye) {
+	vec3 d = { m->cone_apex.x - eye.x, m->cone_apex.y - eye.y, m->cone_apex.z - eye.z };
+	float len = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+	return d.x * m->cone_axis.x + d.y * m->cone_axis.y + d.z * m->cone_axis.z >= m->cone_cutoff * len;
+}
+
+/* returns 0 on success, like fclose */
+int q3meshlet_write(const struct q3meshlet_set* set, FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
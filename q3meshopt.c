@@ -0,0 +1,242 @@
+#include <math.h>
+#include <string.h>
+
+#include "q3meshopt.h"
+
+#define EMPTY 0xFFFFFFFFU
+
+float q3meshopt_acmr(const u32* indices, size_t n_indices, size_t n_vertices, u32 cache_size) {
+	if(n_indices < 3)
+		return 0.0f;
+
+	/* a vertex is cached while fewer than cache_size misses happened since it was loaded */
+	u64* loaded = malloc(sizeof(u64) * (n_vertices? n_vertices : 1));
+	for(size_t i = 0; i < n_vertices; i++)
+		loaded[i] = ~(u64)0;
+
+	u64 misses = 0;
+	for(size_t i = 0; i < n_indices; i++) {
+		u32 v = indices[i];
+		if(loaded[v] != ~(u64)0 && misses - loaded[v] < cache_size)
+			continue;
+		loaded[v] = misses++;
+	}
+
+	free(loaded);
+	return (float)misses / (n_indices / 3);
+}
+
+static u32 hash_vertex(const struct q3vertex* v) {
+	/* FNV-1a over the raw bytes, exact match is all we want */
+	const u8* p = (const u8*)v;
+	u32 h = 2166136261U;
+	for(size_t i = 0; i < sizeof(*v); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h;
+}
+
+size_t q3meshopt_dedup(struct q3vertex* vertices, size_t n_vertices, u32* indices, size_t n_indices) {
+	size_t cap = 1;
+	while(cap < n_vertices * 2)
+		cap <<= 1;
+	u32* table = malloc(sizeof(u32) * cap);
+	memset(table, 0xFF, sizeof(u32) * cap);
+	u32* remap = malloc(sizeof(u32) * (n_vertices? n_vertices : 1));
+
+	/* open addressing, unique vertices get compacted towards the front as they're found */
+	size_t n = 0;
+	for(size_t i = 0; i < n_vertices; i++) {
+		size_t slot = hash_vertex(vertices + i) & (cap - 1);
+		for(;; slot = (slot + 1) & (cap - 1)) {
+			if(table[slot] == EMPTY) {
+				table[slot] = n;
+				vertices[n] = vertices[i];
+				remap[i] = n++;
+				break;
+			}
+			if(!memcmp(vertices + table[slot], vertices + i, sizeof(struct q3vertex))) {
+				remap[i] = table[slot];
+				break;
+			}
+		}
+	}
+
+	for(size_t i = 0; i < n_indices; i++)
+		indices[i] = remap[indices[i]];
+
+	free(remap);
+	free(table);
+	return n;
+}
+
+/* scoring constants from Forsyth's article */
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRI_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+static float vertex_score(i32 cache_pos, u32 remaining) {
+	if(!remaining)
+		return -1.0f;
+
+	float score = 0.0f;
+	if(cache_pos >= 0) {
+		if(cache_pos < 3) {
+			/* the triangle just drawn, deliberately not favoured over the next few */
+			score = LAST_TRI_SCORE;
+		} else {
+			float s = 1.0f - (cache_pos - 3) * (1.0f / (Q3MESHOPT_CACHE_SIZE - 3));
+			score = powf(s, CACHE_DECAY_POWER);
+		}
+	}
+	return score + VALENCE_BOOST_SCALE * powf((float)remaining, -VALENCE_BOOST_POWER);
+}
+
+void q3meshopt_reorder_triangles(u32* indices, size_t n_indices, size_t n_vertices) {
+	size_t n_tris = n_indices / 3;
+	if(n_tris < 2)
+		return;
+
+	/* triangles using each vertex, CSR */
+	u32* tri_start = calloc(n_vertices + 1, sizeof(u32));
+	for(size_t i = 0; i < n_indices; i++)
+		tri_start[indices[i] + 1]++;
+	for(size_t i = 0; i < n_vertices; i++)
+		tri_start[i + 1] += tri_start[i];
+	u32* tri_list = malloc(sizeof(u32) * n_indices);
+	u32* fill = malloc(sizeof(u32) * n_vertices);
+	memcpy(fill, tri_start, sizeof(u32) * n_vertices);
+	for(size_t i = 0; i < n_indices; i++)
+		tri_list[fill[indices[i]]++] = i / 3;
+
+	u32* remaining = malloc(sizeof(u32) * n_vertices);
+	i32* cache_pos = malloc(sizeof(i32) * n_vertices);
+	float* score = malloc(sizeof(float) * n_vertices);
+	for(size_t v = 0; v < n_vertices; v++) {
+		remaining[v] = tri_start[v + 1] - tri_start[v];
+		cache_pos[v] = -1;
+		score[v] = vertex_score(-1, remaining[v]);
+	}
+
+	float* tri_score = malloc(sizeof(float) * n_tris);
+	u8* emitted = calloc(n_tris, 1);
+	for(size_t t = 0; t < n_tris; t++)
+		tri_score[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+	u32* out = malloc(sizeof(u32) * n_indices);
+	/* LRU cache with room for the three being pushed in */
+	u32 cache[Q3MESHOPT_CACHE_SIZE + 3], cache_n = 0;
+	size_t scan = 0;
+	i64 best = -1;
+
+	for(size_t done = 0; done < n_tris; done++) {
+		/* nothing in cache is usable, restart at the next unemitted triangle in input order */
+		if(best < 0) {
+			while(emitted[scan])
+				scan++;
+			best = scan;
+		}
+
+		const u32* tri = indices + best * 3;
+		memcpy(out + done * 3, tri, sizeof(u32) * 3);
+		emitted[best] = 1;
+
+		/* move the three to the front of the cache, everything else shifts down */
+		u32 next[Q3MESHOPT_CACHE_SIZE + 3], n = 0;
+		for(int k = 0; k < 3; k++) {
+			next[n++] = tri[k];
+			remaining[tri[k]]--;
+		}
+		for(u32 i = 0; i < cache_n; i++)
+			if(cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+				next[n++] = cache[i];
+		for(u32 i = 0; i < n; i++) {
+			u32 v = next[i];
+			cache_pos[v] = i < Q3MESHOPT_CACHE_SIZE? (i32)i : -1;
+			score[v] = vertex_score(cache_pos[v], remaining[v]);
+		}
+		cache_n = n < Q3MESHOPT_CACHE_SIZE? n : Q3MESHOPT_CACHE_SIZE;
+		memcpy(cache, next, sizeof(u32) * cache_n);
+
+		/* only triangles touching the cache changed score, the best of those goes next */
+		best = -1;
+		float best_score = -1.0f;
+		for(u32 i = 0; i < n; i++) {
+			u32 v = next[i];
+			for(u32 j = tri_start[v]; j < tri_start[v + 1]; j++) {
+				u32 t = tri_list[j];
+				if(emitted[t])
+					continue;
+				const u32* o = indices + t * 3;
+				tri_score[t] = score[o[0]] + score[o[1]] + score[o[2]];
+				if(tri_score[t] > best_score) {
+					best_score = tri_score[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	memcpy(indices, out, sizeof(u32) * n_indices);
+	free(out);
+	free(emitted);
+	free(tri_score);
+	free(score);
+	free(cache_pos);
+	free(remaining);
+	free(fill);
+	free(tri_list);
+	free(tri_start);
+}
+
+size_t q3meshopt_reorder_vertices(struct q3vertex* vertices, size_t n_vertices, u32* indices, size_t n_indices) {
+	u32* remap = malloc(sizeof(u32) * (n_vertices? n_vertices : 1));
+	memset(remap, 0xFF, sizeof(u32) * n_vertices);
+	struct q3vertex* sorted = malloc(sizeof(struct q3vertex) * (n_vertices? n_vertices : 1));
+
+	size_t n = 0;
+	for(size_t i = 0; i < n_indices; i++) {
+		u32 v = indices[i];
+		if(remap[v] == EMPTY) {
+			remap[v] = n;
+			sorted[n++] = vertices[v];
+		}
+		indices[i] = remap[v];
+	}
+
+	memcpy(vertices, sorted, sizeof(struct q3vertex) * n);
+	free(sorted);
+	free(remap);
+	return n;
+}
+
+void q3meshopt_optimize_batches(struct q3batch_set* set) {
+	set->n_vertices = q3meshopt_dedup(set->vertices, set->n_vertices, set->indices, set->n_indices);
+
+	/* each batch is optimised on its own, with its vertices renumbered densely first */
+	u32* local = malloc(sizeof(u32) * (set->n_vertices? set->n_vertices : 1));
+	u32* global = malloc(sizeof(u32) * (set->n_vertices? set->n_vertices : 1));
+	memset(local, 0xFF, sizeof(u32) * set->n_vertices);
+	for(size_t b = 0; b < set->n_batches; b++) {
+		u32* idx = set->indices + set->batches[b].first_index;
+		size_t n = set->batches[b].n_indices, n_local = 0;
+		for(size_t i = 0; i < n; i++) {
+			if(local[idx[i]] == EMPTY) {
+				local[idx[i]] = n_local;
+				global[n_local++] = idx[i];
+			}
+			idx[i] = local[idx[i]];
+		}
+
+		q3meshopt_reorder_triangles(idx, n, n_local);
+
+		for(size_t i = 0; i < n; i++)
+			idx[i] = global[idx[i]];
+		for(size_t i = 0; i < n_local; i++)
+			local[global[i]] = EMPTY;
+	}
+	free(global);
+	free(local);
+
+	set->n_vertices = q3meshopt_reorder_vertices(set->vertices, set->n_vertices, set->indices, set->n_indices);
+}
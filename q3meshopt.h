@@ -0,0 +1,32 @@
+#ifndef Q3_MESHOPT_H_
+#define Q3_MESHOPT_H_
+
+#include "q3batch.h"
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* post transform cache size the triangle order is tuned for */
+#define Q3MESHOPT_CACHE_SIZE 32
+
+/* average cache miss ratio, misses per triangle through a FIFO of cache_size entries */
+float q3meshopt_acmr(const u32* indices, size_t n_indices, size_t n_vertices, u32 cache_size);
+
+/* merges bit-identical vertices and rewrites indices to match, returns the new vertex count */
+size_t q3meshopt_dedup(struct q3vertex* vertices, size_t n_vertices, u32* indices, size_t n_indices);
+
+/* Forsyth's linear-speed vertex cache optimisation over one triangle list */
+void q3meshopt_reorder_triangles(u32* indices, size_t n_indices, size_t n_vertices);
+
+/* renumbers vertices in order of first use, dropping unreferenced ones, returns the new count */
+size_t q3meshopt_reorder_vertices(struct q3vertex* vertices, size_t n_vertices, u32* indices, size_t n_indices);
+
+/* all three over a batch set, triangles only move within their own batch */
+void q3meshopt_optimize_batches(struct q3batch_set* set);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
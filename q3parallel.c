@@ -0,0 +1,247 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "q3parallel.h"
+
+struct job {
+	size_t n;
+	void (*fn)(void* user, size_t i);
+	void* user;
+	atomic_size_t next;
+};
+
+static size_t n_threads = 1;
+static pthread_once_t n_threads_once = PTHREAD_ONCE_INIT;
+
+static void init_n_threads(void) {
+	const char* env = getenv("Q3_THREADS");
+	long count = env? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+	n_threads = count > 0? (size_t)count : 1;
+}
+
+size_t q3_n_threads(void) {
+	pthread_once(&n_threads_once, init_n_threads);
+	return n_threads;
+}
+
+/* items are handed out one at a time, they're all coarse (a page, a patch, a model...) */
+static void* worker(void* arg) {
+	struct job* job = arg;
+	for(size_t i; (i = atomic_fetch_add(&job->next, 1)) < job->n;)
+		job->fn(job->user, i);
+	return NULL;
+}
+
+void q3_parallel_for(size_t n, void (*fn)(void* user, size_t i), void* user) {
+	struct job job = { .n = n, .fn = fn, .user = user };
+	atomic_init(&job.next, 0);
+
+	size_t count = q3_n_threads();
+	if(count > n)
+		count = n;
+	if(count <= 1) {
+		worker(&job);
+		return;
+	}
+
+	pthread_t* threads = malloc(sizeof(pthread_t) * (count - 1));
+	size_t started = 0;
+	for(; started < count - 1; started++)
+		if(pthread_create(threads + started, NULL, worker, &job))
+			break;
+
+	worker(&job);
+
+	for(size_t i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+/* next item in the low half and end in the high, so taking and stealing are both one CAS */
+struct range {
+	_Atomic uint64_t items;
+	size_t steals;
+	char pad[64 - sizeof(uint64_t) - sizeof(size_t)];
+};
+
+struct q3pool {
+	size_t n_threads;
+	pthread_t* threads;
+	struct range* ranges;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	size_t generation;
+	size_t running;
+	bool quit;
+
+	void (*fn)(void* user, size_t i, size_t worker);
+	void* user;
+};
+
+struct pool_thread {
+	struct q3pool* pool;
+	size_t index;
+};
+
+static inline uint64_t pack_range(uint32_t next, uint32_t end) {
+	return (uint64_t)end << 32 | next;
+}
+
+static bool take_item(struct range* r, size_t* item) {
+	uint64_t v = atomic_load(&r->items);
+	for(;;) {
+		uint32_t next = v, end = v >> 32;
+		if(next >= end)
+			return false;
+		if(atomic_compare_exchange_weak(&r->items, &v, pack_range(next + 1, end))) {
+			*item = next;
+			return true;
+		}
+	}
+}
+
+/* the back half, or the last item if that's all there is */
+static bool steal_range(struct range* r, uint32_t* first, uint32_t* last) {
+	uint64_t v = atomic_load(&r->items);
+	for(;;) {
+		uint32_t next = v, end = v >> 32;
+		if(next >= end)
+			return false;
+		uint32_t mid = end - (end - next + 1) / 2;
+		if(atomic_compare_exchange_weak(&r->items, &v, pack_range(next, mid))) {
+			*first = mid;
+			*last = end;
+			return true;
+		}
+	}
+}
+
+static void pool_work(struct q3pool* pool, size_t index) {
+	struct range* own = pool->ranges + index;
+	for(;;) {
+		size_t item;
+		while(take_item(own, &item))
+			pool->fn(pool->user, item, index);
+
+		/* go round everyone once, starting with the next worker so thieves spread out */
+		bool stolen = false;
+		for(size_t k = 1; k < pool->n_threads && !stolen; k++) {
+			uint32_t first, last;
+			if(steal_range(pool->ranges + (index + k) % pool->n_threads, &first, &last)) {
+				atomic_store(&own->items, pack_range(first, last));
+				own->steals++;
+				stolen = true;
+			}
+		}
+		if(!stolen)
+			return;
+	}
+}
+
+static void* pool_thread(void* arg) {
+	struct pool_thread* self = arg;
+	struct q3pool* pool = self->pool;
+	size_t seen = 0;
+	for(;;) {
+		pthread_mutex_lock(&pool->lock);
+		while(!pool->quit && pool->generation == seen)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if(pool->quit) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		pool_work(pool, self->index);
+
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->running == 0)
+			pthread_cond_signal(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	free(self);
+	return NULL;
+}
+
+struct q3pool* q3pool_create(size_t n_threads) {
+	struct q3pool* pool = calloc(1, sizeof(struct q3pool));
+	pool->n_threads = n_threads? n_threads : q3_n_threads();
+	pool->ranges = aligned_alloc(64, sizeof(struct range) * pool->n_threads);
+	pool->threads = malloc(sizeof(pthread_t) * pool->n_threads);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for(size_t i = 0; i < pool->n_threads; i++)
+		atomic_init(&pool->ranges[i].items, 0);
+
+	/* the caller is worker 0, settle for fewer if threads run out */
+	size_t started = 1;
+	for(; started < pool->n_threads; started++) {
+		struct pool_thread* self = malloc(sizeof(struct pool_thread));
+		*self = (struct pool_thread) { pool, started };
+		if(pthread_create(pool->threads + started, NULL, pool_thread, self)) {
+			free(self);
+			break;
+		}
+	}
+	pool->n_threads = started;
+	return pool;
+}
+
+void q3pool_free(struct q3pool* pool) {
+	if(!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for(size_t i = 1; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool->ranges);
+	free(pool);
+}
+
+size_t q3pool_n_threads(const struct q3pool* pool) {
+	return pool->n_threads;
+}
+
+size_t q3pool_for(struct q3pool* pool, size_t n, void (*fn)(void* user, size_t i, size_t worker), void* user) {
+	if(n > UINT32_MAX)
+		n = UINT32_MAX;
+	pool->fn = fn;
+	pool->user = user;
+	for(size_t i = 0; i < pool->n_threads; i++) {
+		atomic_store(&pool->ranges[i].items, pack_range(n * i / pool->n_threads, n * (i + 1) / pool->n_threads));
+		pool->ranges[i].steals = 0;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->running = pool->n_threads - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	pool_work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while(pool->running)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	size_t steals = 0;
+	for(size_t i = 0; i < pool->n_threads; i++)
+		steals += pool->ranges[i].steals;
+	return steals;
+}
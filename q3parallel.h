@@ -0,0 +1,33 @@
+#ifndef Q3_PARALLEL_H_
+#define Q3_PARALLEL_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* worker count, the online CPU count unless Q3_THREADS is set in the environment */
+size_t q3_n_threads(void);
+
+/* calls fn(user, i) for every i in [0, n) spread over q3_n_threads() threads, the caller works too */
+void q3_parallel_for(size_t n, void (*fn)(void* user, size_t i), void* user);
+
+/*
+	Threads that stay around between calls, for work that comes every frame. Items start split
+	evenly between workers, and a worker that runs out steals the back half of someone else's.
+*/
+struct q3pool;
+
+/* n_threads includes the caller, 0 for q3_n_threads() */
+struct q3pool* q3pool_create(size_t n_threads);
+void q3pool_free(struct q3pool* pool);
+size_t q3pool_n_threads(const struct q3pool* pool);
+
+/* calls fn(user, i, worker) for every i in [0, n) with worker in [0, n_threads), returns how many steals it took */
+size_t q3pool_for(struct q3pool* pool, size_t n, void (*fn)(void* user, size_t i, size_t worker), void* user);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
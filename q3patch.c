@@ -0,0 +1,421 @@
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include "q3parallel.h"
+#include "q3patch.h"
+
+/* pos, tex, lightmap, normal, color, padded so a control point is one cache line */
+#define ATTRS 14
+#define ATTR_STRIDE 16
+/* positions within this count as the same control point when matching edges */
+#define WELD_EPS 0.01f
+
+static void to_attrs(const struct q3vertex* v, float* a) {
+	a[0] = v->pos.x;
+	a[1] = v->pos.y;
+	a[2] = v->pos.z;
+	a[3] = v->tex_coords.s;
+	a[4] = v->tex_coords.t;
+	a[5] = v->lightmap_coords.s;
+	a[6] = v->lightmap_coords.t;
+	a[7] = v->norm.x;
+	a[8] = v->norm.y;
+	a[9] = v->norm.z;
+	a[10] = v->color.r;
+	a[11] = v->color.g;
+	a[12] = v->color.b;
+	a[13] = v->color.a;
+	a[14] = a[15] = 0.0f;
+}
+
+static u8 to_byte(float f) {
+	f += 0.5f;
+	return f <= 0.0f? 0 : f >= 255.0f? 255 : (u8)f;
+}
+
+/* control point k along an edge */
+static const struct q3vertex* edge_ctrl(const struct q3bsp* bsp, const struct q3patch* p, u8 edge, u32 k) {
+	const struct q3vertex* ctrl = bsp->vertices + bsp->faces[p->face].first_vertex_idx;
+	switch(edge) {
+		case 0: return ctrl + k;
+		case 1: return ctrl + k * p->width + p->width - 1;
+		case 2: return ctrl + (p->height - 1) * p->width + k;
+		default: return ctrl + k * p->width;
+	}
+}
+
+static u32 edge_ctrl_len(const struct q3patch* p, u8 edge) {
+	return edge & 1? p->height : p->width;
+}
+
+/* index into a mesh's vertex grid of vertex k along an edge */
+static u32 edge_vertex(const struct q3patch_mesh* m, u8 edge, u32 k) {
+	switch(edge) {
+		case 0: return k;
+		case 1: return k * m->width + m->width - 1;
+		case 2: return (m->height - 1) * m->width + k;
+		default: return k * m->width;
+	}
+}
+
+static bool same_pos(vec3 a, vec3 b) {
+	return fabsf(a.x - b.x) < WELD_EPS && fabsf(a.y - b.y) < WELD_EPS && fabsf(a.z - b.z) < WELD_EPS;
+}
+
+static bool edges_match(const struct q3bsp* bsp, const struct q3patch* a, u8 ea, const struct q3patch* b, u8 eb, bool reversed) {
+	u32 n = edge_ctrl_len(a, ea);
+	if(n != edge_ctrl_len(b, eb))
+		return false;
+	for(u32 k = 0; k < n; k++)
+		if(!same_pos(edge_ctrl(bsp, a, ea, k)->pos, edge_ctrl(bsp, b, eb, reversed? n - 1 - k : k)->pos))
+			return false;
+	return true;
+}
+
+/* collapsed edges (the tip of a cone) would match anything touching that point */
+static bool edge_degenerate(const struct q3bsp* bsp, const struct q3patch* p, u8 edge) {
+	u32 n = edge_ctrl_len(p, edge);
+	vec3 first = edge_ctrl(bsp, p, edge, 0)->pos;
+	for(u32 k = 1; k < n; k++)
+		if(!same_pos(first, edge_ctrl(bsp, p, edge, k)->pos))
+			return false;
+	return true;
+}
+
+static void find_links(struct q3patch_set* set) {
+	for(size_t i = 0; i < set->n_patches; i++)
+		for(u8 e = 0; e < 4; e++)
+			set->patches[i].links[e] = (struct q3patch_link) { -1, 0, false };
+
+	for(size_t i = 0; i < set->n_patches; i++) {
+		struct q3patch* a = set->patches + i;
+		for(u8 ea = 0; ea < 4; ea++) {
+			if(a->links[ea].patch >= 0 || edge_degenerate(set->bsp, a, ea))
+				continue;
+			for(size_t j = i + 1; j < set->n_patches && a->links[ea].patch < 0; j++) {
+				struct q3patch* b = set->patches + j;
+				for(u8 eb = 0; eb < 4; eb++) {
+					if(b->links[eb].patch >= 0)
+						continue;
+					for(int r = 0; r < 2; r++) {
+						if(!edges_match(set->bsp, a, ea, b, eb, r))
+							continue;
+						a->links[ea] = (struct q3patch_link) { j, eb, r };
+						b->links[eb] = (struct q3patch_link) { i, ea, r };
+						goto linked;
+					}
+				}
+			}
+linked:
+			;
+		}
+	}
+}
+
+struct q3patch_set* q3patch_init(const struct q3bsp* bsp) {
+	struct q3patch_set* set = calloc(1, sizeof(struct q3patch_set));
+	set->bsp = bsp;
+
+	for(size_t i = 0; i < bsp->n_faces; i++)
+		set->n_patches += bsp->faces[i].type == PATCH;
+	set->patches = calloc(set->n_patches? set->n_patches : 1, sizeof(struct q3patch));
+
+	size_t n = 0;
+	for(size_t i = 0; i < bsp->n_faces; i++) {
+		const struct q3face* face = bsp->faces + i;
+		if(face->type != PATCH)
+			continue;
+		struct q3patch* p = set->patches + n++;
+		p->face = i;
+		p->width = face->patch_dimensions.s;
+		p->height = face->patch_dimensions.t;
+		/* q3map only writes odd sizes, anything else gets no pieces and never tessellates */
+		bool valid = p->width >= 3 && p->height >= 3 && (p->width & 1) && (p->height & 1)
+			&& (u64)p->width * p->height <= face->n_vertices;
+		p->pieces_x = valid? (p->width - 1) / 2 : 0;
+		p->pieces_y = valid? (p->height - 1) / 2 : 0;
+		if(!valid)
+			p->width = p->height = 0;
+	}
+
+	find_links(set);
+	return set;
+}
+
+void q3patch_free(struct q3patch_set* set) {
+	if(!set)
+		return;
+	free(set->patches);
+	free(set->vertices);
+	free(set->indices);
+	free(set);
+}
+
+/* out[k][i] = b0[i]*q[0][k] + b1[i]*q[1][k] + b2[i]*q[2][k] for n points along u, SoA out */
+static void eval_row(const float* b0, const float* b1, const float* b2, u32 n, const float q[3][ATTR_STRIDE], float* out, size_t stride) {
+	u32 i = 0;
+#if defined(__AVX__)
+	for(; i < n; i += 8) {
+		__m256 w0 = _mm256_loadu_ps(b0 + i), w1 = _mm256_loadu_ps(b1 + i), w2 = _mm256_loadu_ps(b2 + i);
+		for(int k = 0; k < ATTRS; k++) {
+			__m256 v = _mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(w0, _mm256_set1_ps(q[0][k])),
+				_mm256_mul_ps(w1, _mm256_set1_ps(q[1][k]))),
+				_mm256_mul_ps(w2, _mm256_set1_ps(q[2][k])));
+			_mm256_storeu_ps(out + k * stride + i, v);
+		}
+	}
+#elif defined(__SSE__)
+	for(; i < n; i += 4) {
+		__m128 w0 = _mm_loadu_ps(b0 + i), w1 = _mm_loadu_ps(b1 + i), w2 = _mm_loadu_ps(b2 + i);
+		for(int k = 0; k < ATTRS; k++) {
+			__m128 v = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(w0, _mm_set1_ps(q[0][k])),
+				_mm_mul_ps(w1, _mm_set1_ps(q[1][k]))),
+				_mm_mul_ps(w2, _mm_set1_ps(q[2][k])));
+			_mm_storeu_ps(out + k * stride + i, v);
+		}
+	}
+#endif
+	for(; i < n; i++)
+		for(int k = 0; k < ATTRS; k++)
+			out[k * stride + i] = b0[i] * q[0][k] + b1[i] * q[1][k] + b2[i] * q[2][k];
+}
+
+/* the SIMD loop may run up to 7 past n, everything it touches is padded for that */
+#define ROW_PAD 8
+
+static void build_mesh(const struct q3bsp* bsp, const struct q3patch* p, u32 level, const struct q3patch_mesh* m, struct q3vertex* verts, u32* indices) {
+	const struct q3vertex* src = bsp->vertices + bsp->faces[p->face].first_vertex_idx;
+	float (*ctrl)[ATTR_STRIDE] = malloc(sizeof(float[ATTR_STRIDE]) * p->width * p->height);
+	for(u32 i = 0; i < p->width * p->height; i++)
+		to_attrs(src + i, ctrl[i]);
+
+	/* quadratic bernstein weights at every step, identical for each piece */
+	u32 nb = level + 1 + ROW_PAD;
+	float* b = calloc(nb * 3, sizeof(float));
+	for(u32 i = 0; i <= level; i++) {
+		float t = (float)i / level;
+		b[i] = (1.0f - t) * (1.0f - t);
+		b[nb + i] = 2.0f * t * (1.0f - t);
+		b[2 * nb + i] = t * t;
+	}
+
+	size_t stride = m->width + ROW_PAD;
+	float* row = malloc(sizeof(float) * stride * ATTRS);
+	for(u32 y = 0; y < m->height; y++) {
+		u32 py = y / level;
+		if(py >= p->pieces_y)
+			py = p->pieces_y - 1;
+		u32 ly = y - py * level;
+		float wv[3] = { b[ly], b[nb + ly], b[2 * nb + ly] };
+
+		/* collapse each piece's three control rows to one curve at v, then run along u */
+		for(u32 px = 0; px < p->pieces_x; px++) {
+			float q[3][ATTR_STRIDE];
+			for(int i = 0; i < 3; i++)
+				for(int k = 0; k < ATTRS; k++)
+					q[i][k] = wv[0] * ctrl[(2 * py + 0) * p->width + 2 * px + i][k]
+						+ wv[1] * ctrl[(2 * py + 1) * p->width + 2 * px + i][k]
+						+ wv[2] * ctrl[(2 * py + 2) * p->width + 2 * px + i][k];
+			eval_row(b, b + nb, b + 2 * nb, level + 1, q, row + px * level, stride);
+		}
+
+		struct q3vertex* out = verts + y * m->width;
+		for(u32 x = 0; x < m->width; x++) {
+			const float* r = row + x;
+			vec3 n = { r[7 * stride], r[8 * stride], r[9 * stride] };
+			float len = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+			float inv = len > 0.0f? 1.0f / len : 0.0f;
+			out[x] = (struct q3vertex) {
+				.pos = { r[0], r[stride], r[2 * stride] },
+				.tex_coords = { .s = r[3 * stride], .t = r[4 * stride] },
+				.lightmap_coords = { .s = r[5 * stride], .t = r[6 * stride] },
+				.norm = { n.x * inv, n.y * inv, n.z * inv },
+				.color = { .r = to_byte(r[10 * stride]), .g = to_byte(r[11 * stride]), .b = to_byte(r[12 * stride]), .a = to_byte(r[13 * stride]) },
+			};
+		}
+	}
+
+	/* same winding as R_CreateSurfaceGridMesh */
+	u32* idx = indices;
+	for(u32 y = 0; y + 1 < m->height; y++) {
+		for(u32 x = 0; x + 1 < m->width; x++) {
+			u32 v1 = y * m->width + x + 1;
+			u32 v2 = v1 - 1;
+			u32 v3 = v2 + m->width;
+			u32 v4 = v3 + 1;
+			*idx++ = v2;
+			*idx++ = v3;
+			*idx++ = v1;
+			*idx++ = v3;
+			*idx++ = v4;
+			*idx++ = v1;
+		}
+	}
+
+	free(row);
+	free(b);
+	free(ctrl);
+}
+
+struct build_job {
+	struct q3patch_set* set;
+	const u32* patches;
+	const u32* levels;
+};
+
+static void build_one(void* user, size_t i) {
+	const struct build_job* job = user;
+	struct q3patch_set* set = job->set;
+	const struct q3patch* p = set->patches + job->patches[i];
+	const struct q3patch_mesh* m = p->lods + job->levels[i];
+	build_mesh(set->bsp, p, job->levels[i], m, set->vertices + m->first_vertex, set->indices + m->first_index);
+}
+
+void q3patch_tessellate(struct q3patch_set* set, const u32* levels) {
+	u32* todo = malloc(sizeof(u32) * (set->n_patches? set->n_patches : 1));
+	u32* todo_levels = malloc(sizeof(u32) * (set->n_patches? set->n_patches : 1));
+	size_t n = 0;
+
+	/* reserve pool space up front so the workers never have to allocate */
+	for(size_t i = 0; i < set->n_patches; i++) {
+		struct q3patch* p = set->patches + i;
+		u32 level = levels[i];
+		if(!level || level > Q3PATCH_MAX_LEVEL || !p->pieces_x || p->lods[level].n_vertices)
+			continue;
+
+		struct q3patch_mesh* m = p->lods + level;
+		m->width = p->pieces_x * level + 1;
+		m->height = p->pieces_y * level + 1;
+		m->first_vertex = set->n_vertices;
+		m->n_vertices = m->width * m->height;
+		m->first_index = set->n_indices;
+		m->n_indices = (m->width - 1) * (m->height - 1) * 6;
+		set->n_vertices += m->n_vertices;
+		set->n_indices += m->n_indices;
+		todo[n] = i;
+		todo_levels[n] = level;
+		n++;
+	}
+
+	if(set->n_vertices > set->cap_vertices) {
+		set->cap_vertices = set->n_vertices > set->cap_vertices * 2? set->n_vertices : set->cap_vertices * 2;
+		set->vertices = realloc(set->vertices, sizeof(struct q3vertex) * set->cap_vertices);
+	}
+	if(set->n_indices > set->cap_indices) {
+		set->cap_indices = set->n_indices > set->cap_indices * 2? set->n_indices : set->cap_indices * 2;
+		set->indices = realloc(set->indices, sizeof(u32) * set->cap_indices);
+	}
+
+	struct build_job job = { set, todo, todo_levels };
+	q3_parallel_for(n, build_one, &job);
+
+	free(todo);
+	free(todo_levels);
+}
+
+void q3patch_measure(const struct q3patch* p, u32 level, u32* n_vertices, u32* n_indices) {
+	if(!level || level > Q3PATCH_MAX_LEVEL || !p->pieces_x) {
+		*n_vertices = *n_indices = 0;
+		return;
+	}
+	u32 width = p->pieces_x * level + 1, height = p->pieces_y * level + 1;
+	*n_vertices = width * height;
+	*n_indices = (width - 1) * (height - 1) * 6;
+}
+
+void q3patch_build(const struct q3bsp* bsp, const struct q3patch* p, u32 level, struct q3vertex* vertices, u32* indices) {
+	if(!level || level > Q3PATCH_MAX_LEVEL || !p->pieces_x)
+		return;
+	struct q3patch_mesh m = {
+		.width = p->pieces_x * level + 1,
+		.height = p->pieces_y * level + 1,
+	};
+	build_mesh(bsp, p, level, &m, vertices, indices);
+}
+
+void q3patch_tessellate_all(struct q3patch_set* set, u32 level) {
+	u32* levels = malloc(sizeof(u32) * (set->n_patches? set->n_patches : 1));
+	for(size_t i = 0; i < set->n_patches; i++)
+		levels[i] = level;
+	q3patch_tessellate(set, levels);
+	free(levels);
+}
+
+/* the side with the lower level wins, ties go to the lower index so both sides agree */
+static bool yields_to(const u32* levels, size_t self, const struct q3patch_link* link) {
+	if(link->patch < 0 || !levels[link->patch])
+		return false;
+	u32 mine = levels[self], theirs = levels[link->patch];
+	return theirs < mine || (theirs == mine && (size_t)link->patch < self);
+}
+
+void q3patch_stitch(const struct q3patch_set* set, size_t patch, const u32* levels, struct q3vertex* out) {
+	const struct q3patch* p = set->patches + patch;
+	const struct q3patch_mesh* m = p->lods + levels[patch];
+
+	for(u8 e = 0; e < 4; e++) {
+		const struct q3patch_link* link = p->links + e;
+		if(!yields_to(levels, patch, link))
+			continue;
+
+		const struct q3patch* other = set->patches + link->patch;
+		const struct q3patch_mesh* om = other->lods + levels[link->patch];
+		if(!om->n_vertices)
+			continue;
+		const struct q3vertex* ov = set->vertices + om->first_vertex;
+
+		u32 fine = (e & 1? m->height : m->width) - 1;
+		u32 coarse = (link->edge & 1? om->height : om->width) - 1;
+		for(u32 k = 0; k <= fine; k++) {
+			/* exact rational position along the edge, so shared vertices land bit for bit */
+			u32 num = (link->reversed? fine - k : k) * coarse;
+			u32 j = num / fine, rem = num % fine;
+			vec3 a = ov[edge_vertex(om, link->edge, j)].pos;
+			vec3 pos = a;
+			if(rem) {
+				vec3 c = ov[edge_vertex(om, link->edge, j + 1)].pos;
+				float f = (float)rem / fine;
+				pos = (vec3) { a.x + (c.x - a.x) * f, a.y + (c.y - a.y) * f, a.z + (c.z - a.z) * f };
+			}
+			out[edge_vertex(m, e, k)].pos = pos;
+		}
+	}
+}
+
+size_t q3patch_assemble(struct q3patch_set* set, const u32* levels,
+	struct q3vertex** vertices, size_t* n_vertices, u32** indices, size_t* n_indices) {
+	q3patch_tessellate(set, levels);
+
+	size_t nv = 0, ni = 0;
+	for(size_t i = 0; i < set->n_patches; i++) {
+		if(!levels[i] || levels[i] > Q3PATCH_MAX_LEVEL || !set->patches[i].pieces_x)
+			continue;
+		nv += set->patches[i].lods[levels[i]].n_vertices;
+		ni += set->patches[i].lods[levels[i]].n_indices;
+	}
+	*vertices = realloc(*vertices, sizeof(struct q3vertex) * (nv? nv : 1));
+	*indices = realloc(*indices, sizeof(u32) * (ni? ni : 1));
+
+	size_t v = 0, ix = 0;
+	for(size_t i = 0; i < set->n_patches; i++) {
+		if(!levels[i] || levels[i] > Q3PATCH_MAX_LEVEL || !set->patches[i].pieces_x)
+			continue;
+		const struct q3patch_mesh* m = set->patches[i].lods + levels[i];
+		memcpy(*vertices + v, set->vertices + m->first_vertex, sizeof(struct q3vertex) * m->n_vertices);
+		q3patch_stitch(set, i, levels, *vertices + v);
+		for(u32 k = 0; k < m->n_indices; k++)
+			(*indices)[ix + k] = set->indices[m->first_index + k] + v;
+		v += m->n_vertices;
+		ix += m->n_indices;
+	}
+
+	*n_vertices = nv;
+	*n_indices = ni;
+	return ni / 3;
+}
@@ -0,0 +1,82 @@
+#ifndef Q3_PATCH_H_
+#define Q3_PATCH_H_
+
+#include <stdbool.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* subdivisions per 3x3 biquadratic piece along each axis */
+#define Q3PATCH_MAX_LEVEL 32
+
+/* one tessellation of a patch, indices are relative to first_vertex */
+struct q3patch_mesh {
+	u32 first_vertex;
+	u32 n_vertices;
+	u32 first_index;
+	u32 n_indices;
+	/* vertex grid, row major */
+	u32 width, height;
+};
+
+/* the patch sharing an edge, edges go v=0, u=1, v=1, u=0 */
+struct q3patch_link {
+	i32 patch;
+	u8 edge;
+	/* the neighbour walks the shared control points the other way */
+	bool reversed;
+};
+
+struct q3patch {
+	i32 face;
+	/* control point grid and the number of 3x3 pieces in it */
+	u32 width, height;
+	u32 pieces_x, pieces_y;
+	struct q3patch_link links[4];
+	/* built on demand, n_vertices == 0 until then */
+	struct q3patch_mesh lods[Q3PATCH_MAX_LEVEL + 1];
+};
+
+/* every PATCH face in the map plus the shared pool all their tessellations live in */
+struct q3patch_set {
+	const struct q3bsp* bsp;
+	size_t n_patches;
+	struct q3patch* patches;
+
+	size_t n_vertices, cap_vertices;
+	struct q3vertex* vertices;
+	size_t n_indices, cap_indices;
+	u32* indices;
+};
+
+struct q3patch_set* q3patch_init(const struct q3bsp* bsp);
+void q3patch_free(struct q3patch_set* set);
+
+/* builds whatever is missing, one task per patch, level 0 means "skip this patch" */
+void q3patch_tessellate(struct q3patch_set* set, const u32* levels);
+/* same level for every patch */
+void q3patch_tessellate_all(struct q3patch_set* set, u32 level);
+
+/* vertex and index counts of one patch at a level, both zero if it never tessellates */
+void q3patch_measure(const struct q3patch* p, u32 level, u32* n_vertices, u32* n_indices);
+/* tessellates one patch straight into caller buffers sized by q3patch_measure, no pool and no stitching */
+void q3patch_build(const struct q3bsp* bsp, const struct q3patch* p, u32 level, struct q3vertex* vertices, u32* indices);
+
+/*
+	Flattens the patches at the given levels into one vertex/index list, building any missing
+	levels first. Where neighbours differ in level the finer edge is snapped onto the coarser
+	one so there are no cracks. Arrays are grown with realloc, returns the triangle count.
+*/
+size_t q3patch_assemble(struct q3patch_set* set, const u32* levels,
+	struct q3vertex** vertices, size_t* n_vertices, u32** indices, size_t* n_indices);
+
+/* snaps one patch's edges in an already assembled copy of its level-`level` mesh */
+void q3patch_stitch(const struct q3patch_set* set, size_t patch, const u32* levels, struct q3vertex* out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,199 @@
+#include <math.h>
+#include <string.h>
+
+#include "q3patchlod.h"
+
+static float dist3(vec3 a, vec3 b) {
+	float x = a.x - b.x, y = a.y - b.y, z = a.z - b.z;
+	return sqrtf(x * x + y * y + z * z);
+}
+
+/* |p0 - 2p1 + p2|, how far the quadratic bulges from its chord times four */
+static float second_diff(vec3 p0, vec3 p1, vec3 p2) {
+	vec3 d = { p0.x - 2.0f * p1.x + p2.x, p0.y - 2.0f * p1.y + p2.y, p0.z - 2.0f * p1.z + p2.z };
+	return sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+}
+
+static void patch_metrics(struct q3patchlod* lod, size_t i) {
+	const struct q3patch* p = lod->set->patches + i;
+	const struct q3vertex* ctrl = lod->set->bsp->vertices + lod->set->bsp->faces[p->face].first_vertex_idx;
+	float du = 0.0f, dv = 0.0f;
+	vec3 mins = { INFINITY, INFINITY, INFINITY }, maxs = { -INFINITY, -INFINITY, -INFINITY };
+
+	for(u32 y = 0; y < p->height; y++)
+		for(u32 x = 0; x < p->width; x++) {
+			vec3 v = ctrl[y * p->width + x].pos;
+			mins = (vec3) { fminf(mins.x, v.x), fminf(mins.y, v.y), fminf(mins.z, v.z) };
+			maxs = (vec3) { fmaxf(maxs.x, v.x), fmaxf(maxs.y, v.y), fmaxf(maxs.z, v.z) };
+			if(x + 2 < p->width && !(x & 1))
+				du = fmaxf(du, second_diff(v, ctrl[y * p->width + x + 1].pos, ctrl[y * p->width + x + 2].pos));
+			if(y + 2 < p->height && !(y & 1))
+				dv = fmaxf(dv, second_diff(v, ctrl[(y + 1) * p->width + x].pos, ctrl[(y + 2) * p->width + x].pos));
+		}
+
+	/* tensor product error is bounded by the sum of the two directions */
+	lod->curvature[i] = du + dv;
+	lod->mins[i] = mins;
+	lod->maxs[i] = maxs;
+}
+
+struct q3patchlod* q3patchlod_init(struct q3patch_set* set, bool pow2) {
+	struct q3patchlod* lod = calloc(1, sizeof(struct q3patchlod));
+	size_t n = set->n_patches? set->n_patches : 1;
+	lod->set = set;
+	lod->pow2 = pow2;
+	lod->curvature = calloc(n, sizeof(float));
+	lod->mins = calloc(n, sizeof(vec3));
+	lod->maxs = calloc(n, sizeof(vec3));
+	lod->levels = calloc(n, sizeof(u32));
+	lod->vertices = calloc(n, sizeof(struct q3vertex*));
+	for(size_t i = 0; i < set->n_patches; i++)
+		if(set->patches[i].pieces_x)
+			patch_metrics(lod, i);
+	return lod;
+}
+
+void q3patchlod_free(struct q3patchlod* lod) {
+	if(!lod)
+		return;
+	for(size_t i = 0; i < lod->set->n_patches; i++)
+		free(lod->vertices[i]);
+	free(lod->vertices);
+	free(lod->curvature);
+	free(lod->mins);
+	free(lod->maxs);
+	free(lod->levels);
+	free(lod);
+}
+
+u32 q3patchlod_level(const struct q3patchlod* lod, size_t patch, float tolerance, const struct q3patchlod_view* view) {
+	if(!lod->set->patches[patch].pieces_x)
+		return 0;
+
+	/* pixels to world units at the nearest point of the patch */
+	if(view) {
+		vec3 e = view->eye, lo = lod->mins[patch], hi = lod->maxs[patch];
+		vec3 nearest = { fminf(fmaxf(e.x, lo.x), hi.x), fminf(fmaxf(e.y, lo.y), hi.y), fminf(fmaxf(e.z, lo.z), hi.z) };
+		float d = fmaxf(dist3(e, nearest), 1.0f);
+		tolerance = tolerance * d / view->projection;
+	}
+
+	/* chord error of a quadratic split n ways is |p0 - 2p1 + p2| / (4n^2) */
+	float n = ceilf(sqrtf(lod->curvature[patch] / (4.0f * fmaxf(tolerance, 1e-6f))));
+	u32 level = n < 1.0f? 1 : n > Q3PATCH_MAX_LEVEL? Q3PATCH_MAX_LEVEL : (u32)n;
+	if(lod->pow2) {
+		u32 p = 1;
+		while(p < level)
+			p <<= 1;
+		level = p;
+	}
+	return level;
+}
+
+size_t q3patchlod_update(struct q3patchlod* lod, float tolerance, const struct q3patchlod_view* view) {
+	struct q3patch_set* set = lod->set;
+	size_t n = set->n_patches;
+	u8* dirty = calloc(n? n : 1, 1);
+	u32* want = malloc(sizeof(u32) * (n? n : 1));
+	for(size_t i = 0; i < n; i++)
+		want[i] = q3patchlod_level(lod, i, tolerance, view);
+
+	/*
+		Stitching snaps the finer side of an edge onto the coarser one's, which moves its cells off
+		the surface by up to half the coarser error on top of their own. Linked patches take the
+		finest level among them instead, so no edge gets snapped and the bound holds.
+	*/
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(size_t i = 0; i < n; i++)
+			for(int e = 0; e < 4; e++) {
+				i32 other = set->patches[i].links[e].patch;
+				if(other >= 0 && want[other] > want[i]) {
+					want[i] = want[other];
+					changed = true;
+				}
+			}
+	}
+
+	for(size_t i = 0; i < n; i++) {
+		u32 level = want[i];
+		if(level == lod->levels[i])
+			continue;
+		lod->levels[i] = level;
+		/* neighbours' stitching depends on our level too */
+		dirty[i] = 1;
+		for(int e = 0; e < 4; e++)
+			if(set->patches[i].links[e].patch >= 0)
+				dirty[set->patches[i].links[e].patch] = 1;
+	}
+
+	q3patch_tessellate(set, lod->levels);
+
+	size_t redone = 0;
+	for(size_t i = 0; i < n; i++) {
+		if(!dirty[i] || !lod->levels[i])
+			continue;
+		const struct q3patch_mesh* m = set->patches[i].lods + lod->levels[i];
+		lod->vertices[i] = realloc(lod->vertices[i], sizeof(struct q3vertex) * m->n_vertices);
+		memcpy(lod->vertices[i], set->vertices + m->first_vertex, sizeof(struct q3vertex) * m->n_vertices);
+		q3patch_stitch(set, i, lod->levels, lod->vertices[i]);
+		redone++;
+	}
+
+	free(want);
+	free(dirty);
+	return redone;
+}
+
+size_t q3patchlod_triangles(const struct q3patchlod* lod) {
+	size_t n = 0;
+	for(size_t i = 0; i < lod->set->n_patches; i++)
+		if(lod->levels[i])
+			n += lod->set->patches[i].lods[lod->levels[i]].n_indices / 3;
+	return n;
+}
+
+/* exact surface position, u and v run over the whole patch in pieces (0..pieces_x) */
+static vec3 eval_pos(const struct q3patch_set* set, const struct q3patch* p, float u, float v) {
+	const struct q3vertex* ctrl = set->bsp->vertices + set->bsp->faces[p->face].first_vertex_idx;
+	u32 px = u >= p->pieces_x? p->pieces_x - 1 : (u32)u;
+	u32 py = v >= p->pieces_y? p->pieces_y - 1 : (u32)v;
+	u -= px;
+	v -= py;
+	float bu[3] = { (1 - u) * (1 - u), 2 * u * (1 - u), u * u };
+	float bv[3] = { (1 - v) * (1 - v), 2 * v * (1 - v), v * v };
+
+	vec3 r = { 0, 0, 0 };
+	for(int j = 0; j < 3; j++)
+		for(int i = 0; i < 3; i++) {
+			vec3 c = ctrl[(2 * py + j) * p->width + 2 * px + i].pos;
+			float w = bu[i] * bv[j];
+			r.x += w * c.x;
+			r.y += w * c.y;
+			r.z += w * c.z;
+		}
+	return r;
+}
+
+float q3patchlod_measure_error(const struct q3patchlod* lod) {
+	float err = 0.0f;
+	for(size_t i = 0; i < lod->set->n_patches; i++) {
+		u32 level = lod->levels[i];
+		if(!level || !lod->vertices[i])
+			continue;
+		const struct q3patch* p = lod->set->patches + i;
+		const struct q3patch_mesh* m = p->lods + level;
+		const struct q3vertex* v = lod->vertices[i];
+
+		for(u32 y = 0; y + 1 < m->height; y++)
+			for(u32 x = 0; x + 1 < m->width; x++) {
+				/* cell centre on the quad made of the two triangles vs the real surface */
+				vec3 a = v[y * m->width + x].pos, b = v[y * m->width + x + 1].pos;
+				vec3 c = v[(y + 1) * m->width + x].pos, d = v[(y + 1) * m->width + x + 1].pos;
+				vec3 mid = { (a.x + b.x + c.x + d.x) * 0.25f, (a.y + b.y + c.y + d.y) * 0.25f, (a.z + b.z + c.z + d.z) * 0.25f };
+				vec3 real = eval_pos(lod->set, p, (x + 0.5f) / level, (y + 0.5f) / level);
+				err = fmaxf(err, dist3(mid, real));
+			}
+	}
+	return err;
+}
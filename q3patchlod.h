@@ -0,0 +1,57 @@
+#ifndef Q3_PATCHLOD_H_
+#define Q3_PATCHLOD_H_
+
+#include <stdbool.h>
+
+#include "q3patch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* for view dependent levels, error is then measured in pixels instead of world units */
+struct q3patchlod_view {
+	vec3 eye;
+	/* pixels per world unit at distance 1, image_height / (2*tan(fov_y/2)) */
+	float projection;
+};
+
+/* per patch level choice that is kept across updates */
+struct q3patchlod {
+	struct q3patch_set* set;
+	/* largest second difference of any control row or column, in world units */
+	float* curvature;
+	vec3* mins;
+	vec3* maxs;
+	u32* levels;
+	/* stitched copy of each patch at its current level */
+	struct q3vertex** vertices;
+	/* only round levels up to powers of two, so the cache gets reused more */
+	bool pow2;
+};
+
+struct q3patchlod* q3patchlod_init(struct q3patch_set* set, bool pow2);
+void q3patchlod_free(struct q3patchlod* lod);
+
+/* the level that keeps the chord error of every piece under tolerance */
+u32 q3patchlod_level(const struct q3patchlod* lod, size_t patch, float tolerance, const struct q3patchlod_view* view);
+
+/*
+	Picks a level for every patch, raised to the finest among the patches it's linked to so that
+	stitching never has to snap an edge, then re-tessellates and re-stitches only the patches
+	whose level changed (or whose neighbour's did). view may be NULL. Returns how many were redone.
+*/
+size_t q3patchlod_update(struct q3patchlod* lod, float tolerance, const struct q3patchlod_view* view);
+
+size_t q3patchlod_triangles(const struct q3patchlod* lod);
+
+/*
+	Largest distance between the true surface and the current triangles, sampled at cell centres.
+	With the levels from q3patchlod_update this stays under tolerance.
+*/
+float q3patchlod_measure_error(const struct q3patchlod* lod);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
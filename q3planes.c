@@ -1,21 +1,72 @@
 #include <float.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "q3brickmap.h"
 #include "q3bsp.h"
+#include "q3parallel.h"
+#include "q3raster.h"
+#include "q3sdf.h"
+#include "q3time.h"
 #include "q3util.h"
 
 #include <SDL2/SDL.h>
 
 /* control detail of raymarching */
-#define MAX_STEPS 64
-#define MAX_DIST 200.0
+#define MAX_STEPS 128
+#define MAX_DIST 4096.0
+/* furthest the brush lookup reaches, and so the longest single step */
+#define SDF_RADIUS 256.0f
+/* close enough to count as a hit, relative to how far the ray went, about a pixel at 1024 wide */
+#define HIT_EPSILON 0.001f
+/* default spacing of the baked distance samples */
+#define BRICK_VOXEL 8.0f
+/* tessellation of curved surfaces when rasterizing, and how close to the eye triangles get cut */
+#define RASTER_PATCH_LEVEL 4
+#define RASTER_NEAR 1.0f
+/* frames each raster benchmark averages over */
+#define RASTER_BENCH_FRAMES 8
+/* where a player's eyes are above their origin */
+#define VIEW_HEIGHT 26.0f
+/* how far a key press moves the camera, and how many radians it turns it */
+#define MOVE_STEP 16.0f
+#define TURN_STEP 0.1f
+
+/* 32x32 pixels is 4KiB of framebuffer, small enough that a tile stays in L1 while it's traced */
+#define TILE_SIZE 32
+/* first progressive pass traces one pixel per 8x8 block, has to divide TILE_SIZE */
+#define PREVIEW_STRIDE 8
 
 struct vec3 cam_pos = { 0.0, -1.0, 0.0 };
+struct vec3 cam_dir = { 0.0, -1.0, 0.0 };
+
+struct q3sdf* brushes = NULL;
+/* baked from brushes, used instead of them when there */
+struct q3brickmap* bricks = NULL;
+/* when there, frames are rasterized from the map's faces instead of marched */
+struct q3raster_scene* scene = NULL;
+struct q3raster* raster = NULL;
+/* cull leaves behind the nearest ones through a depth pyramid */
+bool occlusion = true;
 
 size_t image_width = 256;
 size_t image_height = 256;
+/* seconds draw may spend refining before it presents, 0 renders whole frames */
+double budget = 0.0;
+/* no per-frame lines, for when stdout is for something else */
+bool quiet = false;
+/* where everything but the frame lines goes, stderr when stdout is only for the JSON */
+FILE* info = NULL;
 
 /* raymarch planes */
 /* make everything a copy and let the optimizer take care of it */
@@ -52,62 +103,167 @@ static vec3 cross(struct vec3 v1, struct vec3 v2) {
 	};
 }
 
-static float sdf_plane(struct vec3 p, struct vec3 norm, float dist) {
-	return dot(p, norm) + dist;
-}
-
-static float sdf(const struct q3bsp* bsp, const struct vec3 p) {
-	float dist = FLT_MAX;
-	dist = fminf(dist, length(p)-0.5);
-
-	/*for(size_t i = 0; i < bsp->n_planes; i++) {
-		dist = fminf(dist, sdf_plane(p, bsp->planes[i].norm, bsp->planes[i].dist));
-	}*/
-
-	return dist;
+static float sdf(const struct vec3 p) {
+	if(bricks)
+		return q3brickmap_sample(bricks, p);
+	return q3sdf_eval(brushes, p, SDF_RADIUS, NULL);
 }
 
-float cast(struct q3bsp* bsp, const struct vec3 dir) {
+float cast(const struct vec3 dir) {
 	float t = 0.0;
 
 	for(size_t i = 0; i < MAX_STEPS; i++) {
-		float dt = sdf(bsp, add(cam_pos, scalar(dir, t)));
+		float dt = sdf(add(cam_pos, scalar(dir, t)));
 
-		if(dt < 0.0001f*t)
+		if(dt < HIT_EPSILON*t)
 			return t;
-		else if(dt > MAX_DIST)
-			return -1.0;
-		
+
 		t += dt;
+		if(t > MAX_DIST)
+			return -1.0;
 	}
 
 	return -1.0;
 }
 
-struct vec3 raygen(vec3 cam_dir, size_t x, size_t y) {
+/* the camera basis only changes once a frame, not per pixel */
+struct camera {
+	vec3 forward;
+	vec3 right;
+	vec3 up;
+	float ratio;
+};
+
+struct camera camera_setup(vec3 cam_dir) {
+	struct camera cam = { .forward = cam_dir };
+	cam.right = normalize(cross(cam.forward, (vec3){0.0, 0.0, 1.0}));
+	cam.up = normalize(cross(cam.right, cam.forward));
+	cam.ratio = (float)image_width / (float)image_height;
+	return cam;
+}
+
+struct vec3 raygen(const struct camera* cam, size_t x, size_t y) {
 	vec2 ndc = {
 		.x = 2.0 * (((float)x)/(float)image_width) - 1.0,
 		.y = 1.0 - (2.0* (float)y/(float)image_height),
 	};
 
-	const float ratio = (float)image_width / (float)image_height;
-	ndc.x *= ratio;
-
-	const vec3 forward = cam_dir;
-	const vec3 right = normalize(cross(forward, (vec3){0.0, 0.0, 1.0}));
-	const vec3 up = normalize(cross(right, forward));
+	ndc.x *= cam->ratio;
 
 	return normalize(
 		add(
 			add(
-				scalar(right, ndc.x),
-				scalar(up, ndc.y)
+				scalar(cam->right, ndc.x),
+				scalar(cam->up, ndc.y)
 			),
-			scalar(forward, 2.0)
+			scalar(cam->forward, 2.0)
 		)
 	);
 }
 
+/* packets of rays along a row, SoA, lanes drop out as they hit or escape */
+#if defined(__AVX2__)
+#define LANES 8
+
+/* the brush lookup is a tree walk, so lanes go one at a time, and only the ones still marching */
+static __m256 sdf_lanes(__m256 px, __m256 py, __m256 pz, __m256 active) {
+	float x[LANES], y[LANES], z[LANES], d[LANES] = { 0.0f };
+	_mm256_storeu_ps(x, px);
+	_mm256_storeu_ps(y, py);
+	_mm256_storeu_ps(z, pz);
+	for(int mask = _mm256_movemask_ps(active); mask; mask &= mask - 1) {
+		int l = __builtin_ctz(mask);
+		d[l] = sdf((vec3) { x[l], y[l], z[l] });
+	}
+	return _mm256_loadu_ps(d);
+}
+
+/*
+	t for the first n of pixels x, x + step, ... of row y, -1 where nothing was hit. Every lane
+	does the same math whatever its neighbours, so a pixel comes out the same in any packet.
+*/
+static void cast_lanes(const struct camera* cam, size_t x, size_t step, size_t n, size_t y, float* out) {
+	const __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+	__m256 nx = _mm256_add_ps(_mm256_set1_ps((float)x), _mm256_mul_ps(lane, _mm256_set1_ps((float)step)));
+	nx = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(nx, _mm256_set1_ps(2.0f / image_width)), _mm256_set1_ps(1.0f)), _mm256_set1_ps(cam->ratio));
+	const float ny = 1.0f - 2.0f * (float)y / (float)image_height;
+
+	__m256 d[3];
+	const float* right = &cam->right.x, * up = &cam->up.x, * forward = &cam->forward.x;
+	for(int k = 0; k < 3; k++)
+		d[k] = _mm256_add_ps(_mm256_mul_ps(nx, _mm256_set1_ps(right[k])), _mm256_set1_ps(up[k] * ny + forward[k] * 2.0f));
+	__m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f),
+		_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(d[0], d[0]), _mm256_add_ps(_mm256_mul_ps(d[1], d[1]), _mm256_mul_ps(d[2], d[2])))));
+	for(int k = 0; k < 3; k++)
+		d[k] = _mm256_mul_ps(d[k], inv);
+
+	const __m256 ox = _mm256_set1_ps(cam_pos.x), oy = _mm256_set1_ps(cam_pos.y), oz = _mm256_set1_ps(cam_pos.z);
+	const __m256 eps = _mm256_set1_ps(HIT_EPSILON), max_dist = _mm256_set1_ps(MAX_DIST);
+	__m256 t = _mm256_setzero_ps(), result = _mm256_set1_ps(-1.0f);
+	__m256 active = _mm256_cmp_ps(lane, _mm256_set1_ps((float)n), _CMP_LT_OQ);
+	for(size_t i = 0; i < MAX_STEPS; i++) {
+		__m256 dt = sdf_lanes(_mm256_add_ps(_mm256_mul_ps(d[0], t), ox), _mm256_add_ps(_mm256_mul_ps(d[1], t), oy),
+			_mm256_add_ps(_mm256_mul_ps(d[2], t), oz), active);
+		__m256 hit = _mm256_and_ps(active, _mm256_cmp_ps(dt, _mm256_mul_ps(eps, t), _CMP_LT_OQ));
+		result = _mm256_blendv_ps(result, t, hit);
+		active = _mm256_andnot_ps(hit, active);
+		t = _mm256_add_ps(t, _mm256_and_ps(dt, active));
+		active = _mm256_andnot_ps(_mm256_cmp_ps(t, max_dist, _CMP_GT_OQ), active);
+		if(!_mm256_movemask_ps(active))
+			break;
+	}
+	_mm256_storeu_ps(out, result);
+}
+
+#elif defined(__SSE2__)
+#define LANES 4
+
+static __m128 sdf_lanes(__m128 px, __m128 py, __m128 pz, __m128 active) {
+	float x[LANES], y[LANES], z[LANES], d[LANES] = { 0.0f };
+	_mm_storeu_ps(x, px);
+	_mm_storeu_ps(y, py);
+	_mm_storeu_ps(z, pz);
+	for(int mask = _mm_movemask_ps(active); mask; mask &= mask - 1) {
+		int l = __builtin_ctz(mask);
+		d[l] = sdf((vec3) { x[l], y[l], z[l] });
+	}
+	return _mm_loadu_ps(d);
+}
+
+static void cast_lanes(const struct camera* cam, size_t x, size_t step, size_t n, size_t y, float* out) {
+	const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	__m128 nx = _mm_add_ps(_mm_set1_ps((float)x), _mm_mul_ps(lane, _mm_set1_ps((float)step)));
+	nx = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(nx, _mm_set1_ps(2.0f / image_width)), _mm_set1_ps(1.0f)), _mm_set1_ps(cam->ratio));
+	const float ny = 1.0f - 2.0f * (float)y / (float)image_height;
+
+	__m128 d[3];
+	const float* right = &cam->right.x, * up = &cam->up.x, * forward = &cam->forward.x;
+	for(int k = 0; k < 3; k++)
+		d[k] = _mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(right[k])), _mm_set1_ps(up[k] * ny + forward[k] * 2.0f));
+	__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f),
+		_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(d[0], d[0]), _mm_add_ps(_mm_mul_ps(d[1], d[1]), _mm_mul_ps(d[2], d[2])))));
+	for(int k = 0; k < 3; k++)
+		d[k] = _mm_mul_ps(d[k], inv);
+
+	const __m128 ox = _mm_set1_ps(cam_pos.x), oy = _mm_set1_ps(cam_pos.y), oz = _mm_set1_ps(cam_pos.z);
+	const __m128 eps = _mm_set1_ps(HIT_EPSILON), max_dist = _mm_set1_ps(MAX_DIST);
+	__m128 t = _mm_setzero_ps(), result = _mm_set1_ps(-1.0f);
+	__m128 active = _mm_cmplt_ps(lane, _mm_set1_ps((float)n));
+	for(size_t i = 0; i < MAX_STEPS; i++) {
+		__m128 dt = sdf_lanes(_mm_add_ps(_mm_mul_ps(d[0], t), ox), _mm_add_ps(_mm_mul_ps(d[1], t), oy), _mm_add_ps(_mm_mul_ps(d[2], t), oz), active);
+		/* no blendv before SSE4.1 */
+		__m128 hit = _mm_and_ps(active, _mm_cmplt_ps(dt, _mm_mul_ps(eps, t)));
+		result = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, result));
+		active = _mm_andnot_ps(hit, active);
+		t = _mm_add_ps(t, _mm_and_ps(dt, active));
+		active = _mm_andnot_ps(_mm_cmpgt_ps(t, max_dist), active);
+		if(!_mm_movemask_ps(active))
+			break;
+	}
+	_mm_storeu_ps(out, result);
+}
+#endif
+
 u32 rgbfromu8(u8 r, u8 g, u8 b) {
 	return r << 16 | g << 8 | b;
 }
@@ -116,6 +272,43 @@ u32 color(vec3 in) {
 	return rgbfromu8(in.x*255.0, in.y*255.0, in.z*255.0);
 }
 
+/* grey fading with distance, black where nothing was hit */
+u32 shade(float t) {
+	if(t < 0.0f)
+		return 0;
+	float g = 1.0f - 0.9f * fminf(t / 2048.0f, 1.0f);
+	return color((vec3) { g, g, g });
+}
+
+/* the first player spawn, looking the way it faces */
+void spawn_camera(const struct q3bsp* bsp) {
+	for(const char* p = bsp->entities; p && (p = strchr(p, '{'));) {
+		const char* end = strchr(p, '}');
+		if(!end)
+			break;
+		size_t len = end - p;
+		char* ent = strndup(p, len);
+		p = end;
+
+		float angle = 0.0f;
+		vec3 origin;
+		const char* key;
+		if(!strstr(ent, "\"info_player_deathmatch\"") && !strstr(ent, "\"info_player_start\""))
+			goto next;
+		if(!(key = strstr(ent, "\"origin\"")) || sscanf(key, "\"origin\" \"%f %f %f\"", &origin.x, &origin.y, &origin.z) != 3)
+			goto next;
+		if((key = strstr(ent, "\"angle\"")))
+			sscanf(key, "\"angle\" \"%f\"", &angle);
+
+		cam_pos = (vec3) { origin.x, origin.y, origin.z + VIEW_HEIGHT };
+		cam_dir = (vec3) { cosf(angle * (float)M_PI / 180.0f), sinf(angle * (float)M_PI / 180.0f), 0.0f };
+		free(ent);
+		return;
+next:
+		free(ent);
+	}
+}
+
 u32* framebuffer = NULL;
 /* temporary SDL context, so using globals */
 SDL_Window* win;
@@ -145,14 +338,322 @@ err:
     exit(EXIT_FAILURE);
 }
 
-void draw(struct q3bsp* bsp) {
-	const vec3 cam_dir = { 0.0, -1.0, 0.0 };
+struct q3pool* pool = NULL;
+
+struct draw_job {
+	struct camera cam;
+	size_t tiles_x;
+	/* trace every stride'th pixel and fill its block, first says the pixels on the grid twice as wide aren't done yet */
+	size_t stride;
+	bool first;
+	/* how long each tile took, and how long each worker was busy */
+	double* tile_time;
+	double* worker_time;
+};
+
+/*
+	Pixels x0, x0 + step, ... before x1 of row y, each filling its stride sized block down to y1.
+	The last packet is cut short rather than finished one pixel at a time, so every pixel goes
+	through the same kernel whichever pass traces it.
+*/
+static void draw_span(const struct camera* cam, size_t x0, size_t x1, size_t step, size_t stride, size_t y, size_t y1) {
+	size_t n = x1 > x0? (x1 - x0 + step - 1) / step : 0;
+#ifdef LANES
+	float t[TILE_SIZE + LANES];
+	for(size_t i = 0; i < n; i += LANES)
+		cast_lanes(cam, x0 + i * step, step, n - i < LANES? n - i : LANES, y, t + i);
+#else
+	float t[TILE_SIZE];
+	for(size_t i = 0; i < n; i++)
+		t[i] = cast(raygen(cam, x0 + i * step, y));
+#endif
+	size_t by1 = y + stride < y1? y + stride : y1;
+	for(size_t i = 0; i < n; i++) {
+		u32 c = shade(t[i]);
+		size_t x = x0 + i * step, bx1 = x + stride < x1? x + stride : x1;
+		for(size_t by = y; by < by1; by++)
+			for(size_t bx = x; bx < bx1; bx++)
+				framebuffer[by*image_width+bx] = c;
+	}
+}
+
+static void draw_tile(void* user, size_t tile, size_t worker) {
+	const struct draw_job* job = user;
+	double t0 = q3_seconds();
+
+	size_t x0 = tile % job->tiles_x * TILE_SIZE, y0 = tile / job->tiles_x * TILE_SIZE;
+	size_t x1 = x0 + TILE_SIZE < image_width? x0 + TILE_SIZE : image_width;
+	size_t y1 = y0 + TILE_SIZE < image_height? y0 + TILE_SIZE : image_height;
+	size_t stride = job->stride, skip = job->first? 0 : stride * 2;
+	for(size_t y = y0; y < y1; y += stride) {
+		/* tiles start on the coarser grid, so on its rows the new pixels are every other one starting one in */
+		if(skip && y % skip == 0)
+			draw_span(&job->cam, x0 + stride, x1, skip, stride, y, y1);
+		else
+			draw_span(&job->cam, x0, x1, stride, stride, y, y1);
+	}
+
+	double t = q3_seconds() - t0;
+	job->tile_time[tile] = t;
+	job->worker_time[worker] += t;
+}
+
+/* one thread through a whole frame each way, to see what the packets buy */
+void bench_cast(void) {
+	struct camera cam = camera_setup(cam_dir);
+	size_t n = image_width * image_height;
+	float* scalar_t = malloc(sizeof(float) * n);
+
+	double t0 = q3_seconds();
+	for(size_t y = 0; y < image_height; y++)
+		for(size_t x = 0; x < image_width; x++)
+			scalar_t[y*image_width+x] = cast(raygen(&cam, x, y));
+	double t_scalar = q3_seconds() - t0;
+	fprintf(info, "Scalar: %.2f Mrays/s\n", n / t_scalar * 1e-6);
+
+	/* what each step cost, against the whole map */
+	struct q3sdf_stats stats = { 0 };
+	size_t steps = 0;
+	for(size_t y = 0; y < image_height; y += 4) {
+		for(size_t x = 0; x < image_width; x += 4) {
+			vec3 dir = raygen(&cam, x, y);
+			for(float t = 0.0f; steps++, t <= MAX_DIST;) {
+				float dt = q3sdf_eval(brushes, add(cam_pos, scalar(dir, t)), SDF_RADIUS, &stats);
+				if(dt < HIT_EPSILON*t)
+					break;
+				t += dt;
+			}
+		}
+	}
+	fprintf(info, "Per step: %.1f nodes, %.1f leaves, %.1f of %zu hulls\n", (double)stats.nodes / steps,
+		(double)stats.leaves / steps, (double)stats.hulls / steps, brushes->hulls->n_hulls);
+
+#ifdef LANES
+	float* packet_t = malloc(sizeof(float) * n);
+	t0 = q3_seconds();
+	for(size_t y = 0; y < image_height; y++) {
+		size_t x = 0;
+		for(; x + LANES <= image_width; x += LANES)
+			cast_lanes(&cam, x, 1, LANES, y, packet_t + y*image_width+x);
+		for(; x < image_width; x++)
+			packet_t[y*image_width+x] = cast(raygen(&cam, x, y));
+	}
+	double t_packet = q3_seconds() - t0;
+
+	size_t hits = 0, differ = 0;
+	for(size_t i = 0; i < n; i++) {
+		hits += scalar_t[i] >= 0.0f;
+		differ += (scalar_t[i] >= 0.0f) != (packet_t[i] >= 0.0f);
+	}
+	fprintf(info, "%d wide: %.2f Mrays/s (%.2fx), %zu of %zu pixels differ in hit or miss, %zu hits\n",
+		LANES, n / t_packet * 1e-6, t_scalar / t_packet, differ, n, hits);
+	free(packet_t);
+#endif
+	free(scalar_t);
+}
+
+/* the same frame marched through the exact brushes and the bricks */
+void bench_bricks(void) {
+	struct camera cam = camera_setup(cam_dir);
+	size_t n = image_width * image_height;
+	float* exact_t = malloc(sizeof(float) * n);
+	struct q3brickmap* baked = bricks;
+
+	bricks = NULL;
+	double t0 = q3_seconds();
+	for(size_t y = 0; y < image_height; y++)
+		for(size_t x = 0; x < image_width; x++)
+			exact_t[y*image_width+x] = cast(raygen(&cam, x, y));
+	double t_exact = q3_seconds() - t0;
+
+	bricks = baked;
+	size_t differ = 0, both = 0;
+	double depth_error = 0.0;
+	t0 = q3_seconds();
 	for(size_t y = 0; y < image_height; y++) {
 		for(size_t x = 0; x < image_width; x++) {
-			vec3 ray = raygen(cam_dir, x, y);
-			framebuffer[y*image_width+x] = cast(bsp, cam_dir) >= 0.0? 0xFFFFFFFF : 0;
+			float t = cast(raygen(&cam, x, y));
+			float e = exact_t[y*image_width+x];
+			differ += (t >= 0.0f) != (e >= 0.0f);
+			if(t >= 0.0f && e >= 0.0f) {
+				depth_error += fabsf(t - e);
+				both++;
+			}
 		}
 	}
+	double t_bricks = q3_seconds() - t0;
+
+	fprintf(info, "Marching: %.3f Mrays/s exact, %.3f Mrays/s bricks (%.1fx), %zu pixels differ in hit or miss, depth off by %.2f on average\n",
+		n / t_exact * 1e-6, n / t_bricks * 1e-6, t_exact / t_bricks, differ, both? depth_error / both : 0.0);
+	free(exact_t);
+}
+
+/* one pass over the framebuffer, see draw_job for stride and first */
+double render_pass(size_t stride, bool first) {
+	if(!pool)
+		pool = q3pool_create(0);
+
+	size_t n_workers = q3pool_n_threads(pool);
+	size_t tiles_x = (image_width + TILE_SIZE - 1) / TILE_SIZE;
+	size_t tiles_y = (image_height + TILE_SIZE - 1) / TILE_SIZE;
+	size_t n_tiles = tiles_x * tiles_y;
+	struct draw_job job = {
+		.cam = camera_setup(cam_dir),
+		.tiles_x = tiles_x,
+		.stride = stride,
+		.first = first,
+		.tile_time = malloc(sizeof(double) * (n_tiles? n_tiles : 1)),
+		.worker_time = calloc(n_workers, sizeof(double)),
+	};
+
+	double t0 = q3_seconds();
+	size_t steals = q3pool_for(pool, n_tiles, draw_tile, &job);
+	double t = q3_seconds() - t0;
+
+	/* busiest worker against the average shows how unevenly the tiles cost */
+	double tile_min = n_tiles? job.tile_time[0] : 0.0, tile_max = 0.0, tile_sum = 0.0, busiest = 0.0, busy = 0.0;
+	for(size_t i = 0; i < n_tiles; i++) {
+		tile_min = fmin(tile_min, job.tile_time[i]);
+		tile_max = fmax(tile_max, job.tile_time[i]);
+		tile_sum += job.tile_time[i];
+	}
+	for(size_t i = 0; i < n_workers; i++) {
+		busiest = fmax(busiest, job.worker_time[i]);
+		busy += job.worker_time[i];
+	}
+	char label[32];
+	if(stride == 1 && first)
+		snprintf(label, sizeof(label), "Frame");
+	else
+		snprintf(label, sizeof(label), "Pass 1/%zu", stride);
+	if(!quiet)
+		printf("%s: %.3f ms, %zu tiles on %zu threads, tile min/avg/max %.3f/%.3f/%.3f ms, imbalance %.2f, %zu steals\n",
+			label, t * 1e3, n_tiles, n_workers, tile_min * 1e3, tile_sum * 1e3 / (n_tiles? n_tiles : 1), tile_max * 1e3,
+			busy > 0.0? busiest * n_workers / busy : 1.0, steals);
+
+	free(job.worker_time);
+	free(job.tile_time);
+	return t;
+}
+
+/* the same view as raygen, a pixel off centre is 2 / image_height of the forward distance */
+static struct q3raster_view raster_view(void) {
+	struct camera cam = camera_setup(cam_dir);
+	return (struct q3raster_view) { cam_pos, cam.forward, cam.right, cam.up, (float)image_height, RASTER_NEAR };
+}
+
+double render_raster(struct q3raster_stats* stats) {
+	if(!pool)
+		pool = q3pool_create(0);
+	if(!raster)
+		raster = q3raster_create(pool, image_width, image_height);
+
+	struct q3raster_view view = raster_view();
+	double t0 = q3_seconds();
+	q3raster_clear(raster, framebuffer, 0);
+	q3raster_draw_bsp(raster, scene, &view, occlusion, framebuffer, stats);
+	return q3_seconds() - t0;
+}
+
+/* traces or rasterizes a frame into framebuffer, returns how long it took */
+double render(void) {
+	if(!scene)
+		return render_pass(1, true);
+
+	struct q3raster_stats stats = { 0 };
+	double t = render_raster(&stats);
+	if(!quiet)
+		printf("Raster: %.3f ms, setup %.3f ms, raster %.3f ms, %zu triangles, %zu culled, %zu clipped, %zu in bins, %zu pixels, "
+			"%zu leaves, %zu occluders, %zu hidden and %zu nodes in %.3f ms\n",
+			t * 1e3, stats.setup_time * 1e3, stats.raster_time * 1e3, stats.triangles, stats.culled, stats.clipped,
+			stats.binned, stats.pixels, stats.leaves, stats.occluders, stats.culled_leaves, stats.culled_nodes, stats.cull_time * 1e3);
+	return t;
+}
+
+/* triangles and pixels a second through the pool and through one thread from where the camera is, then the tree walk with and without the pyramid */
+void bench_raster(void) {
+	if(!raster)
+		raster = q3raster_create(pool, image_width, image_height);
+	struct q3pool* one = q3pool_create(1);
+	struct q3pool* pools[2] = { pool, one };
+	struct q3raster_view view = raster_view();
+	for(int p = 0; p < 2; p++) {
+		struct q3raster* r = q3raster_create(pools[p], image_width, image_height);
+		struct q3raster_stats stats = { 0 };
+		/* one to warm up the bins */
+		q3raster_draw(r, scene, &view, NULL, 0, framebuffer, NULL);
+		double t0 = q3_seconds();
+		for(int f = 0; f < RASTER_BENCH_FRAMES; f++) {
+			q3raster_clear(r, framebuffer, 0);
+			q3raster_draw(r, scene, &view, NULL, 0, framebuffer, &stats);
+		}
+		double t = q3_seconds() - t0;
+		fprintf(info, "Raster %zu threads: %.3f ms a frame, %.2f Mtris/s set up, %.2f Mtris/s whole, %.2f Mpixels/s filled, %.2f depth passes a pixel\n",
+			q3pool_n_threads(pools[p]), t * 1e3 / RASTER_BENCH_FRAMES, stats.triangles / stats.setup_time * 1e-6,
+			stats.triangles / t * 1e-6, stats.pixels / stats.raster_time * 1e-6,
+			(double)stats.pixels / (image_width * image_height * RASTER_BENCH_FRAMES));
+		q3raster_free(r);
+	}
+	q3pool_free(one);
+
+	/* what the pyramid saves over frustum and PVS alone */
+	double t[2];
+	struct q3raster_stats stats[2] = { { 0 } };
+	for(int hiz = 0; hiz < 2; hiz++) {
+		q3raster_draw_bsp(raster, scene, &view, hiz, framebuffer, NULL);
+		double t0 = q3_seconds();
+		for(int f = 0; f < RASTER_BENCH_FRAMES; f++) {
+			q3raster_clear(raster, framebuffer, 0);
+			q3raster_draw_bsp(raster, scene, &view, hiz, framebuffer, stats + hiz);
+		}
+		t[hiz] = (q3_seconds() - t0) / RASTER_BENCH_FRAMES;
+	}
+	fprintf(info, "Hi-Z: %zu of %zu leaves and %zu nodes culled, %zu fewer triangles, %.3f ms a frame against %.3f ms, %.3f ms saved (%.0f%%), culling took %.3f ms\n",
+		stats[1].culled_leaves / RASTER_BENCH_FRAMES, stats[1].leaves / RASTER_BENCH_FRAMES, stats[1].culled_nodes / RASTER_BENCH_FRAMES,
+		(stats[0].triangles - stats[1].triangles) / RASTER_BENCH_FRAMES, t[1] * 1e3, t[0] * 1e3, (t[0] - t[1]) * 1e3,
+		t[0] > 0.0? (t[0] - t[1]) / t[0] * 100.0 : 0.0, stats[1].cull_time * 1e3 / RASTER_BENCH_FRAMES);
+}
+
+/* how far refinement got, and for which camera */
+struct progress {
+	bool valid;
+	vec3 pos, dir;
+	/* of the next pass, 0 once every pixel has been traced */
+	size_t stride;
+} progress = { 0 };
+
+static bool same_vec(vec3 a, vec3 b) {
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+/*
+	A coarse preview first, then passes at half the stride each tracing only the pixels the ones
+	before skipped, so the last pass leaves exactly what render would have. Passes are kept while
+	the camera stays put, and one only starts if it looks like it fits in the budget, guessing
+	each costs about 4 times the one before since it traces 3 times the pixels and smaller blocks.
+	Returns the time spent, 0 if there was nothing left to trace.
+*/
+double refine(double budget) {
+	if(!progress.valid || !same_vec(progress.pos, cam_pos) || !same_vec(progress.dir, cam_dir))
+		progress = (struct progress) { true, cam_pos, cam_dir, PREVIEW_STRIDE };
+
+	double t0 = q3_seconds(), last = 0.0;
+	while(progress.stride) {
+		double spent = q3_seconds() - t0;
+		/* at least one pass, so there's something new each time */
+		if(spent > 0.0 && spent + last * 4.0 > budget)
+			break;
+		last = render_pass(progress.stride, progress.stride == PREVIEW_STRIDE);
+		progress.stride /= 2;
+	}
+	return q3_seconds() - t0;
+}
+
+/* how long draw's last render took */
+double last_frame = 0.0;
+
+void draw(void) {
+	last_frame = budget > 0.0? refine(budget) : render();
 
 	SDL_UpdateTexture(tex, NULL, framebuffer, image_width*sizeof(uint32_t));
 
@@ -160,6 +661,282 @@ void draw(struct q3bsp* bsp) {
 	SDL_RenderPresent(ren);
 }
 
+/* camera the event thread steers and the render thread follows */
+struct view {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	vec3 pos, dir;
+	bool changed;
+	/* -frames wants frames counted without anyone steering, so keep making them */
+	bool continuous;
+	bool quit;
+} view = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+/*
+	Finished frames on their way to the event thread, without either side ever waiting on the
+	other. The render thread copies framebuffer into back and swaps it into ready with
+	FRAME_FRESH set, the event thread swaps its front for ready whenever the bit is there.
+	Whatever either gets back from the swap is theirs to overwrite.
+*/
+#define FRAME_FRESH ((uintptr_t)1)
+struct frames {
+	u32* back;
+	u32* front;
+	atomic_uintptr_t ready;
+	/* pushed after each swap so the event thread wakes up for it */
+	u32 event;
+} frames;
+
+static void publish(void) {
+	memcpy(frames.back, framebuffer, image_width * image_height * sizeof(u32));
+	uintptr_t old = atomic_exchange(&frames.ready, (uintptr_t)frames.back | FRAME_FRESH);
+	frames.back = (u32*)(old & ~FRAME_FRESH);
+
+	SDL_Event e = { .type = frames.event };
+	SDL_PushEvent(&e);
+}
+
+/* the newest frame into front, false if there's been none since the last */
+static bool take_frame(void) {
+	if(!(atomic_load(&frames.ready) & FRAME_FRESH))
+		return false;
+	/* only this thread clears the bit, so it's still set */
+	uintptr_t fresh = atomic_exchange(&frames.ready, (uintptr_t)frames.front);
+	frames.front = (u32*)(fresh & ~FRAME_FRESH);
+	return true;
+}
+
+/* traces whenever the view moves, while there's refining left or frames are being counted, and sleeps otherwise */
+static void* render_main(void* user) {
+	(void)user;
+	bool dirty = true;
+	for(;;) {
+		pthread_mutex_lock(&view.lock);
+		while(!view.quit && !view.changed && !dirty && !view.continuous && !(budget > 0.0 && progress.stride))
+			pthread_cond_wait(&view.wake, &view.lock);
+		if(view.quit) {
+			pthread_mutex_unlock(&view.lock);
+			break;
+		}
+		if(view.changed) {
+			cam_pos = view.pos;
+			cam_dir = view.dir;
+			view.changed = false;
+			dirty = true;
+		}
+		pthread_mutex_unlock(&view.lock);
+
+		last_frame = budget > 0.0? refine(budget) : render();
+		dirty = false;
+		publish();
+	}
+	return NULL;
+}
+
+/* WASD or the arrow keys, false for keys that don't move anything */
+static bool steer(SDL_Keycode key) {
+	pthread_mutex_lock(&view.lock);
+	vec3 side = cross(view.dir, (vec3) { 0.0f, 0.0f, 1.0f });
+	float turn = 0.0f;
+	switch(key) {
+	case SDLK_w:
+	case SDLK_UP:
+		view.pos = add(view.pos, scalar(view.dir, MOVE_STEP));
+		break;
+	case SDLK_s:
+	case SDLK_DOWN:
+		view.pos = add(view.pos, scalar(view.dir, -MOVE_STEP));
+		break;
+	case SDLK_a:
+	case SDLK_d:
+		/* looking straight up or down there's no side to go to */
+		if(length(side) > 0.0f)
+			view.pos = add(view.pos, scalar(normalize(side), key == SDLK_d? MOVE_STEP : -MOVE_STEP));
+		break;
+	case SDLK_LEFT:
+		turn = TURN_STEP;
+		break;
+	case SDLK_RIGHT:
+		turn = -TURN_STEP;
+		break;
+	default:
+		pthread_mutex_unlock(&view.lock);
+		return false;
+	}
+	if(turn != 0.0f) {
+		float c = cosf(turn), s = sinf(turn);
+		view.dir = (vec3) { view.dir.x * c - view.dir.y * s, view.dir.x * s + view.dir.y * c, view.dir.z };
+	}
+	view.changed = true;
+	pthread_cond_signal(&view.wake);
+	pthread_mutex_unlock(&view.lock);
+	return true;
+}
+
+/*
+	The window's loop. Tracing happens on its own thread, this one only takes input and uploads
+	whatever frame is newest, so neither holds the other up. Stops after max_frames frames were
+	shown, unless that's 0.
+*/
+void run_window(size_t max_frames) {
+	size_t size = image_width * image_height;
+	frames.back = calloc(size, sizeof(u32));
+	frames.front = calloc(size, sizeof(u32));
+	atomic_init(&frames.ready, (uintptr_t)calloc(size, sizeof(u32)));
+	frames.event = SDL_RegisterEvents(1);
+	view.pos = cam_pos;
+	view.dir = cam_dir;
+	view.continuous = max_frames > 0;
+	view.quit = false;
+
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, render_main, NULL)) {
+		fprintf(stderr, "Error starting the render thread\n");
+		goto done;
+	}
+
+	size_t shown = 0;
+	SDL_Event e;
+	while(SDL_WaitEvent(&e)) {
+		if(e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE))
+			break;
+		if(e.type == SDL_KEYDOWN)
+			steer(e.key.keysym.sym);
+		if(!take_frame())
+			continue;
+		SDL_UpdateTexture(tex, NULL, frames.front, image_width*sizeof(uint32_t));
+		SDL_RenderCopy(ren, tex, NULL, NULL);
+		SDL_RenderPresent(ren);
+		if(max_frames && ++shown >= max_frames)
+			break;
+	}
+
+	pthread_mutex_lock(&view.lock);
+	view.quit = true;
+	pthread_cond_signal(&view.wake);
+	pthread_mutex_unlock(&view.lock);
+	pthread_join(thread, NULL);
+done:
+	free(frames.back);
+	free(frames.front);
+	free((u32*)(atomic_load(&frames.ready) & ~FRAME_FRESH));
+}
+
+/* framebuffer as binary PPM, 0 or EOF like fclose */
+int write_ppm(const char* path) {
+	FILE* out = fopen(path, "wb");
+	if(!out)
+		return EOF;
+	fprintf(out, "P6\n%zu %zu\n255\n", image_width, image_height);
+	for(size_t i = 0; i < image_width * image_height; i++) {
+		u8 rgb[3] = { framebuffer[i] >> 16, framebuffer[i] >> 8, framebuffer[i] };
+		fwrite(rgb, 1, 3, out);
+	}
+	return fclose(out);
+}
+
+static u32 crc_table[256];
+
+static u32 crc32_update(u32 crc, const u8* data, size_t n) {
+	if(!crc_table[1]) {
+		for(u32 i = 0; i < 256; i++) {
+			u32 c = i;
+			for(int k = 0; k < 8; k++)
+				c = c & 1? 0xEDB88320U ^ (c >> 1) : c >> 1;
+			crc_table[i] = c;
+		}
+	}
+	for(size_t i = 0; i < n; i++)
+		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static void put_be32(u8* p, u32 v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void png_chunk(FILE* out, const char* type, const u8* data, size_t n) {
+	u8 head[8];
+	put_be32(head, n);
+	memcpy(head + 4, type, 4);
+	u32 crc = crc32_update(0xFFFFFFFFU, head + 4, 4);
+	crc = crc32_update(crc, data, n) ^ 0xFFFFFFFFU;
+	u8 tail[4];
+	put_be32(tail, crc);
+	fwrite(head, 1, 8, out);
+	fwrite(data, 1, n, out);
+	fwrite(tail, 1, 4, out);
+}
+
+/* framebuffer as PNG with stored (uncompressed) deflate blocks, there's no zlib to lean on */
+int write_png(const char* path) {
+	FILE* out = fopen(path, "wb");
+	if(!out)
+		return EOF;
+
+	size_t row = image_width * 3 + 1, raw_size = row * image_height;
+	size_t n_blocks = (raw_size + 65534) / 65535;
+	size_t size = 2 + raw_size + 5 * (n_blocks? n_blocks : 1) + 4;
+	u8* raw = malloc(raw_size? raw_size : 1);
+	u8* z = malloc(size);
+	for(size_t y = 0; y < image_height; y++) {
+		u8* r = raw + y * row;
+		/* no filter */
+		*r++ = 0;
+		for(size_t x = 0; x < image_width; x++) {
+			u32 c = framebuffer[y*image_width+x];
+			*r++ = c >> 16;
+			*r++ = c >> 8;
+			*r++ = c;
+		}
+	}
+
+	u8* w = z;
+	*w++ = 0x78;
+	*w++ = 0x01;
+	size_t at = 0;
+	do {
+		size_t len = raw_size - at < 65535? raw_size - at : 65535;
+		*w++ = at + len == raw_size;
+		*w++ = len;
+		*w++ = len >> 8;
+		*w++ = ~len;
+		*w++ = ~len >> 8;
+		memcpy(w, raw + at, len);
+		w += len;
+		at += len;
+	} while(at < raw_size);
+	u32 a = 1, b = 0;
+	for(size_t i = 0; i < raw_size; i++) {
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	put_be32(w, b << 16 | a);
+	w += 4;
+
+	u8 ihdr[13];
+	put_be32(ihdr, image_width);
+	put_be32(ihdr + 4, image_height);
+	/* 8 bit RGB, deflate, no filter method, no interlace */
+	memcpy(ihdr + 8, (u8[]) { 8, 2, 0, 0, 0 }, 5);
+	fwrite("\x89PNG\r\n\x1a\n", 1, 8, out);
+	png_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+	png_chunk(out, "IDAT", z, w - z);
+	png_chunk(out, "IEND", NULL, 0);
+
+	free(z);
+	free(raw);
+	return fclose(out);
+}
+
+int write_image(const char* path) {
+	const char* ext = strrchr(path, '.');
+	return ext && !strcasecmp(ext, ".png")? write_png(path) : write_ppm(path);
+}
+
 void deinit_video() {
 	SDL_DestroyTexture(tex);
 	SDL_DestroyWindow(win);
@@ -167,37 +944,320 @@ void deinit_video() {
 	SDL_Quit();
 }
 
+/* a camera path, Catmull-Rom through the keys */
+struct keyframe {
+	float time;
+	vec3 pos;
+	vec3 dir;
+};
+
+struct camera_path {
+	size_t n_keys;
+	struct keyframe* keys;
+};
+
+/* one key per line, "time x y z dx dy dz", times increasing, # starts a comment */
+bool load_path(const char* path, struct camera_path* out) {
+	FILE* in = fopen(path, "r");
+	if(!in)
+		return false;
+	size_t cap = 16;
+	out->n_keys = 0;
+	out->keys = malloc(sizeof(struct keyframe) * cap);
+
+	char line[256];
+	while(fgets(line, sizeof(line), in)) {
+		struct keyframe k;
+		char* comment = strchr(line, '#');
+		if(comment)
+			*comment = '\0';
+		if(sscanf(line, "%f %f %f %f %f %f %f", &k.time, &k.pos.x, &k.pos.y, &k.pos.z, &k.dir.x, &k.dir.y, &k.dir.z) != 7)
+			continue;
+		if(out->n_keys && k.time <= out->keys[out->n_keys - 1].time)
+			continue;
+		if(out->n_keys == cap) {
+			cap *= 2;
+			out->keys = realloc(out->keys, sizeof(struct keyframe) * cap);
+		}
+		out->keys[out->n_keys++] = k;
+	}
+	fclose(in);
+	return out->n_keys > 0;
+}
+
+static vec3 catmull_rom(vec3 p0, vec3 p1, vec3 p2, vec3 p3, float u) {
+	float u2 = u * u, u3 = u2 * u;
+	float w0 = -0.5f * u3 + u2 - 0.5f * u;
+	float w1 = 1.5f * u3 - 2.5f * u2 + 1.0f;
+	float w2 = -1.5f * u3 + 2.0f * u2 + 0.5f * u;
+	float w3 = 0.5f * u3 - 0.5f * u2;
+	return add(add(scalar(p0, w0), scalar(p1, w1)), add(scalar(p2, w2), scalar(p3, w3)));
+}
+
+/* where the camera is at time t, held at the end keys past either end */
+void path_camera(const struct camera_path* path, float t, vec3* pos, vec3* dir) {
+	const struct keyframe* k = path->keys;
+	size_t n = path->n_keys, i = 0;
+	if(n == 1 || t <= k[0].time || t >= k[n - 1].time) {
+		const struct keyframe* end = t <= k[0].time? k : k + n - 1;
+		*pos = end->pos;
+		*dir = normalize(end->dir);
+		return;
+	}
+	while(i + 2 < n && t >= k[i + 1].time)
+		i++;
+
+	/* the ends stand in for their missing neighbours */
+	const struct keyframe* k0 = k + (i? i - 1 : 0), * k1 = k + i, * k2 = k + i + 1, * k3 = k + (i + 2 < n? i + 2 : n - 1);
+	float u = (t - k1->time) / (k2->time - k1->time);
+	*pos = catmull_rom(k0->pos, k1->pos, k2->pos, k3->pos, u);
+	*dir = normalize(catmull_rom(k0->dir, k1->dir, k2->dir, k3->dir, u));
+}
+
+static int compare_double(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y? -1 : x > y;
+}
+
+/* nearest rank of sorted times */
+static double percentile(const double* sorted, size_t n, double p) {
+	size_t rank = (size_t)ceil(p / 100.0 * n);
+	return sorted[rank? rank - 1 : 0];
+}
+
+/* renders the path at fps and writes the timings as JSON, to stdout for "-" */
+void flythrough(const struct camera_path* path, float fps, bool present, const char* map, const char* json) {
+	float duration = path->keys[path->n_keys - 1].time - path->keys[0].time;
+	size_t frames = (size_t)(duration * fps) + 1;
+	double* times = malloc(sizeof(double) * frames);
+	double total = 0.0;
+
+	for(size_t f = 0; f < frames; f++) {
+		path_camera(path, path->keys[0].time + f / fps, &cam_pos, &cam_dir);
+		if(present) {
+			draw();
+			times[f] = last_frame;
+		} else {
+			times[f] = render();
+		}
+		total += times[f];
+	}
+	qsort(times, frames, sizeof(double), compare_double);
+
+	FILE* out = strcmp(json, "-")? fopen(json, "w") : stdout;
+	if(!out) {
+		fprintf(stderr, "Error writing \"%s\"\n", json);
+		free(times);
+		return;
+	}
+	fprintf(out, "{\n");
+	fprintf(out, "\t\"map\": \"");
+	for(const char* c = map; *c; c++)
+		fprintf(out, *c == '"' || *c == '\\'? "\\%c" : "%c", *c);
+	fprintf(out, "\",\n");
+	fprintf(out, "\t\"width\": %zu,\n\t\"height\": %zu,\n", image_width, image_height);
+	fprintf(out, "\t\"threads\": %zu,\n", q3pool_n_threads(pool));
+	fprintf(out, "\t\"sdf\": \"%s\",\n\t\"voxel\": %g,\n", scene? "raster" : bricks? "bricks" : "exact", bricks? bricks->voxel_size : 0.0f);
+	fprintf(out, "\t\"keyframes\": %zu,\n\t\"fps\": %g,\n\t\"frames\": %zu,\n", path->n_keys, fps, frames);
+	fprintf(out, "\t\"total_ms\": %.3f,\n", total * 1e3);
+	fprintf(out, "\t\"avg_ms\": %.3f,\n", total * 1e3 / frames);
+	fprintf(out, "\t\"min_ms\": %.3f,\n", times[0] * 1e3);
+	fprintf(out, "\t\"p50_ms\": %.3f,\n", percentile(times, frames, 50.0) * 1e3);
+	fprintf(out, "\t\"p95_ms\": %.3f,\n", percentile(times, frames, 95.0) * 1e3);
+	fprintf(out, "\t\"p99_ms\": %.3f,\n", percentile(times, frames, 99.0) * 1e3);
+	fprintf(out, "\t\"max_ms\": %.3f,\n", times[frames - 1] * 1e3);
+	/* the rasterizer casts no rays, it fills pixels */
+	fprintf(out, "\t\"%s\": %.0f\n", scene? "pixels_per_sec" : "rays_per_sec",
+		total > 0.0? image_width * image_height * frames / total : 0.0);
+	fprintf(out, "}\n");
+	if(out != stdout)
+		fclose(out);
+	free(times);
+}
+
+void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [options] file.bsp\n", name);
+	fprintf(stderr, "    -headless        render without a window, SDL is never initialised\n");
+	fprintf(stderr, "    -o file          write the last frame, .png or .ppm (headless)\n");
+	fprintf(stderr, "    -frames n        frames to render and time (headless, default 1), or to show before quitting\n");
+	fprintf(stderr, "    -driver name     SDL video driver, dummy runs the window loop without a display\n");
+	fprintf(stderr, "    -size WxH        resolution (default %zux%zu)\n", image_width, image_height);
+	fprintf(stderr, "    -pos x y z       camera position (default the first player spawn)\n");
+	fprintf(stderr, "    -dir x y z       camera direction\n");
+	fprintf(stderr, "    -voxel size      brick spacing, 0 marches the exact brushes (default %g)\n", BRICK_VOXEL);
+	fprintf(stderr, "    -budget ms       refine progressively, presenting about every ms (default off, marching only)\n");
+	fprintf(stderr, "    -raster          rasterize the map's faces with their lightmaps instead of marching\n");
+	fprintf(stderr, "    -nohiz           rasterize without occlusion culling, frustum and PVS only\n");
+	fprintf(stderr, "    -bench           compare the marching paths first\n");
+	fprintf(stderr, "    -path file       fly through keyframes, \"time x y z dx dy dz\" per line, then exit\n");
+	fprintf(stderr, "    -fps n           frames per second of path time (default 30)\n");
+	fprintf(stderr, "    -json file       where the flythrough timings go, - for stdout (default)\n");
+	exit(1);
+}
+
 int main(int argc, char* argv[]) {
-	if(argc < 2 || argc > 2) {
-		fprintf(stderr, "Usage: %s file.bsp\n", argv[0]);
-		exit(1);
+	bool headless = false, bench = false, set_pos = false, set_dir = false, rasterize = false;
+	const char* output = NULL;
+	const char* path = NULL;
+	const char* path_file = NULL;
+	const char* json = "-";
+	const char* driver = NULL;
+	size_t frames = 1;
+	bool set_frames = false;
+	float fps = 30.0f;
+	float voxel = BRICK_VOXEL;
+	vec3 pos = { 0.0f, 0.0f, 0.0f }, dir = { 0.0f, 0.0f, 0.0f };
+
+	for(int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		int left = argc - i - 1;
+		if(!strcmp(arg, "-headless"))
+			headless = true;
+		else if(!strcmp(arg, "-bench"))
+			bench = true;
+		else if(!strcmp(arg, "-raster"))
+			rasterize = true;
+		else if(!strcmp(arg, "-nohiz"))
+			occlusion = false;
+		else if(!strcmp(arg, "-o") && left >= 1)
+			output = argv[++i];
+		else if(!strcmp(arg, "-frames") && left >= 1) {
+			frames = strtoul(argv[++i], NULL, 10);
+			set_frames = true;
+		} else if(!strcmp(arg, "-driver") && left >= 1)
+			driver = argv[++i];
+		else if(!strcmp(arg, "-path") && left >= 1)
+			path_file = argv[++i];
+		else if(!strcmp(arg, "-json") && left >= 1)
+			json = argv[++i];
+		else if(!strcmp(arg, "-fps") && left >= 1)
+			fps = strtof(argv[++i], NULL);
+		else if(!strcmp(arg, "-budget") && left >= 1)
+			budget = strtod(argv[++i], NULL) * 1e-3;
+		else if(!strcmp(arg, "-voxel") && left >= 1)
+			voxel = strtof(argv[++i], NULL);
+		else if(!strcmp(arg, "-size") && left >= 1) {
+			if(sscanf(argv[++i], "%zux%zu", &image_width, &image_height) != 2 || !image_width || !image_height)
+				usage(argv[0]);
+		} else if(!strcmp(arg, "-pos") && left >= 3) {
+			pos = (vec3) { strtof(argv[i + 1], NULL), strtof(argv[i + 2], NULL), strtof(argv[i + 3], NULL) };
+			set_pos = true;
+			i += 3;
+		} else if(!strcmp(arg, "-dir") && left >= 3) {
+			dir = (vec3) { strtof(argv[i + 1], NULL), strtof(argv[i + 2], NULL), strtof(argv[i + 3], NULL) };
+			set_dir = length(dir) > 0.0f;
+			i += 3;
+		} else if(arg[0] != '-' && !path)
+			path = arg;
+		else
+			usage(argv[0]);
+	}
+	if(!path || fps <= 0.0f)
+		usage(argv[0]);
+
+	struct camera_path camera_path = { 0 };
+	if(path_file && !load_path(path_file, &camera_path)) {
+		fprintf(stderr, "No keyframes in \"%s\"\n", path_file);
+		return 1;
 	}
+	/* the JSON is the output then */
+	quiet = path_file && !strcmp(json, "-");
+	info = quiet? stderr : stdout;
 
-	init_video();
+	if(driver)
+		SDL_SetHint(SDL_HINT_VIDEODRIVER, driver);
+	if(!headless)
+		init_video();
 
-	struct q3bsp* bsp = q3bsp_load(argv[1]);
+	struct q3bsp* bsp = q3bsp_load(path);
 	if(!bsp) {
-		fprintf(stderr, "Error loading file: \"%s\": \"%s\"\n", argv[1], q3bsp_error == Q3BSP_NO_MAGIC? "Missing MAGIC" : "Failed to open file");
+		fprintf(stderr, "Error loading file: \"%s\": \"%s\"\n", path, q3bsp_error == Q3BSP_NO_MAGIC? "Missing MAGIC" : "Failed to open file");
 		return 1;
 	}
 
-	for(size_t i = 0; i < bsp->n_planes; i++) {
-		print_plane(bsp, &bsp->planes[i], false);
+	/* print_plane only knows stdout */
+	if(!headless && !quiet) {
+		for(size_t i = 0; i < bsp->n_planes; i++) {
+			print_plane(bsp, &bsp->planes[i], false);
+		}
 	}
 
-	framebuffer = calloc(image_height * image_width, sizeof(u32));
+	double t0 = q3_seconds();
+	if(rasterize) {
+		scene = q3raster_scene_build(bsp, RASTER_PATCH_LEVEL);
+		fprintf(info, "Raster scene: %zu triangles, %zu lightmaps, built in %.3f ms\n",
+			scene->n_indices / 3, scene->n_lightmaps, (q3_seconds() - t0) * 1e3);
+		/* nothing to refine, a frame is cheap enough */
+		budget = 0.0;
+	} else {
+		brushes = q3sdf_build(bsp, Q3HULL_CONTENTS_SOLID);
+		fprintf(info, "Brush SDF: %zu hulls (%zu in brush models), built in %.3f ms\n",
+			brushes->hulls->n_hulls, brushes->n_loose, (q3_seconds() - t0) * 1e3);
+	}
+	spawn_camera(bsp);
+	if(set_pos)
+		cam_pos = pos;
+	if(set_dir)
+		cam_dir = normalize(dir);
 
-	SDL_Event e;
-	while(SDL_WaitEvent(&e)) {
-		if(e.type == SDL_QUIT)
-			break;
-		draw(bsp);
+	if(voxel > 0.0f && !rasterize) {
+		t0 = q3_seconds();
+		bricks = q3brickmap_bake(brushes, voxel);
+		fprintf(info, "Bricks: %u x %u x %u cells, %zu bricks of %d^3, %.2f MiB, baked in %.3f ms\n",
+			bricks->dims[0], bricks->dims[1], bricks->dims[2], bricks->n_bricks, Q3BRICKMAP_SIZE,
+			q3brickmap_bytes(bricks) / (1024.0 * 1024.0), (q3_seconds() - t0) * 1e3);
+		if(bench)
+			bench_bricks();
+	}
+
+	framebuffer = calloc(image_height * image_width, sizeof(u32));
+	if(!pool)
+		pool = q3pool_create(0);
+	if(bench && rasterize)
+		bench_raster();
+	else if(bench)
+		bench_cast();
 
-		//cam_pos.y -= 0.01;
+	if(path_file) {
+		flythrough(&camera_path, fps, !headless, path, json);
+	} else if(headless) {
+		double total = 0.0, fastest = INFINITY, slowest = 0.0;
+		for(size_t f = 0; f < frames; f++) {
+			double t = 0.0;
+			if(budget > 0.0) {
+				/* from scratch each frame, to time the preview and the whole way to converged */
+				progress.valid = false;
+				for(size_t step = 0; !step || progress.stride; step++) {
+					double s = refine(budget);
+					if(!quiet)
+						printf("Refine %zu: %.3f ms%s\n", step, s * 1e3, progress.stride? "" : ", converged");
+					t += s;
+				}
+			} else {
+				t = render();
+			}
+			total += t;
+			fastest = fmin(fastest, t);
+			slowest = fmax(slowest, t);
+		}
+		if(frames)
+			printf("Frames: %zu at %zux%zu, min/avg/max %.3f/%.3f/%.3f ms\n", frames, image_width, image_height,
+				fastest * 1e3, total * 1e3 / frames, slowest * 1e3);
+		if(output && write_image(output))
+			fprintf(stderr, "Error writing \"%s\"\n", output);
+	} else {
+		run_window(set_frames? frames : 0);
 	}
 
+	free(camera_path.keys);
+	q3raster_free(raster);
+	q3raster_scene_free(scene);
+	q3pool_free(pool);
+	q3brickmap_free(bricks);
+	q3sdf_free(brushes);
 	free(framebuffer);
 	q3bsp_free(bsp);
 
-	deinit_video();
-}
\ No newline at end of file
+	if(!headless)
+		deinit_video();
+}
@@ -0,0 +1,361 @@
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX2__) && defined(__F16C__)
+#include <immintrin.h>
+#define LANES 8
+#endif
+
+#include "q3quant.h"
+
+#define PI 3.14159265358979f
+
+/* round to nearest even, with overflow to inf and denormals, the same as vcvtps2ph */
+static u16 float_to_half(float f) {
+	u32 x;
+	memcpy(&x, &f, sizeof(x));
+	u32 sign = (x >> 16) & 0x8000;
+	u32 abs = x & 0x7FFFFFFF;
+
+	if(abs >= 0x7F800000)
+		return sign | 0x7C00 | (abs > 0x7F800000? 0x200 : 0);
+	if(abs >= 0x477FF000)
+		return sign | 0x7C00;
+	if(abs < 0x38800000) {
+		/* denormal half, shift the mantissa (with its implicit one) into place */
+		if(abs < 0x33000000)
+			return sign;
+		u32 e = abs >> 23;
+		u32 m = (abs & 0x7FFFFF) | 0x800000;
+		u32 shift = 126 - e;
+		u32 half = m >> shift;
+		u32 rem = m & ((1U << shift) - 1);
+		u32 mid = 1U << (shift - 1);
+		if(rem > mid || (rem == mid && (half & 1)))
+			half++;
+		return sign | half;
+	}
+
+	u32 half = ((abs - 0x38000000) >> 13);
+	u32 rem = abs & 0x1FFF;
+	if(rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+		half++;
+	return sign | half;
+}
+
+static float half_to_float(u16 h) {
+	u32 sign = (u32)(h & 0x8000) << 16;
+	u32 e = (h >> 10) & 0x1F;
+	u32 m = h & 0x3FF;
+	u32 x;
+	if(e == 0x1F) {
+		x = sign | 0x7F800000 | (m << 13);
+	} else if(e) {
+		x = sign | ((e + 112) << 23) | (m << 13);
+	} else if(m) {
+		/* renormalise */
+		e = 113;
+		while(!(m & 0x400)) {
+			m <<= 1;
+			e--;
+		}
+		x = sign | (e << 23) | ((m & 0x3FF) << 13);
+	} else {
+		x = sign;
+	}
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+static i16 snorm16(float f) {
+	f = fminf(fmaxf(f, -1.0f), 1.0f);
+	return (i16)lrintf(f * 32767.0f);
+}
+
+static u16 unorm16(float f) {
+	f = fminf(fmaxf(f, 0.0f), 65535.0f);
+	return (u16)lrintf(f);
+}
+
+static void oct_encode(vec3 n, i16 out[2]) {
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	l1 = fmaxf(l1, 1e-20f);
+	float x = n.x / l1, y = n.y / l1;
+	if(n.z < 0.0f) {
+		float ox = (1.0f - fabsf(y)) * copysignf(1.0f, x);
+		float oy = (1.0f - fabsf(x)) * copysignf(1.0f, y);
+		x = ox;
+		y = oy;
+	}
+	out[0] = snorm16(x);
+	out[1] = snorm16(y);
+}
+
+static vec3 oct_decode(const i16 in[2]) {
+	float x = fmaxf(in[0] / 32767.0f, -1.0f), y = fmaxf(in[1] / 32767.0f, -1.0f);
+	float z = 1.0f - fabsf(x) - fabsf(y);
+	if(z < 0.0f) {
+		float ox = (1.0f - fabsf(y)) * copysignf(1.0f, x);
+		float oy = (1.0f - fabsf(x)) * copysignf(1.0f, y);
+		x = ox;
+		y = oy;
+	}
+	float len = sqrtf(x * x + y * y + z * z);
+	return (vec3) { x / len, y / len, z / len };
+}
+
+static void encode_one(const struct q3vertex* v, u16 model, const struct q3quant_bounds* b, const vec3* inv, struct q3qvertex* out) {
+	out->pos[0] = unorm16((v->pos.x - b->mins.x) * inv->x);
+	out->pos[1] = unorm16((v->pos.y - b->mins.y) * inv->y);
+	out->pos[2] = unorm16((v->pos.z - b->mins.z) * inv->z);
+	out->model = model;
+	oct_encode(v->norm, out->norm);
+	out->tex_coords[0] = float_to_half(v->tex_coords.s);
+	out->tex_coords[1] = float_to_half(v->tex_coords.t);
+	out->lightmap_coords[0] = float_to_half(v->lightmap_coords.s);
+	out->lightmap_coords[1] = float_to_half(v->lightmap_coords.t);
+	out->color = v->color;
+}
+
+static void decode_one(const struct q3qvertex* q, const struct q3quant_bounds* b, struct q3vertex* out) {
+	out->pos = (vec3) {
+		b->mins.x + q->pos[0] * b->step.x,
+		b->mins.y + q->pos[1] * b->step.y,
+		b->mins.z + q->pos[2] * b->step.z,
+	};
+	out->norm = oct_decode(q->norm);
+	out->tex_coords.s = half_to_float(q->tex_coords[0]);
+	out->tex_coords.t = half_to_float(q->tex_coords[1]);
+	out->lightmap_coords.s = half_to_float(q->lightmap_coords[0]);
+	out->lightmap_coords.t = half_to_float(q->lightmap_coords[1]);
+	out->color = q->color;
+}
+
+#ifdef LANES
+static inline __m256 abs8(__m256 v) {
+	return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v);
+}
+
+/* +-1 with the sign of v, -0 counts as negative like copysignf */
+static inline __m256 sign8(__m256 v) {
+	return _mm256_or_ps(_mm256_set1_ps(1.0f), _mm256_and_ps(_mm256_set1_ps(-0.0f), v));
+}
+
+static void encode8(const struct q3vertex* v, const u16* model, const float* bounds, const float* inv, struct q3qvertex* out) {
+	/* q3vertex is 11 floats, so lane i starts 11*i floats in */
+	const __m256i stride = _mm256_setr_epi32(0, 11, 22, 33, 44, 55, 66, 77);
+	const float* f = (const float*)v;
+	__m256i m = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)model));
+	/* bounds and inverse steps are 6 and 3 floats per model */
+	__m256i m6 = _mm256_mullo_epi32(m, _mm256_set1_epi32(6));
+	__m256i m3 = _mm256_mullo_epi32(m, _mm256_set1_epi32(3));
+
+	i32 pos[3][LANES];
+	for(int k = 0; k < 3; k++) {
+		__m256 p = _mm256_i32gather_ps(f + k, stride, 4);
+		__m256 q = _mm256_mul_ps(_mm256_sub_ps(p, _mm256_i32gather_ps(bounds + k, m6, 4)), _mm256_i32gather_ps(inv + k, m3, 4));
+		q = _mm256_min_ps(_mm256_max_ps(q, _mm256_setzero_ps()), _mm256_set1_ps(65535.0f));
+		_mm256_storeu_si256((__m256i*)pos[k], _mm256_cvtps_epi32(q));
+	}
+
+	__m256 nx = _mm256_i32gather_ps(f + 7, stride, 4);
+	__m256 ny = _mm256_i32gather_ps(f + 8, stride, 4);
+	__m256 nz = _mm256_i32gather_ps(f + 9, stride, 4);
+	__m256 l1 = _mm256_max_ps(_mm256_add_ps(_mm256_add_ps(abs8(nx), abs8(ny)), abs8(nz)), _mm256_set1_ps(1e-20f));
+	__m256 x = _mm256_div_ps(nx, l1), y = _mm256_div_ps(ny, l1);
+	__m256 lower = _mm256_cmp_ps(nz, _mm256_setzero_ps(), _CMP_LT_OQ);
+	__m256 fx = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), abs8(y)), sign8(x));
+	__m256 fy = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), abs8(x)), sign8(y));
+	x = _mm256_blendv_ps(x, fx, lower);
+	y = _mm256_blendv_ps(y, fy, lower);
+	const __m256 one = _mm256_set1_ps(1.0f), minus = _mm256_set1_ps(-1.0f), k = _mm256_set1_ps(32767.0f);
+	i32 oct[2][LANES];
+	_mm256_storeu_si256((__m256i*)oct[0], _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(x, minus), one), k)));
+	_mm256_storeu_si256((__m256i*)oct[1], _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(y, minus), one), k)));
+
+	u16 half[4][LANES];
+	for(int c = 0; c < 4; c++)
+		_mm_storeu_si128((__m128i*)half[c], _mm256_cvtps_ph(_mm256_i32gather_ps(f + 3 + c, stride, 4), _MM_FROUND_TO_NEAREST_INT));
+
+	for(int l = 0; l < LANES; l++) {
+		struct q3qvertex* o = out + l;
+		o->pos[0] = pos[0][l];
+		o->pos[1] = pos[1][l];
+		o->pos[2] = pos[2][l];
+		o->model = model[l];
+		o->norm[0] = oct[0][l];
+		o->norm[1] = oct[1][l];
+		o->tex_coords[0] = half[0][l];
+		o->tex_coords[1] = half[1][l];
+		o->lightmap_coords[0] = half[2][l];
+		o->lightmap_coords[1] = half[3][l];
+		o->color = v[l].color;
+	}
+}
+
+static void decode8(const struct q3qvertex* q, const float* bounds, struct q3vertex* out) {
+	/* q3qvertex is 6 u32s, pull each 16 bit field out of the right word */
+	const __m256i stride = _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42);
+	const int* w = (const int*)q;
+	const __m256i lo = _mm256_set1_epi32(0xFFFF);
+	__m256i w0 = _mm256_i32gather_epi32(w + 0, stride, 4);
+	__m256i w1 = _mm256_i32gather_epi32(w + 1, stride, 4);
+	__m256i w2 = _mm256_i32gather_epi32(w + 2, stride, 4);
+	__m256i w3 = _mm256_i32gather_epi32(w + 3, stride, 4);
+	__m256i w4 = _mm256_i32gather_epi32(w + 4, stride, 4);
+
+	__m256i m6 = _mm256_mullo_epi32(_mm256_srli_epi32(w1, 16), _mm256_set1_epi32(6));
+	__m256i qp[3] = { _mm256_and_si256(w0, lo), _mm256_srli_epi32(w0, 16), _mm256_and_si256(w1, lo) };
+	float pos[3][LANES];
+	for(int k = 0; k < 3; k++)
+		_mm256_storeu_ps(pos[k], _mm256_add_ps(_mm256_i32gather_ps(bounds + k, m6, 4),
+			_mm256_mul_ps(_mm256_cvtepi32_ps(qp[k]), _mm256_i32gather_ps(bounds + 3 + k, m6, 4))));
+
+	/* sign extend the two snorm halves */
+	const __m256 scale = _mm256_set1_ps(1.0f / 32767.0f), minus = _mm256_set1_ps(-1.0f);
+	__m256 x = _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(w2, 16), 16)), scale), minus);
+	__m256 y = _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(w2, 16)), scale), minus);
+	__m256 z = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), abs8(x)), abs8(y));
+	__m256 lower = _mm256_cmp_ps(z, _mm256_setzero_ps(), _CMP_LT_OQ);
+	__m256 fx = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), abs8(y)), sign8(x));
+	__m256 fy = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), abs8(x)), sign8(y));
+	x = _mm256_blendv_ps(x, fx, lower);
+	y = _mm256_blendv_ps(y, fy, lower);
+	__m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(
+		_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z))));
+	float norm[3][LANES];
+	_mm256_storeu_ps(norm[0], _mm256_mul_ps(x, inv));
+	_mm256_storeu_ps(norm[1], _mm256_mul_ps(y, inv));
+	_mm256_storeu_ps(norm[2], _mm256_mul_ps(z, inv));
+
+	/* halves: tex s,t in w3 and lightmap s,t in w4, interleaved lo/hi */
+	__m256i hs[4] = { _mm256_and_si256(w3, lo), _mm256_srli_epi32(w3, 16), _mm256_and_si256(w4, lo), _mm256_srli_epi32(w4, 16) };
+	float uv[4][LANES];
+	for(int c = 0; c < 4; c++) {
+		__m256i packed = _mm256_packus_epi32(hs[c], hs[c]);
+		packed = _mm256_permute4x64_epi64(packed, 0x08);
+		_mm256_storeu_ps(uv[c], _mm256_cvtph_ps(_mm256_castsi256_si128(packed)));
+	}
+
+	for(int l = 0; l < LANES; l++) {
+		struct q3vertex* o = out + l;
+		o->pos = (vec3) { pos[0][l], pos[1][l], pos[2][l] };
+		o->norm = (vec3) { norm[0][l], norm[1][l], norm[2][l] };
+		o->tex_coords.s = uv[0][l];
+		o->tex_coords.t = uv[1][l];
+		o->lightmap_coords.s = uv[2][l];
+		o->lightmap_coords.t = uv[3][l];
+		o->color = q[l].color;
+	}
+}
+#endif
+
+struct q3quant_stream* q3quant_encode(const struct q3bsp* bsp) {
+	struct q3quant_stream* stream = calloc(1, sizeof(struct q3quant_stream));
+	size_t n_models = bsp->n_models? bsp->n_models : 1;
+	stream->n_models = n_models;
+	stream->bounds = malloc(sizeof(struct q3quant_bounds) * n_models);
+	vec3* inv = malloc(sizeof(vec3) * n_models);
+	for(size_t i = 0; i < n_models; i++) {
+		vec3 mins = bsp->n_models? bsp->models[i].mins : (vec3) { 0, 0, 0 };
+		vec3 maxs = bsp->n_models? bsp->models[i].maxs : (vec3) { 1, 1, 1 };
+		/* flat models would divide by zero */
+		vec3 size = { fmaxf(maxs.x - mins.x, 1e-3f), fmaxf(maxs.y - mins.y, 1e-3f), fmaxf(maxs.z - mins.z, 1e-3f) };
+		stream->bounds[i].mins = mins;
+		stream->bounds[i].step = (vec3) { size.x / 65535.0f, size.y / 65535.0f, size.z / 65535.0f };
+		inv[i] = (vec3) { 65535.0f / size.x, 65535.0f / size.y, 65535.0f / size.z };
+	}
+
+	/* vertices take the model of the faces that use them, anything unreferenced goes to the world */
+	u16* model = calloc(bsp->n_vertices + 8, sizeof(u16));
+	for(size_t m = 1; m < bsp->n_models; m++) {
+		const struct q3model* mod = bsp->models + m;
+		for(u32 f = 0; f < mod->n_faces; f++) {
+			const struct q3face* face = bsp->faces + mod->face_start_idx + f;
+			for(u32 v = 0; v < face->n_vertices; v++)
+				model[face->first_vertex_idx + v] = m;
+		}
+	}
+
+	stream->n_vertices = bsp->n_vertices;
+	stream->vertices = malloc(sizeof(struct q3qvertex) * (bsp->n_vertices? bsp->n_vertices : 1));
+	size_t i = 0;
+#ifdef LANES
+	for(; i + LANES <= bsp->n_vertices; i += LANES)
+		encode8(bsp->vertices + i, model + i, (const float*)stream->bounds, (const float*)inv, stream->vertices + i);
+#endif
+	for(; i < bsp->n_vertices; i++)
+		encode_one(bsp->vertices + i, model[i], stream->bounds + model[i], inv + model[i], stream->vertices + i);
+
+	free(model);
+	free(inv);
+	return stream;
+}
+
+void q3quant_free(struct q3quant_stream* stream) {
+	if(!stream)
+		return;
+	free(stream->bounds);
+	free(stream->vertices);
+	free(stream);
+}
+
+void q3quant_decode(const struct q3quant_stream* stream, struct q3vertex* out) {
+	size_t i = 0;
+#ifdef LANES
+	for(; i + LANES <= stream->n_vertices; i += LANES)
+		decode8(stream->vertices + i, (const float*)stream->bounds, out + i);
+#endif
+	for(; i < stream->n_vertices; i++)
+		decode_one(stream->vertices + i, stream->bounds + stream->vertices[i].model, out + i);
+}
+
+void q3quant_measure(const struct q3quant_stream* stream, const struct q3vertex* original, struct q3quant_error* err) {
+	memset(err, 0, sizeof(*err));
+	struct q3vertex* decoded = malloc(sizeof(struct q3vertex) * (stream->n_vertices? stream->n_vertices : 1));
+	q3quant_decode(stream, decoded);
+
+	double sum_pos = 0.0, sum_norm = 0.0;
+	size_t n_norm = 0;
+	for(size_t i = 0; i < stream->n_vertices; i++) {
+		const struct q3vertex* a = original + i;
+		const struct q3vertex* b = decoded + i;
+		vec3 d = { a->pos.x - b->pos.x, a->pos.y - b->pos.y, a->pos.z - b->pos.z };
+		float e = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+		err->max_pos = fmaxf(err->max_pos, e);
+		sum_pos += e;
+
+		/* some tools write zero normals, those have no angle to lose */
+		float len = sqrtf(a->norm.x * a->norm.x + a->norm.y * a->norm.y + a->norm.z * a->norm.z);
+		if(len > 0.5f) {
+			float c = (a->norm.x * b->norm.x + a->norm.y * b->norm.y + a->norm.z * b->norm.z) / len;
+			float angle = acosf(fminf(fmaxf(c, -1.0f), 1.0f)) * 180.0f / PI;
+			err->max_norm = fmaxf(err->max_norm, angle);
+			sum_norm += angle;
+			n_norm++;
+		}
+
+		err->max_tex = fmaxf(err->max_tex, fmaxf(fabsf(a->tex_coords.s - b->tex_coords.s), fabsf(a->tex_coords.t - b->tex_coords.t)));
+		err->max_lightmap = fmaxf(err->max_lightmap, fmaxf(fabsf(a->lightmap_coords.s - b->lightmap_coords.s), fabsf(a->lightmap_coords.t - b->lightmap_coords.t)));
+	}
+	err->mean_pos = stream->n_vertices? sum_pos / stream->n_vertices : 0.0;
+	err->mean_norm = n_norm? sum_norm / n_norm : 0.0;
+	free(decoded);
+}
+
+int q3quant_write(const struct q3quant_stream* stream, FILE* out) {
+	struct q3quant_file_header header = {
+		.magic = Q3QUANT_MAGIC,
+		.version = Q3QUANT_VERSION,
+		.n_models = stream->n_models,
+		.n_vertices = stream->n_vertices,
+	};
+	if(fwrite(&header, sizeof(header), 1, out) != 1)
+		return EOF;
+	if(fwrite(stream->bounds, sizeof(struct q3quant_bounds), stream->n_models, out) != stream->n_models)
+		return EOF;
+	if(stream->n_vertices && fwrite(stream->vertices, sizeof(struct q3qvertex), stream->n_vertices, out) != stream->n_vertices)
+		return EOF;
+	return 0;
+}
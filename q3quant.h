@@ -0,0 +1,72 @@
+#ifndef Q3_QUANT_H_
+#define Q3_QUANT_H_
+
+#include <stdio.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* "Q3QV" */
+#define Q3QUANT_MAGIC 0x56513351U
+#define Q3QUANT_VERSION 1
+
+/* 24 bytes against struct q3vertex's 44 */
+struct q3qvertex {
+	/* 0-65535 across the owning model's bounds */
+	u16 pos[3];
+	u16 model;
+	/* octahedral unit vector, snorm16 */
+	i16 norm[2];
+	/* IEEE half floats */
+	u16 tex_coords[2];
+	u16 lightmap_coords[2];
+	rgba color;
+};
+
+struct q3quant_bounds {
+	vec3 mins;
+	/* (maxs - mins) / 65535, what a step of one is worth */
+	vec3 step;
+};
+
+struct q3quant_stream {
+	size_t n_models;
+	struct q3quant_bounds* bounds;
+	size_t n_vertices;
+	struct q3qvertex* vertices;
+};
+
+struct q3quant_error {
+	/* world units */
+	float max_pos, mean_pos;
+	/* degrees */
+	float max_norm, mean_norm;
+	float max_tex, max_lightmap;
+};
+
+/* on disk: the header, n_models q3quant_bounds, then the vertices */
+struct q3quant_file_header {
+	u32 magic;
+	u32 version;
+	u32 n_models;
+	u32 n_vertices;
+};
+
+struct q3quant_stream* q3quant_encode(const struct q3bsp* bsp);
+void q3quant_free(struct q3quant_stream* stream);
+
+/* expands the whole stream back to full floats, out holds n_vertices */
+void q3quant_decode(const struct q3quant_stream* stream, struct q3vertex* out);
+
+/* compares a decoded copy against the original vertices */
+void q3quant_measure(const struct q3quant_stream* stream, const struct q3vertex* original, struct q3quant_error* err);
+
+int q3quant_write(const struct q3quant_stream* stream, FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,958 @@
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "q3color.h"
+#include "q3patch.h"
+#include "q3raster.h"
+#include "q3time.h"
+#include "q3vis.h"
+
+#define LIGHTMAP_SIZE 128
+#define LIGHTMAP_TEXELS (LIGHTMAP_SIZE * LIGHTMAP_SIZE)
+/* surface flags in the texture lump */
+#define SURF_SKY 0x4
+#define SURF_NODRAW 0x80
+
+/* triangles per setup task */
+#define CHUNK_TRIS 512
+/* 4 bits of subpixel precision */
+#define SUBPIXEL 16
+/* triangles are only cut this far off screen, closer in the fixed point can't overflow */
+#define GUARD_BAND 64.0f
+/* the near plane and four guard band sides each add at most one corner */
+#define MAX_CORNERS 8
+/* pyramid levels that fit inside a tile, log2 of Q3RASTER_TILE */
+#define TILE_LEVELS 6
+#define MAX_LEVELS 32
+
+static bool face_drawn(const struct q3bsp* bsp, const struct q3face* face) {
+	if(face->texture_idx >= 0 && (size_t)face->texture_idx < bsp->n_textures
+		&& (bsp->textures[face->texture_idx].flags & (SURF_SKY | SURF_NODRAW)))
+		return false;
+	return face->type == POLYGON || face->type == MESH || face->type == PATCH;
+}
+
+/* 0x00RRGGBB from the converted bytes, in place */
+static void swizzle(u32* texels, size_t n) {
+	for(size_t i = 0; i < n; i++) {
+		rgba c = { .color = texels[i] };
+		texels[i] = (u32)c.r << 16 | (u32)c.g << 8 | c.b;
+	}
+}
+
+struct q3raster_scene* q3raster_scene_build(const struct q3bsp* bsp, u32 patch_level) {
+	struct q3raster_scene* scene = calloc(1, sizeof(struct q3raster_scene));
+	scene->bsp = bsp;
+
+	/* patches flattened once, like q3batch does, their indices shifted past the map's vertices */
+	struct q3patch_set* patches = NULL;
+	struct q3vertex* patch_vertices = NULL;
+	u32* patch_indices = NULL;
+	size_t n_patch_vertices = 0, n_patch_indices = 0;
+	i32* face_patch = malloc(sizeof(i32) * (bsp->n_faces? bsp->n_faces : 1));
+	u32* patch_first_index = NULL;
+	for(size_t i = 0; i < bsp->n_faces; i++)
+		face_patch[i] = -1;
+
+	if(patch_level) {
+		if(patch_level > Q3PATCH_MAX_LEVEL)
+			patch_level = Q3PATCH_MAX_LEVEL;
+		patches = q3patch_init(bsp);
+		u32* levels = malloc(sizeof(u32) * (patches->n_patches? patches->n_patches : 1));
+		for(size_t i = 0; i < patches->n_patches; i++)
+			levels[i] = patch_level;
+		q3patch_assemble(patches, levels, &patch_vertices, &n_patch_vertices, &patch_indices, &n_patch_indices);
+		free(levels);
+
+		patch_first_index = malloc(sizeof(u32) * (patches->n_patches? patches->n_patches : 1));
+		size_t at = 0;
+		for(size_t i = 0; i < patches->n_patches; i++) {
+			const struct q3patch* p = patches->patches + i;
+			if(!p->pieces_x)
+				continue;
+			face_patch[p->face] = i;
+			patch_first_index[i] = at;
+			at += p->lods[patch_level].n_indices;
+		}
+	}
+
+	scene->face_first = calloc(bsp->n_faces? bsp->n_faces : 1, sizeof(u32));
+	scene->face_count = calloc(bsp->n_faces? bsp->n_faces : 1, sizeof(u32));
+	for(size_t i = 0; i < bsp->n_faces; i++) {
+		const struct q3face* face = bsp->faces + i;
+		bool drawn = face_drawn(bsp, face);
+		u32 count = 0;
+		if(drawn && face->type == PATCH)
+			count = face_patch[i] >= 0? patches->patches[face_patch[i]].lods[patch_level].n_indices : 0;
+		else if(drawn && face->first_vertex_idx >= 0 && (size_t)face->first_vertex_idx + face->n_vertices <= bsp->n_vertices
+			&& face->first_mesh_vertex_idx >= 0 && (size_t)face->first_mesh_vertex_idx + face->n_mesh_vertices <= bsp->n_mesh_verts)
+			count = face->n_mesh_vertices / 3 * 3;
+		scene->face_first[i] = scene->n_indices;
+		scene->face_count[i] = count;
+		scene->n_indices += count;
+	}
+
+	scene->n_vertices = bsp->n_vertices + n_patch_vertices;
+	scene->vertices = malloc(sizeof(struct q3vertex) * (scene->n_vertices? scene->n_vertices : 1));
+	memcpy(scene->vertices, bsp->vertices, sizeof(struct q3vertex) * bsp->n_vertices);
+	if(n_patch_vertices)
+		memcpy(scene->vertices + bsp->n_vertices, patch_vertices, sizeof(struct q3vertex) * n_patch_vertices);
+
+	scene->indices = malloc(sizeof(u32) * (scene->n_indices? scene->n_indices : 1));
+	for(size_t i = 0; i < bsp->n_faces; i++) {
+		const struct q3face* face = bsp->faces + i;
+		u32* out = scene->indices + scene->face_first[i];
+		u32 count = scene->face_count[i];
+		if(face->type == PATCH) {
+			for(u32 k = 0; k < count; k++)
+				out[k] = patch_indices[patch_first_index[face_patch[i]] + k] + bsp->n_vertices;
+		} else {
+			const struct q3mesh_vert* mv = bsp->mesh_verts + face->first_mesh_vertex_idx;
+			for(u32 k = 0; k < count; k++) {
+				/* a bad offset falls back onto the face's first vertex rather than off the array */
+				i64 v = (i64)face->first_vertex_idx + mv[k].idx;
+				out[k] = v >= 0 && (size_t)v < bsp->n_vertices? (u32)v : (u32)face->first_vertex_idx;
+			}
+		}
+	}
+
+	/* overbright shifted like the game without hardware gamma, and no gamma ramp */
+	struct q3color_params params;
+	q3color_params_init(&params, 2, 1.0f);
+	scene->n_lightmaps = bsp->n_lightmaps;
+	scene->lightmaps = malloc(sizeof(u32) * LIGHTMAP_TEXELS * (bsp->n_lightmaps? bsp->n_lightmaps : 1));
+	q3color_convert_lightmaps(&params, bsp->lightmaps, bsp->n_lightmaps, scene->lightmaps, Q3COLOR_RGBA8);
+	swizzle(scene->lightmaps, LIGHTMAP_TEXELS * bsp->n_lightmaps);
+	scene->colors = malloc(sizeof(u32) * (scene->n_vertices? scene->n_vertices : 1));
+	q3color_convert_vertices(&params, scene->vertices, scene->n_vertices, (rgba*)scene->colors);
+	swizzle(scene->colors, scene->n_vertices);
+
+	free(face_patch);
+	free(patch_first_index);
+	free(patch_vertices);
+	free(patch_indices);
+	q3patch_free(patches);
+	return scene;
+}
+
+void q3raster_scene_free(struct q3raster_scene* scene) {
+	if(!scene)
+		return;
+	free(scene->vertices);
+	free(scene->indices);
+	free(scene->face_first);
+	free(scene->face_count);
+	free(scene->lightmaps);
+	free(scene->colors);
+	free(scene);
+}
+
+/* a set up triangle, everything as functions of the pixel, f = a * x + b * y + c */
+struct tri {
+	/* >= 0 inside, the fill rule is folded into c */
+	i64 edges[3][3];
+	/* 1/z and the lightmap coordinates over z, which are linear on screen */
+	float iz[3], s[3], t[3];
+	/* pixels it can touch, inclusive */
+	i32 min_x, min_y, max_x, max_y;
+	/* NULL for flat colour */
+	const u32* lightmap;
+	u32 color;
+};
+
+struct bin {
+	u32 n, cap;
+	u32* tris;
+};
+
+struct chunk {
+	size_t n_tris, cap_tris;
+	struct tri* tris;
+	size_t triangles, culled, clipped, binned;
+};
+
+struct q3raster {
+	struct q3pool* pool;
+	size_t width, height;
+	size_t tiles_x, tiles_y, n_tiles;
+	/* 1/z, so 0 is infinitely far and bigger is closer */
+	float* depth;
+	size_t* tile_pixels;
+
+	/* kept between draws so the arrays only ever grow */
+	size_t n_chunks, cap_chunks;
+	struct chunk* chunks;
+	/* n_tiles per chunk, chunk after chunk */
+	struct bin* bins;
+	/* where each listed face's triangles start, one past the end too */
+	size_t cap_faces;
+	size_t* face_start;
+
+	/* level 0 is depth, each one up keeps the furthest of the 2x2 under it */
+	size_t n_levels;
+	float* levels[MAX_LEVELS];
+	size_t level_width[MAX_LEVELS], level_height[MAX_LEVELS];
+
+	/* for draw_bsp: leaves front to back, the faces to draw, and what's been taken this frame */
+	size_t n_leaves;
+	u32* leaves;
+	size_t n_list;
+	u32* list;
+	u32 stamp;
+	u32* face_stamp;
+	u32* leaf_stamp;
+};
+
+struct q3raster* q3raster_create(struct q3pool* pool, size_t width, size_t height) {
+	struct q3raster* r = calloc(1, sizeof(struct q3raster));
+	r->pool = pool;
+	r->width = width;
+	r->height = height;
+	r->tiles_x = (width + Q3RASTER_TILE - 1) / Q3RASTER_TILE;
+	r->tiles_y = (height + Q3RASTER_TILE - 1) / Q3RASTER_TILE;
+	r->n_tiles = r->tiles_x * r->tiles_y;
+	size_t n_pixels = width * height;
+	r->depth = calloc(n_pixels? n_pixels : 1, sizeof(float));
+	r->tile_pixels = calloc(r->n_tiles? r->n_tiles : 1, sizeof(size_t));
+
+	r->levels[0] = r->depth;
+	r->level_width[0] = width;
+	r->level_height[0] = height;
+	for(r->n_levels = 1; r->n_levels < MAX_LEVELS; r->n_levels++) {
+		size_t l = r->n_levels, w = r->level_width[l - 1], h = r->level_height[l - 1];
+		if(w <= 1 && h <= 1)
+			break;
+		r->level_width[l] = (w + 1) / 2;
+		r->level_height[l] = (h + 1) / 2;
+		r->levels[l] = malloc(sizeof(float) * r->level_width[l] * r->level_height[l]);
+	}
+	return r;
+}
+
+void q3raster_free(struct q3raster* r) {
+	if(!r)
+		return;
+	for(size_t c = 0; c < r->cap_chunks; c++) {
+		free(r->chunks[c].tris);
+		for(size_t t = 0; t < r->n_tiles; t++)
+			free(r->bins[c * r->n_tiles + t].tris);
+	}
+	free(r->chunks);
+	free(r->bins);
+	free(r->face_start);
+	for(size_t l = 1; l < r->n_levels; l++)
+		free(r->levels[l]);
+	free(r->depth);
+	free(r->tile_pixels);
+	free(r->leaves);
+	free(r->list);
+	free(r->face_stamp);
+	free(r->leaf_stamp);
+	free(r);
+}
+
+struct tile_rect {
+	i32 x0, y0, x1, y1;
+};
+
+static struct tile_rect tile_rect(const struct q3raster* r, size_t tile) {
+	struct tile_rect rect = {
+		.x0 = tile % r->tiles_x * Q3RASTER_TILE,
+		.y0 = tile / r->tiles_x * Q3RASTER_TILE,
+	};
+	rect.x1 = rect.x0 + Q3RASTER_TILE < (i32)r->width? rect.x0 + Q3RASTER_TILE : (i32)r->width;
+	rect.y1 = rect.y0 + Q3RASTER_TILE < (i32)r->height? rect.y0 + Q3RASTER_TILE : (i32)r->height;
+	return rect;
+}
+
+struct clear_job {
+	struct q3raster* r;
+	u32* color;
+	u32 background;
+};
+
+static void clear_tile(void* user, size_t tile, size_t worker) {
+	(void)worker;
+	const struct clear_job* job = user;
+	struct q3raster* r = job->r;
+	struct tile_rect rect = tile_rect(r, tile);
+	for(i32 y = rect.y0; y < rect.y1; y++) {
+		for(i32 x = rect.x0; x < rect.x1; x++) {
+			job->color[y * r->width + x] = job->background;
+			r->depth[y * r->width + x] = 0.0f;
+		}
+	}
+}
+
+void q3raster_clear(struct q3raster* r, u32* color, u32 background) {
+	struct clear_job job = { r, color, background };
+	q3pool_for(r->pool, r->n_tiles, clear_tile, &job);
+}
+
+struct draw_job {
+	struct q3raster* r;
+	const struct q3raster_scene* scene;
+	const struct q3raster_view* view;
+	const u32* faces;
+	size_t n_faces;
+	size_t n_tris;
+	u32* color;
+};
+
+/* view space position and lightmap coordinates */
+struct corner {
+	float x, y, z;
+	float s, t;
+};
+
+/* near plane, then the guard band's left, right, bottom and top */
+static float clip_distance(const struct q3raster* r, const struct q3raster_view* view, const struct corner* c, int plane) {
+	float hw = r->width * 0.5f + GUARD_BAND, hh = r->height * 0.5f + GUARD_BAND;
+	switch(plane) {
+	case 0: return c->z - view->near;
+	case 1: return hw * c->z + view->focal * c->x;
+	case 2: return hw * c->z - view->focal * c->x;
+	case 3: return hh * c->z + view->focal * c->y;
+	default: return hh * c->z - view->focal * c->y;
+	}
+}
+
+/* Sutherland-Hodgman against the planes in mask, returns the corners left */
+static size_t clip(const struct q3raster* r, const struct q3raster_view* view, struct corner* poly, size_t n, u32 mask) {
+	struct corner out[MAX_CORNERS];
+	for(int plane = 0; plane < 5; plane++) {
+		if(!(mask & 1U << plane))
+			continue;
+		size_t n_out = 0;
+		for(size_t i = 0; i < n; i++) {
+			const struct corner* a = poly + i, * b = poly + (i + 1) % n;
+			float da = clip_distance(r, view, a, plane), db = clip_distance(r, view, b, plane);
+			if(da >= 0.0f)
+				out[n_out++] = *a;
+			if((da >= 0.0f) != (db >= 0.0f)) {
+				float t = da / (da - db);
+				out[n_out++] = (struct corner) {
+					a->x + (b->x - a->x) * t, a->y + (b->y - a->y) * t, a->z + (b->z - a->z) * t,
+					a->s + (b->s - a->s) * t, a->t + (b->t - a->t) * t,
+				};
+			}
+		}
+		memcpy(poly, out, sizeof(struct corner) * n_out);
+		n = n_out;
+		if(n < 3)
+			return 0;
+	}
+	return n;
+}
+
+/* coefficients of the screen plane through three values */
+static void attribute_plane(float out[3], const float x[3], const float y[3], float inv_area, float f0, float f1, float f2) {
+	float dx = ((f1 - f0) * (y[2] - y[0]) - (f2 - f0) * (y[1] - y[0])) * inv_area;
+	float dy = ((f2 - f0) * (x[1] - x[0]) - (f1 - f0) * (x[2] - x[0])) * inv_area;
+	out[0] = dx;
+	out[1] = dy;
+	out[2] = f0 - dx * x[0] - dy * y[0];
+}
+
+/* whether any pixel of the rect can be inside every edge, checking each edge's best corner */
+static bool tri_reaches(const struct tri* tri, struct tile_rect rect) {
+	for(int k = 0; k < 3; k++) {
+		const i64* e = tri->edges[k];
+		i64 x = e[0] > 0? rect.x1 - 1 : rect.x0, y = e[1] > 0? rect.y1 - 1 : rect.y0;
+		if(e[0] * x + e[1] * y + e[2] < 0)
+			return false;
+	}
+	return true;
+}
+
+static void push_bin(struct bin* bin, u32 tri) {
+	if(bin->n == bin->cap) {
+		bin->cap = bin->cap? bin->cap * 2 : 64;
+		bin->tris = realloc(bin->tris, sizeof(u32) * bin->cap);
+	}
+	bin->tris[bin->n++] = tri;
+}
+
+/* projects, snaps and bins one screen triangle */
+static void emit(const struct draw_job* job, struct chunk* ch, struct bin* bins, const struct corner* c[3], const u32* lightmap, u32 color) {
+	const struct q3raster* r = job->r;
+	const struct q3raster_view* view = job->view;
+	i64 X[3], Y[3];
+	float x[3], y[3], iz[3];
+	for(int k = 0; k < 3; k++) {
+		iz[k] = 1.0f / c[k]->z;
+		X[k] = llrintf((r->width * 0.5f + view->focal * c[k]->x * iz[k]) * SUBPIXEL);
+		Y[k] = llrintf((r->height * 0.5f - view->focal * c[k]->y * iz[k]) * SUBPIXEL);
+		x[k] = (float)X[k] / SUBPIXEL;
+		y[k] = (float)Y[k] / SUBPIXEL;
+	}
+
+	/* quake winds front faces clockwise, which with y going down is a positive area */
+	i64 area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+	if(area <= 0) {
+		ch->culled++;
+		return;
+	}
+
+	/* samples sit on whole pixels */
+	i64 min_x = X[0], max_x = X[0], min_y = Y[0], max_y = Y[0];
+	for(int k = 1; k < 3; k++) {
+		min_x = X[k] < min_x? X[k] : min_x;
+		max_x = X[k] > max_x? X[k] : max_x;
+		min_y = Y[k] < min_y? Y[k] : min_y;
+		max_y = Y[k] > max_y? Y[k] : max_y;
+	}
+	struct tri tri = {
+		.min_x = (i32)fmax(ceil((double)min_x / SUBPIXEL), 0.0),
+		.min_y = (i32)fmax(ceil((double)min_y / SUBPIXEL), 0.0),
+		.max_x = (i32)fmin(floor((double)max_x / SUBPIXEL), r->width - 1.0),
+		.max_y = (i32)fmin(floor((double)max_y / SUBPIXEL), r->height - 1.0),
+		.lightmap = lightmap,
+		.color = color,
+	};
+	if(tri.min_x > tri.max_x || tri.min_y > tri.max_y) {
+		ch->culled++;
+		return;
+	}
+
+	for(int k = 0; k < 3; k++) {
+		int a = k, b = (k + 1) % 3;
+		i64 dx = X[b] - X[a], dy = Y[b] - Y[a];
+		/* top and left edges own the samples right on them */
+		bool top_left = dy < 0 || (dy == 0 && dx > 0);
+		tri.edges[k][0] = -dy * SUBPIXEL;
+		tri.edges[k][1] = dx * SUBPIXEL;
+		tri.edges[k][2] = dy * X[a] - dx * Y[a] - (top_left? 0 : 1);
+	}
+	float inv_area = (float)(SUBPIXEL * SUBPIXEL) / (float)area;
+	attribute_plane(tri.iz, x, y, inv_area, iz[0], iz[1], iz[2]);
+	attribute_plane(tri.s, x, y, inv_area, c[0]->s * iz[0], c[1]->s * iz[1], c[2]->s * iz[2]);
+	attribute_plane(tri.t, x, y, inv_area, c[0]->t * iz[0], c[1]->t * iz[1], c[2]->t * iz[2]);
+
+	if(ch->n_tris == ch->cap_tris) {
+		ch->cap_tris = ch->cap_tris? ch->cap_tris * 2 : CHUNK_TRIS;
+		ch->tris = realloc(ch->tris, sizeof(struct tri) * ch->cap_tris);
+	}
+	u32 id = ch->n_tris++;
+	ch->tris[id] = tri;
+
+	i32 tx0 = tri.min_x / Q3RASTER_TILE, tx1 = tri.max_x / Q3RASTER_TILE;
+	i32 ty0 = tri.min_y / Q3RASTER_TILE, ty1 = tri.max_y / Q3RASTER_TILE;
+	bool single = tx0 == tx1 && ty0 == ty1;
+	for(i32 ty = ty0; ty <= ty1; ty++) {
+		for(i32 tx = tx0; tx <= tx1; tx++) {
+			size_t tile = (size_t)ty * r->tiles_x + tx;
+			if(!single && !tri_reaches(&tri, tile_rect(r, tile)))
+				continue;
+			push_bin(bins + tile, id);
+			ch->binned++;
+		}
+	}
+}
+
+static void setup_triangle(const struct draw_job* job, struct chunk* ch, struct bin* bins, u32 face, const u32* idx) {
+	const struct q3raster_scene* scene = job->scene;
+	const struct q3raster_view* view = job->view;
+	const struct q3face* f = scene->bsp->faces + face;
+	ch->triangles++;
+
+	struct corner poly[MAX_CORNERS];
+	u32 all_out = 0x1F, any_out = 0;
+	for(int k = 0; k < 3; k++) {
+		const struct q3vertex* v = scene->vertices + idx[k];
+		vec3 d = { v->pos.x - view->pos.x, v->pos.y - view->pos.y, v->pos.z - view->pos.z };
+		poly[k] = (struct corner) {
+			d.x * view->right.x + d.y * view->right.y + d.z * view->right.z,
+			d.x * view->up.x + d.y * view->up.y + d.z * view->up.z,
+			d.x * view->forward.x + d.y * view->forward.y + d.z * view->forward.z,
+			v->lightmap_coords.s, v->lightmap_coords.t,
+		};
+		u32 out = 0;
+		for(int plane = 0; plane < 5; plane++)
+			if(clip_distance(job->r, view, poly + k, plane) < 0.0f)
+				out |= 1U << plane;
+		all_out &= out;
+		any_out |= out;
+	}
+	if(all_out) {
+		ch->culled++;
+		return;
+	}
+
+	size_t n = 3;
+	if(any_out) {
+		ch->clipped++;
+		n = clip(job->r, view, poly, n, any_out);
+	}
+
+	const u32* lightmap = NULL;
+	u32 color = 0;
+	if(f->lightmap_idx >= 0 && (size_t)f->lightmap_idx < scene->n_lightmaps) {
+		lightmap = scene->lightmaps + (size_t)f->lightmap_idx * LIGHTMAP_TEXELS;
+	} else {
+		/* vertex lit, flat at the average of the corners */
+		u32 r = 0, g = 0, b = 0;
+		for(int k = 0; k < 3; k++) {
+			u32 c = scene->colors[idx[k]];
+			r += c >> 16 & 0xFF;
+			g += c >> 8 & 0xFF;
+			b += c & 0xFF;
+		}
+		color = r / 3 << 16 | g / 3 << 8 | b / 3;
+	}
+	for(size_t i = 1; i + 1 < n; i++)
+		emit(job, ch, bins, (const struct corner*[3]) { poly, poly + i, poly + i + 1 }, lightmap, color);
+}
+
+static void setup_chunk(void* user, size_t c, size_t worker) {
+	(void)worker;
+	const struct draw_job* job = user;
+	struct q3raster* r = job->r;
+	struct chunk* ch = r->chunks + c;
+	struct bin* bins = r->bins + c * r->n_tiles;
+	ch->n_tris = ch->triangles = ch->culled = ch->clipped = ch->binned = 0;
+	for(size_t t = 0; t < r->n_tiles; t++)
+		bins[t].n = 0;
+
+	size_t first = c * CHUNK_TRIS, last = first + CHUNK_TRIS < job->n_tris? first + CHUNK_TRIS : job->n_tris;
+	/* the listed face the chunk starts in */
+	size_t lo = 0, hi = job->n_faces;
+	while(hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if(r->face_start[mid] <= first)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	for(size_t tri = first, k = lo; tri < last; tri++) {
+		while(r->face_start[k + 1] <= tri)
+			k++;
+		u32 face = job->faces? job->faces[k] : k;
+		const u32* idx = job->scene->indices + job->scene->face_first[face] + (tri - r->face_start[k]) * 3;
+		setup_triangle(job, ch, bins, face, idx);
+	}
+}
+
+/* a to b by w/256, two channels at a time */
+static inline u32 lerp_rgb(u32 a, u32 b, u32 w) {
+	u32 rb = ((a & 0xFF00FF) * (256 - w) + (b & 0xFF00FF) * w) >> 8 & 0xFF00FF;
+	u32 g = ((a & 0xFF00) * (256 - w) + (b & 0xFF00) * w) >> 8 & 0xFF00;
+	return rb | g;
+}
+
+static inline u32 sample_lightmap(const u32* texels, float s, float t) {
+	float x = fminf(fmaxf(s * LIGHTMAP_SIZE - 0.5f, 0.0f), LIGHTMAP_SIZE - 1.0f);
+	float y = fminf(fmaxf(t * LIGHTMAP_SIZE - 0.5f, 0.0f), LIGHTMAP_SIZE - 1.0f);
+	int x0 = (int)x, y0 = (int)y;
+	int x1 = x0 + 1 < LIGHTMAP_SIZE? x0 + 1 : x0, y1 = y0 + 1 < LIGHTMAP_SIZE? y0 + 1 : y0;
+	u32 wx = (u32)((x - x0) * 256.0f), wy = (u32)((y - y0) * 256.0f);
+	const u32* row0 = texels + y0 * LIGHTMAP_SIZE, * row1 = texels + y1 * LIGHTMAP_SIZE;
+	return lerp_rgb(lerp_rgb(row0[x0], row0[x1], wx), lerp_rgb(row1[x0], row1[x1], wx), wy);
+}
+
+static size_t raster_triangle(struct q3raster* r, const struct tri* tri, struct tile_rect rect, u32* color) {
+	i32 x0 = tri->min_x > rect.x0? tri->min_x : rect.x0, x1 = tri->max_x + 1 < rect.x1? tri->max_x + 1 : rect.x1;
+	i32 y0 = tri->min_y > rect.y0? tri->min_y : rect.y0, y1 = tri->max_y + 1 < rect.y1? tri->max_y + 1 : rect.y1;
+	const i64 (*e)[3] = tri->edges;
+	size_t pixels = 0;
+	for(i32 y = y0; y < y1; y++) {
+		i64 e0 = e[0][0] * x0 + e[0][1] * y + e[0][2];
+		i64 e1 = e[1][0] * x0 + e[1][1] * y + e[1][2];
+		i64 e2 = e[2][0] * x0 + e[2][1] * y + e[2][2];
+		float iz_row = tri->iz[1] * y + tri->iz[2];
+		float s_row = tri->s[1] * y + tri->s[2], t_row = tri->t[1] * y + tri->t[2];
+		float* depth = r->depth + (size_t)y * r->width;
+		u32* out = color + (size_t)y * r->width;
+		for(i32 x = x0; x < x1; x++, e0 += e[0][0], e1 += e[1][0], e2 += e[2][0]) {
+			if((e0 | e1 | e2) < 0)
+				continue;
+			float iz = tri->iz[0] * x + iz_row;
+			if(iz <= depth[x])
+				continue;
+			depth[x] = iz;
+			if(tri->lightmap) {
+				float z = 1.0f / iz;
+				out[x] = sample_lightmap(tri->lightmap, (tri->s[0] * x + s_row) * z, (tri->t[0] * x + t_row) * z);
+			} else {
+				out[x] = tri->color;
+			}
+			pixels++;
+		}
+	}
+	return pixels;
+}
+
+/* chunks in order, so overlapping triangles resolve the same way every time */
+static void raster_tile(void* user, size_t tile, size_t worker) {
+	(void)worker;
+	const struct draw_job* job = user;
+	struct q3raster* r = job->r;
+	struct tile_rect rect = tile_rect(r, tile);
+	size_t pixels = 0;
+	for(size_t c = 0; c < r->n_chunks; c++) {
+		const struct bin* bin = r->bins + c * r->n_tiles + tile;
+		const struct tri* tris = r->chunks[c].tris;
+		for(u32 i = 0; i < bin->n; i++)
+			pixels += raster_triangle(r, tris + bin->tris[i], rect, job->color);
+	}
+	r->tile_pixels[tile] = pixels;
+}
+
+void q3raster_draw(struct q3raster* r, const struct q3raster_scene* scene, const struct q3raster_view* view,
+	const u32* faces, size_t n_faces, u32* color, struct q3raster_stats* stats) {
+	if(!faces)
+		n_faces = scene->bsp->n_faces;
+	if(n_faces + 1 > r->cap_faces) {
+		r->cap_faces = n_faces + 1;
+		r->face_start = realloc(r->face_start, sizeof(size_t) * r->cap_faces);
+	}
+	r->face_start[0] = 0;
+	for(size_t k = 0; k < n_faces; k++)
+		r->face_start[k + 1] = r->face_start[k] + scene->face_count[faces? faces[k] : k] / 3;
+
+	struct draw_job job = { r, scene, view, faces, n_faces, r->face_start[n_faces], color };
+	r->n_chunks = (job.n_tris + CHUNK_TRIS - 1) / CHUNK_TRIS;
+	if(r->n_chunks > r->cap_chunks) {
+		size_t cap = r->n_chunks;
+		r->chunks = realloc(r->chunks, sizeof(struct chunk) * cap);
+		r->bins = realloc(r->bins, sizeof(struct bin) * cap * r->n_tiles);
+		memset(r->chunks + r->cap_chunks, 0, sizeof(struct chunk) * (cap - r->cap_chunks));
+		memset(r->bins + r->cap_chunks * r->n_tiles, 0, sizeof(struct bin) * (cap - r->cap_chunks) * r->n_tiles);
+		r->cap_chunks = cap;
+	}
+
+	double t0 = q3_seconds();
+	q3pool_for(r->pool, r->n_chunks, setup_chunk, &job);
+	double t1 = q3_seconds();
+	q3pool_for(r->pool, r->n_tiles, raster_tile, &job);
+	double t2 = q3_seconds();
+
+	if(!stats)
+		return;
+	for(size_t c = 0; c < r->n_chunks; c++) {
+		stats->triangles += r->chunks[c].triangles;
+		stats->culled += r->chunks[c].culled;
+		stats->clipped += r->chunks[c].clipped;
+		stats->binned += r->chunks[c].binned;
+	}
+	for(size_t t = 0; t < r->n_tiles; t++)
+		stats->pixels += r->tile_pixels[t];
+	stats->setup_time += t1 - t0;
+	stats->raster_time += t2 - t1;
+}
+
+static inline float min2(float a, float b) {
+	return a < b? a : b;
+}
+
+/* texels x0 to x1 of a row of level l from the up to 2x2 under each */
+static void reduce_row(struct q3raster* r, size_t l, size_t y, size_t x0, size_t x1) {
+	size_t w = r->level_width[l - 1], h = r->level_height[l - 1];
+	const float* row0 = r->levels[l - 1] + y * 2 * w;
+	const float* row1 = r->levels[l - 1] + (y * 2 + 1 < h? y * 2 + 1 : y * 2) * w;
+	float* out = r->levels[l] + y * r->level_width[l];
+	size_t x = x0;
+#if defined(__SSE2__)
+	/* 4 texels from 8 columns while they're all there */
+	for(; x + 4 <= x1 && x * 2 + 8 <= w; x += 4) {
+		__m128 a = _mm_min_ps(_mm_loadu_ps(row0 + x * 2), _mm_loadu_ps(row1 + x * 2));
+		__m128 b = _mm_min_ps(_mm_loadu_ps(row0 + x * 2 + 4), _mm_loadu_ps(row1 + x * 2 + 4));
+		_mm_storeu_ps(out + x, _mm_min_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+	}
+#endif
+	for(; x < x1; x++) {
+		size_t a = x * 2, b = a + 1 < w? a + 1 : a;
+		out[x] = min2(min2(row0[a], row0[b]), min2(row1[a], row1[b]));
+	}
+}
+
+/* tiles line up with the lower levels, so those reduce tile by tile */
+static void reduce_tile(void* user, size_t tile, size_t worker) {
+	(void)worker;
+	struct q3raster* r = user;
+	struct tile_rect rect = tile_rect(r, tile);
+	for(size_t l = 1; l <= TILE_LEVELS && l < r->n_levels; l++) {
+		size_t x1 = ((size_t)rect.x1 + (1 << l) - 1) >> l, y1 = ((size_t)rect.y1 + (1 << l) - 1) >> l;
+		for(size_t y = (size_t)rect.y0 >> l; y < y1; y++)
+			reduce_row(r, l, y, (size_t)rect.x0 >> l, x1);
+	}
+}
+
+static void build_pyramid(struct q3raster* r) {
+	q3pool_for(r->pool, r->n_tiles, reduce_tile, r);
+	for(size_t l = TILE_LEVELS + 1; l < r->n_levels; l++)
+		for(size_t y = 0; y < r->level_height[l]; y++)
+			reduce_row(r, l, y, 0, r->level_width[l]);
+}
+
+/* the 8 corners of a box to view depth and screen position, x fastest then y then z */
+static void project_corners(const struct q3raster* r, const struct q3raster_view* v, const float mins[3], const float maxs[3],
+	float sx[8], float sy[8], float cz[8]) {
+	const float hw = r->width * 0.5f, hh = r->height * 0.5f;
+#if defined(__AVX2__)
+	__m256 x = _mm256_sub_ps(_mm256_setr_ps(mins[0], maxs[0], mins[0], maxs[0], mins[0], maxs[0], mins[0], maxs[0]), _mm256_set1_ps(v->pos.x));
+	__m256 y = _mm256_sub_ps(_mm256_setr_ps(mins[1], mins[1], maxs[1], maxs[1], mins[1], mins[1], maxs[1], maxs[1]), _mm256_set1_ps(v->pos.y));
+	__m256 z = _mm256_sub_ps(_mm256_setr_ps(mins[2], mins[2], mins[2], mins[2], maxs[2], maxs[2], maxs[2], maxs[2]), _mm256_set1_ps(v->pos.z));
+#define DOT(a) _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(a.x)), _mm256_mul_ps(y, _mm256_set1_ps(a.y))), _mm256_mul_ps(z, _mm256_set1_ps(a.z)))
+	__m256 vx = DOT(v->right), vy = DOT(v->up), vz = DOT(v->forward);
+#undef DOT
+	/* corners behind the eye come out nonsense, but then the caller doesn't look at them */
+	__m256 scale = _mm256_div_ps(_mm256_set1_ps(v->focal), vz);
+	_mm256_storeu_ps(sx, _mm256_add_ps(_mm256_set1_ps(hw), _mm256_mul_ps(vx, scale)));
+	_mm256_storeu_ps(sy, _mm256_sub_ps(_mm256_set1_ps(hh), _mm256_mul_ps(vy, scale)));
+	_mm256_storeu_ps(cz, vz);
+#elif defined(__SSE2__)
+	for(int half = 0; half < 2; half++) {
+		const float bz = half? maxs[2] : mins[2];
+		__m128 x = _mm_sub_ps(_mm_setr_ps(mins[0], maxs[0], mins[0], maxs[0]), _mm_set1_ps(v->pos.x));
+		__m128 y = _mm_sub_ps(_mm_setr_ps(mins[1], mins[1], maxs[1], maxs[1]), _mm_set1_ps(v->pos.y));
+		__m128 z = _mm_set1_ps(bz - v->pos.z);
+#define DOT(a) _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(a.x)), _mm_mul_ps(y, _mm_set1_ps(a.y))), _mm_mul_ps(z, _mm_set1_ps(a.z)))
+		__m128 vx = DOT(v->right), vy = DOT(v->up), vz = DOT(v->forward);
+#undef DOT
+		__m128 scale = _mm_div_ps(_mm_set1_ps(v->focal), vz);
+		_mm_storeu_ps(sx + half * 4, _mm_add_ps(_mm_set1_ps(hw), _mm_mul_ps(vx, scale)));
+		_mm_storeu_ps(sy + half * 4, _mm_sub_ps(_mm_set1_ps(hh), _mm_mul_ps(vy, scale)));
+		_mm_storeu_ps(cz + half * 4, vz);
+	}
+#else
+	for(int c = 0; c < 8; c++) {
+		vec3 d = {
+			(c & 1? maxs[0] : mins[0]) - v->pos.x,
+			(c & 2? maxs[1] : mins[1]) - v->pos.y,
+			(c & 4? maxs[2] : mins[2]) - v->pos.z,
+		};
+		float vx = d.x * v->right.x + d.y * v->right.y + d.z * v->right.z;
+		float vy = d.x * v->up.x + d.y * v->up.y + d.z * v->up.z;
+		cz[c] = d.x * v->forward.x + d.y * v->forward.y + d.z * v->forward.z;
+		sx[c] = hw + v->focal * vx / cz[c];
+		sy[c] = hh - v->focal * vy / cz[c];
+	}
+#endif
+}
+
+/* whether everything already drawn over the pixels the box covers is nearer than all of it */
+static bool box_hidden(const struct q3raster* r, const struct q3raster_view* view, const float mins[3], const float maxs[3]) {
+	float sx[8], sy[8], cz[8];
+	project_corners(r, view, mins, maxs, sx, sy, cz);
+	float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX, near = FLT_MAX;
+	for(int c = 0; c < 8; c++) {
+		min_x = fminf(min_x, sx[c]);
+		max_x = fmaxf(max_x, sx[c]);
+		min_y = fminf(min_y, sy[c]);
+		max_y = fmaxf(max_y, sy[c]);
+		near = fminf(near, cz[c]);
+	}
+	/* reaching around the eye it could be anywhere */
+	if(near < view->near)
+		return false;
+
+	i32 x0 = (i32)fmaxf(floorf(min_x), 0.0f), x1 = (i32)fminf(ceilf(max_x), r->width - 1.0f);
+	i32 y0 = (i32)fmaxf(floorf(min_y), 0.0f), y1 = (i32)fminf(ceilf(max_y), r->height - 1.0f);
+	if(x0 > x1 || y0 > y1)
+		return true;
+
+	/* the level where the rect is at most 3 texels across, so a handful of reads does */
+	size_t l = 0;
+	while(l + 1 < r->n_levels && ((x1 >> l) - (x0 >> l) > 2 || (y1 >> l) - (y0 >> l) > 2))
+		l++;
+	const float* level = r->levels[l];
+	float far = FLT_MAX;
+	for(i32 y = y0 >> l; y <= y1 >> l; y++)
+		for(i32 x = x0 >> l; x <= x1 >> l; x++)
+			far = fminf(far, level[y * r->level_width[l] + x]);
+	return 1.0f / near < far;
+}
+
+/* the frustum as planes through the eye, and the near plane, all facing in */
+struct frustum {
+	vec3 norm[5];
+	float dist[5];
+};
+
+static struct frustum frustum(const struct q3raster* r, const struct q3raster_view* v) {
+	struct frustum f;
+	/* a pixel of slack on every side */
+	float hw = r->width * 0.5f + 1.0f, hh = r->height * 0.5f + 1.0f;
+	vec3 sides[4][2] = { { v->right, v->forward }, { v->right, v->forward }, { v->up, v->forward }, { v->up, v->forward } };
+	float across[4] = { v->focal, -v->focal, v->focal, -v->focal }, along[4] = { hw, hw, hh, hh };
+	for(int i = 0; i < 4; i++) {
+		vec3 a = sides[i][0], b = sides[i][1];
+		f.norm[i] = (vec3) { a.x * across[i] + b.x * along[i], a.y * across[i] + b.y * along[i], a.z * across[i] + b.z * along[i] };
+	}
+	f.norm[4] = v->forward;
+	for(int i = 0; i < 5; i++)
+		f.dist[i] = f.norm[i].x * v->pos.x + f.norm[i].y * v->pos.y + f.norm[i].z * v->pos.z + (i == 4? v->near : 0.0f);
+	return f;
+}
+
+/* outside if even the box's furthest corner along a plane is behind it */
+static bool box_outside(const struct frustum* f, const float mins[3], const float maxs[3]) {
+	for(int i = 0; i < 5; i++) {
+		vec3 n = f->norm[i];
+		float d = n.x * (n.x > 0.0f? maxs[0] : mins[0]) + n.y * (n.y > 0.0f? maxs[1] : mins[1]) + n.z * (n.z > 0.0f? maxs[2] : mins[2]);
+		if(d < f->dist[i])
+			return true;
+	}
+	return false;
+}
+
+struct walk {
+	struct q3raster* r;
+	const struct q3raster_scene* scene;
+	const struct q3raster_view* view;
+	struct frustum frustum;
+	i32 cluster;
+	/* second time round, test against the pyramid and count what's drawn */
+	bool occlusion;
+	size_t drawn, culled_nodes;
+};
+
+static void ibox(ivec3 mins, ivec3 maxs, float out_mins[3], float out_maxs[3]) {
+	out_mins[0] = mins.x;
+	out_mins[1] = mins.y;
+	out_mins[2] = mins.z;
+	out_maxs[0] = maxs.x;
+	out_maxs[1] = maxs.y;
+	out_maxs[2] = maxs.z;
+}
+
+/* faces of a leaf onto the list, each face once a frame, returns the triangles added */
+static size_t take_leaf(struct q3raster* r, const struct q3raster_scene* scene, size_t leaf_idx) {
+	const struct q3bsp* bsp = scene->bsp;
+	const struct q3leaf* leaf = bsp->leafs + leaf_idx;
+	size_t tris = 0;
+	r->leaf_stamp[leaf_idx] = r->stamp;
+	for(u32 i = 0; i < leaf->n_leaf_faces; i++) {
+		if(leaf->leaf_face < 0 || (size_t)leaf->leaf_face + i >= bsp->n_leaf_faces)
+			break;
+		i32 f = bsp->leaf_faces[leaf->leaf_face + i].face;
+		if(f < 0 || (size_t)f >= bsp->n_faces || r->face_stamp[f] == r->stamp || !scene->face_count[f])
+			continue;
+		r->face_stamp[f] = r->stamp;
+		r->list[r->n_list++] = f;
+		tris += scene->face_count[f] / 3;
+	}
+	return tris;
+}
+
+/* near child first, so leaves come out front to back */
+static void walk(struct walk* w, i32 node) {
+	const struct q3bsp* bsp = w->scene->bsp;
+	float mins[3], maxs[3];
+	while(node >= 0) {
+		const struct q3node* n = bsp->nodes + node;
+		ibox(n->bb_mins, n->bb_maxs, mins, maxs);
+		if(box_outside(&w->frustum, mins, maxs))
+			return;
+		if(w->occlusion && box_hidden(w->r, w->view, mins, maxs)) {
+			w->culled_nodes++;
+			return;
+		}
+		const struct plane* plane = bsp->planes + n->plane;
+		vec3 p = w->view->pos;
+		int near = p.x * plane->norm.x + p.y * plane->norm.y + p.z * plane->norm.z - plane->dist >= 0.0f? 0 : 1;
+		walk(w, n->children[near]);
+		node = n->children[near ^ 1];
+	}
+
+	size_t leaf_idx = -(node + 1);
+	if(leaf_idx >= bsp->n_leafs)
+		return;
+	const struct q3leaf* leaf = bsp->leafs + leaf_idx;
+	if(!q3vis_cluster_visible(bsp->vis_data, w->cluster, leaf->cluster_idx))
+		return;
+	ibox(leaf->bb_mins, leaf->bb_maxs, mins, maxs);
+	if(box_outside(&w->frustum, mins, maxs))
+		return;
+	if(!w->occlusion) {
+		w->r->leaves[w->r->n_leaves++] = leaf_idx;
+		return;
+	}
+	/* the occluders are in already */
+	if(w->r->leaf_stamp[leaf_idx] == w->r->stamp || box_hidden(w->r, w->view, mins, maxs))
+		return;
+	take_leaf(w->r, w->scene, leaf_idx);
+	w->drawn++;
+}
+
+static i32 eye_cluster(const struct q3bsp* bsp, vec3 p) {
+	i32 node = 0;
+	while(node >= 0 && (size_t)node < bsp->n_nodes) {
+		const struct q3node* n = bsp->nodes + node;
+		const struct plane* plane = bsp->planes + n->plane;
+		node = n->children[p.x * plane->norm.x + p.y * plane->norm.y + p.z * plane->norm.z - plane->dist >= 0.0f? 0 : 1];
+	}
+	size_t leaf_idx = -(node + 1);
+	return node < 0 && leaf_idx < bsp->n_leafs? bsp->leafs[leaf_idx].cluster_idx : -1;
+}
+
+void q3raster_draw_bsp(struct q3raster* r, const struct q3raster_scene* scene, const struct q3raster_view* view,
+	bool occlusion, u32* color, struct q3raster_stats* stats) {
+	const struct q3bsp* bsp = scene->bsp;
+	struct q3raster_stats unused = { 0 };
+	stats = stats? stats : &unused;
+	double t0 = q3_seconds();
+
+	if(!r->face_stamp) {
+		r->leaves = malloc(sizeof(u32) * (bsp->n_leafs? bsp->n_leafs : 1));
+		r->list = malloc(sizeof(u32) * (bsp->n_faces? bsp->n_faces : 1));
+		r->face_stamp = calloc(bsp->n_faces? bsp->n_faces : 1, sizeof(u32));
+		r->leaf_stamp = calloc(bsp->n_leafs? bsp->n_leafs : 1, sizeof(u32));
+	}
+	if(!++r->stamp) {
+		memset(r->face_stamp, 0, sizeof(u32) * bsp->n_faces);
+		memset(r->leaf_stamp, 0, sizeof(u32) * bsp->n_leafs);
+		r->stamp = 1;
+	}
+
+	struct walk w = { r, scene, view, frustum(r, view), eye_cluster(bsp, view->pos), false, 0, 0 };
+	r->n_leaves = 0;
+	r->n_list = 0;
+	if(bsp->n_nodes)
+		walk(&w, 0);
+
+	size_t n_occluders = 0;
+	if(occlusion) {
+		for(size_t tris = 0; n_occluders < r->n_leaves && tris < Q3RASTER_OCCLUDER_TRIS; n_occluders++)
+			tris += take_leaf(r, scene, r->leaves[n_occluders]);
+		double t1 = q3_seconds();
+		q3raster_draw(r, scene, view, r->list, r->n_list, color, stats);
+		double t2 = q3_seconds();
+
+		build_pyramid(r);
+		r->n_list = 0;
+		w.occlusion = true;
+		if(bsp->n_nodes)
+			walk(&w, 0);
+		stats->culled_leaves += r->n_leaves - n_occluders - w.drawn;
+		stats->culled_nodes += w.culled_nodes;
+		t0 += t2 - t1;
+	} else {
+		for(size_t i = 0; i < r->n_leaves; i++)
+			take_leaf(r, scene, r->leaves[i]);
+	}
+
+	/* brush models aren't in the world's leaves, and there are few of them */
+	for(size_t m = 1; m < bsp->n_models; m++) {
+		const struct q3model* model = bsp->models + m;
+		for(u32 i = 0; i < model->n_faces; i++) {
+			i64 f = (i64)model->face_start_idx + i;
+			if(f < 0 || (size_t)f >= bsp->n_faces || r->face_stamp[f] == r->stamp || !scene->face_count[f])
+				continue;
+			r->face_stamp[f] = r->stamp;
+			r->list[r->n_list++] = f;
+		}
+	}
+	stats->leaves += r->n_leaves;
+	stats->occluders += n_occluders;
+	stats->cull_time += q3_seconds() - t0;
+
+	q3raster_draw(r, scene, view, r->list, r->n_list, color, stats);
+}
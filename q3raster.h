@@ -0,0 +1,104 @@
+#ifndef Q3_RASTER_H_
+#define Q3_RASTER_H_
+
+#include <stdbool.h>
+
+#include "q3bsp.h"
+#include "q3parallel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* pixels along a tile's side, 64x64 of colour and depth is 32KiB */
+#define Q3RASTER_TILE 64
+/* triangles from the nearest leaves drawn before the depth pyramid is built */
+#define Q3RASTER_OCCLUDER_TRIS 4096
+
+/* the map's surfaces as triangles, kept per face so a caller can pick which faces to draw */
+struct q3raster_scene {
+	const struct q3bsp* bsp;
+	/* the map's vertices, followed by tessellated patch vertices if any */
+	size_t n_vertices;
+	struct q3vertex* vertices;
+	size_t n_indices;
+	u32* indices;
+	/* per map face, where its indices start and how many, 0 for faces that don't get drawn */
+	u32* face_first;
+	u32* face_count;
+
+	/* 128x128 texels each, 0x00RRGGBB with the overbright shift done */
+	size_t n_lightmaps;
+	u32* lightmaps;
+	/* per vertex, same format, for faces without a lightmap */
+	u32* colors;
+};
+
+/* patch_level 0 leaves patches out, billboards and nodraw or sky surfaces are always left out */
+struct q3raster_scene* q3raster_scene_build(const struct q3bsp* bsp, u32 patch_level);
+void q3raster_scene_free(struct q3raster_scene* scene);
+
+/* a pinhole camera, a point in view space at depth z lands focal * x / z pixels off centre */
+struct q3raster_view {
+	vec3 pos;
+	vec3 forward, right, up;
+	float focal;
+	float near;
+};
+
+/* one draw's worth, added onto whatever is there */
+struct q3raster_stats {
+	size_t triangles;
+	/* facing away or entirely off screen */
+	size_t culled;
+	/* crossed the near plane or the guard band and were cut */
+	size_t clipped;
+	/* triangle and tile pairs */
+	size_t binned;
+	/* pixels that passed the depth test */
+	size_t pixels;
+	double setup_time;
+	double raster_time;
+
+	/* q3raster_draw_bsp only: leaves in the frustum and the PVS, how many of those went first as occluders */
+	size_t leaves;
+	size_t occluders;
+	/* leaves and nodes whose box was behind the depth pyramid */
+	size_t culled_leaves;
+	size_t culled_nodes;
+	/* walking the tree, building the pyramid and testing boxes */
+	double cull_time;
+};
+
+struct q3raster;
+
+/* the pool does both stages, color isn't owned and can change between frames */
+struct q3raster* q3raster_create(struct q3pool* pool, size_t width, size_t height);
+void q3raster_free(struct q3raster* r);
+
+/* fills color with background and resets depth, tile by tile on the pool */
+void q3raster_clear(struct q3raster* r, u32* color, u32 background);
+
+/*
+	Draws the given faces, or every face if faces is NULL, depth tested against whatever was
+	drawn since the last clear. Triangles are set up and binned to tiles in chunks, then each
+	tile walks the bins chunk by chunk, so the result doesn't depend on who ran what.
+	Lightmaps are sampled bilinearly and perspective correct. stats may be NULL.
+*/
+void q3raster_draw(struct q3raster* r, const struct q3raster_scene* scene, const struct q3raster_view* view,
+	const u32* faces, size_t n_faces, u32* color, struct q3raster_stats* stats);
+
+/*
+	Draws the world's leaves that are in the frustum and the PVS, and every brush model. With
+	occlusion on the leaves are drawn front to back in tree order: the nearest up to
+	Q3RASTER_OCCLUDER_TRIS triangles first, then a pyramid of the furthest depth per 2x2 is
+	built over the depth buffer, and the tree is walked again dropping any node or leaf whose
+	box is behind it before their faces get binned.
+*/
+void q3raster_draw_bsp(struct q3raster* r, const struct q3raster_scene* scene, const struct q3raster_view* view,
+	bool occlusion, u32* color, struct q3raster_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,229 @@
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "q3sdf.h"
+
+static inline float vdot(vec3 a, vec3 b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline vec3 vsub(vec3 a, vec3 b) {
+	return (vec3) { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+static inline vec3 vcross(vec3 a, vec3 b) {
+	return (vec3) { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+struct q3sdf* q3sdf_build(const struct q3bsp* bsp, u32 contents) {
+	struct q3sdf* sdf = calloc(1, sizeof(struct q3sdf));
+	sdf->bsp = bsp;
+	sdf->hulls = q3hull_build(bsp, contents);
+	sdf->brush_hull = malloc(sizeof(i32) * (bsp->n_brushes? bsp->n_brushes : 1));
+	for(size_t i = 0; i < bsp->n_brushes; i++)
+		sdf->brush_hull[i] = -1;
+	for(size_t h = 0; h < sdf->hulls->n_hulls; h++)
+		sdf->brush_hull[sdf->hulls->hulls[h].brush] = h;
+
+	/* brushes past the world model's only show up in their own model's leaves */
+	size_t world_end = bsp->n_models? (size_t)bsp->models[0].brush_start_idx + bsp->models[0].n_brushes : 0;
+	sdf->loose = malloc(sizeof(u32) * (sdf->hulls->n_hulls? sdf->hulls->n_hulls : 1));
+	for(size_t h = 0; h < sdf->hulls->n_hulls; h++)
+		if((size_t)sdf->hulls->hulls[h].brush >= world_end)
+			sdf->loose[sdf->n_loose++] = h;
+	return sdf;
+}
+
+void q3sdf_free(struct q3sdf* sdf) {
+	if(!sdf)
+		return;
+	q3hull_free(sdf->hulls);
+	free(sdf->brush_hull);
+	free(sdf->loose);
+	free(sdf);
+}
+
+/* squared distance from p to a face it's d in front of */
+static float face_distance2(const struct q3hull_set* set, const struct q3hull* hull, const struct q3hull_face* face, vec3 p, float d) {
+	const vec3* v = set->vertices + hull->first_vertex;
+	const u32* idx = set->indices + face->first_index;
+	vec3 q = { p.x - face->norm.x * d, p.y - face->norm.y * d, p.z - face->norm.z * d };
+
+	bool inside = true;
+	float best = FLT_MAX;
+	for(u32 i = 0; i < face->n_indices; i++) {
+		vec3 a = v[idx[i]], b = v[idx[(i + 1) % face->n_indices]];
+		vec3 ab = vsub(b, a), ap = vsub(p, a);
+		/* counter clockwise from outside, so inside is to the left of every edge */
+		if(vdot(vcross(ab, vsub(q, a)), face->norm) < 0.0f)
+			inside = false;
+		float len2 = vdot(ab, ab);
+		float t = len2 > 0.0f? fminf(fmaxf(vdot(ap, ab) / len2, 0.0f), 1.0f) : 0.0f;
+		vec3 e = { ap.x - ab.x * t, ap.y - ab.y * t, ap.z - ab.z * t };
+		best = fminf(best, vdot(e, e));
+	}
+	return inside? d * d : best;
+}
+
+float q3sdf_hull(const struct q3sdf* sdf, u32 h, vec3 p) {
+	const struct q3hull_set* set = sdf->hulls;
+	const struct q3hull* hull = set->hulls + h;
+	const struct q3hull_face* faces = set->faces + hull->first_face;
+
+	float max_d = -FLT_MAX;
+	u32 max_f = 0;
+	for(u32 f = 0; f < hull->n_faces; f++) {
+		float d = vdot(faces[f].norm, p) - faces[f].dist;
+		if(d > max_d) {
+			max_d = d;
+			max_f = f;
+		}
+	}
+	if(max_d <= 0.0f)
+		return max_d;
+
+	/* nothing is closer than the furthest plane, so if its face is right there that's it */
+	float best = face_distance2(set, hull, faces + max_f, p, max_d);
+	if(best <= max_d * max_d)
+		return max_d;
+	for(u32 f = 0; f < hull->n_faces; f++) {
+		float d = vdot(faces[f].norm, p) - faces[f].dist;
+		if(f != max_f && d > 0.0f && d * d < best)
+			best = fminf(best, face_distance2(set, hull, faces + f, p, d));
+	}
+	return sqrtf(best);
+}
+
+/* squared distance to the box, 0 inside */
+static inline float box_distance2(const struct q3hull* hull, vec3 p) {
+	float dx = fmaxf(fmaxf(hull->mins.x - p.x, p.x - hull->maxs.x), 0.0f);
+	float dy = fmaxf(fmaxf(hull->mins.y - p.y, p.y - hull->maxs.y), 0.0f);
+	float dz = fmaxf(fmaxf(hull->mins.z - p.z, p.z - hull->maxs.z), 0.0f);
+	return dx * dx + dy * dy + dz * dz;
+}
+
+/* the box is never further than the hull, so skip anything that can't beat what we have */
+static void visit_hull(const struct q3sdf* sdf, u32 h, vec3 p, float* best, struct q3sdf_stats* stats) {
+	float bd = box_distance2(sdf->hulls->hulls + h, p);
+	if(bd > 0.0f && (*best <= 0.0f || bd >= *best * *best))
+		return;
+	stats->hulls++;
+	*best = fminf(*best, q3sdf_hull(sdf, h, p));
+}
+
+static void visit_leaf(const struct q3sdf* sdf, size_t leaf_idx, vec3 p, float* best, struct q3sdf_stats* stats) {
+	const struct q3bsp* bsp = sdf->bsp;
+	if(leaf_idx >= bsp->n_leafs)
+		return;
+	const struct q3leaf* leaf = bsp->leafs + leaf_idx;
+	stats->leaves++;
+	for(u32 i = 0; i < leaf->n_leafbrushes; i++) {
+		if((size_t)leaf->leaf_brush + i >= bsp->n_leaf_brushes)
+			break;
+		i32 b = bsp->leaf_brushes[leaf->leaf_brush + i].brush;
+		if(b >= 0 && (size_t)b < bsp->n_brushes && sdf->brush_hull[b] >= 0)
+			visit_hull(sdf, sdf->brush_hull[b], p, best, stats);
+	}
+}
+
+static void visit(const struct q3sdf* sdf, i32 node, vec3 p, float* best, struct q3sdf_stats* stats) {
+	const struct q3bsp* bsp = sdf->bsp;
+	while(node >= 0) {
+		const struct q3node* n = bsp->nodes + node;
+		const struct plane* plane = bsp->planes + n->plane;
+		float d = vdot(p, plane->norm) - plane->dist;
+		int near = d >= 0.0f? 0 : 1;
+		stats->nodes++;
+
+		if(fabsf(d) >= *best) {
+			node = n->children[near];
+			continue;
+		}
+		/* the ball around p reaches across, near side first so it's smaller by the time we cross */
+		visit(sdf, n->children[near], p, best, stats);
+		if(fabsf(d) >= *best)
+			return;
+		node = n->children[near ^ 1];
+	}
+	visit_leaf(sdf, -(node + 1), p, best, stats);
+}
+
+float q3sdf_eval(const struct q3sdf* sdf, vec3 p, float max_dist, struct q3sdf_stats* stats) {
+	struct q3sdf_stats unused = { 0 };
+	float best = max_dist;
+	stats = stats? stats : &unused;
+	if(sdf->bsp->n_nodes)
+		visit(sdf, 0, p, &best, stats);
+	for(size_t i = 0; i < sdf->n_loose; i++)
+		visit_hull(sdf, sdf->loose[i], p, &best, stats);
+	return best;
+}
+
+struct gather {
+	u32* out;
+	size_t cap;
+	size_t n;
+};
+
+static void gather_hull(const struct q3sdf* sdf, u32 h, vec3 p, float radius, struct gather* g) {
+	if(box_distance2(sdf->hulls->hulls + h, p) > radius * radius)
+		return;
+	if(g->n < g->cap)
+		g->out[g->n] = h;
+	g->n++;
+}
+
+static void gather_node(const struct q3sdf* sdf, i32 node, vec3 p, float radius, struct gather* g) {
+	const struct q3bsp* bsp = sdf->bsp;
+	while(node >= 0) {
+		const struct q3node* n = bsp->nodes + node;
+		const struct plane* plane = bsp->planes + n->plane;
+		float d = vdot(p, plane->norm) - plane->dist;
+		if(d > -radius && d < radius)
+			gather_node(sdf, n->children[1], p, radius, g);
+		node = n->children[d >= -radius? 0 : 1];
+	}
+	size_t leaf_idx = -(node + 1);
+	if(leaf_idx >= bsp->n_leafs)
+		return;
+	const struct q3leaf* leaf = bsp->leafs + leaf_idx;
+	for(u32 i = 0; i < leaf->n_leafbrushes; i++) {
+		if((size_t)leaf->leaf_brush + i >= bsp->n_leaf_brushes)
+			break;
+		i32 b = bsp->leaf_brushes[leaf->leaf_brush + i].brush;
+		if(b >= 0 && (size_t)b < bsp->n_brushes && sdf->brush_hull[b] >= 0)
+			gather_hull(sdf, sdf->brush_hull[b], p, radius, g);
+	}
+}
+
+static int compare_u32(const void* a, const void* b) {
+	u32 x = *(const u32*)a, y = *(const u32*)b;
+	return x < y? -1 : x > y;
+}
+
+size_t q3sdf_gather(const struct q3sdf* sdf, vec3 p, float radius, u32* out, size_t cap) {
+	struct gather g = { out, cap, 0 };
+	if(sdf->bsp->n_nodes)
+		gather_node(sdf, 0, p, radius, &g);
+	for(size_t i = 0; i < sdf->n_loose; i++)
+		gather_hull(sdf, sdf->loose[i], p, radius, &g);
+
+	/* brushes sit in every leaf they touch, so there are repeats */
+	if(g.n > cap)
+		return g.n;
+	qsort(out, g.n, sizeof(u32), compare_u32);
+	size_t n = 0;
+	for(size_t i = 0; i < g.n; i++)
+		if(!n || out[n - 1] != out[i])
+			out[n++] = out[i];
+	return n;
+}
+
+float q3sdf_eval_all(const struct q3sdf* sdf, vec3 p, float max_dist) {
+	float best = max_dist;
+	for(size_t h = 0; h < sdf->hulls->n_hulls; h++)
+		best = fminf(best, q3sdf_hull(sdf, h, p));
+	return best;
+}
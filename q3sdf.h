@@ -0,0 +1,58 @@
+#ifndef Q3_SDF_H_
+#define Q3_SDF_H_
+
+#include "q3bsp.h"
+#include "q3hull.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the brushes as hulls, looked up through the BSP tree */
+struct q3sdf {
+	const struct q3bsp* bsp;
+	struct q3hull_set* hulls;
+	/* hull of each brush, -1 for brushes without the contents */
+	i32* brush_hull;
+	/* hulls of brush models (doors, platforms...), which the world's leaves don't list */
+	size_t n_loose;
+	u32* loose;
+};
+
+/* what one evaluation touched, added onto whatever is there */
+struct q3sdf_stats {
+	size_t nodes;
+	size_t leaves;
+	size_t hulls;
+};
+
+struct q3sdf* q3sdf_build(const struct q3bsp* bsp, u32 contents);
+void q3sdf_free(struct q3sdf* sdf);
+
+/*
+	Exact signed distance to one hull. Inside it's the nearest face plane, outside it's the
+	nearest point on the faces p is in front of.
+*/
+float q3sdf_hull(const struct q3sdf* sdf, u32 hull, vec3 p);
+
+/*
+	Signed distance to the nearest brush, exact below max_dist and max_dist past it. Walks the
+	tree near side first and only crosses a split closer than the best distance so far, so the
+	cost follows how much is around p rather than the size of the map. Brush models are few
+	and get checked by their boxes. stats may be NULL.
+*/
+float q3sdf_eval(const struct q3sdf* sdf, vec3 p, float max_dist, struct q3sdf_stats* stats);
+
+/*
+	Every hull whose box comes within radius of p, each once and in order. Returns how many,
+	or something over cap if they didn't fit, and then out is no use.
+*/
+size_t q3sdf_gather(const struct q3sdf* sdf, vec3 p, float radius, u32* out, size_t cap);
+
+/* the same by testing every hull, for checking */
+float q3sdf_eval_all(const struct q3sdf* sdf, vec3 p, float max_dist);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
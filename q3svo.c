@@ -0,0 +1,331 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "q3parallel.h"
+#include "q3svo.h"
+
+enum {
+	EMPTY,
+	SOLID,
+	MIXED,
+};
+
+bool q3svo_brush_solid(const struct q3bsp* bsp, u32 contents, vec3 p) {
+	if(!bsp->n_nodes)
+		return false;
+
+	i32 node = 0;
+	while(node >= 0) {
+		const struct q3node* n = bsp->nodes + node;
+		const struct plane* plane = bsp->planes + n->plane;
+		float d = p.x * plane->norm.x + p.y * plane->norm.y + p.z * plane->norm.z - plane->dist;
+		node = n->children[d >= 0.0f? 0 : 1];
+	}
+	size_t leaf_idx = -(node + 1);
+	if(leaf_idx >= bsp->n_leafs)
+		return false;
+
+	/* brushes straddling a split are in the leaves on both sides, so this leaf has all of them */
+	const struct q3leaf* leaf = bsp->leafs + leaf_idx;
+	for(u32 i = 0; i < leaf->n_leafbrushes; i++) {
+		if((size_t)leaf->leaf_brush + i >= bsp->n_leaf_brushes)
+			break;
+		i32 b = bsp->leaf_brushes[leaf->leaf_brush + i].brush;
+		if(b < 0 || (size_t)b >= bsp->n_brushes)
+			continue;
+		const struct q3brush* brush = bsp->brushes + b;
+		i32 tex = brush->texture_idx;
+		if(tex < 0 || (size_t)tex >= bsp->n_textures || !((u32)bsp->textures[tex].contents & contents))
+			continue;
+
+		bool inside = brush->n_brushsides > 0;
+		for(u32 s = 0; s < brush->n_brushsides && inside; s++) {
+			const struct plane* plane = bsp->planes + bsp->brush_sides[brush->first_brushside_idx + s].plane_idx;
+			inside = p.x * plane->norm.x + p.y * plane->norm.y + p.z * plane->norm.z - plane->dist <= 0.0f;
+		}
+		if(inside)
+			return true;
+	}
+	return false;
+}
+
+struct classify_job {
+	const struct q3bsp* bsp;
+	u32 contents;
+	const struct q3svo* svo;
+	/* one bit per voxel, rows padded to whole words */
+	u64* bits;
+	size_t row_words;
+	size_t* counts;
+};
+
+static void classify_slab(void* user, size_t z) {
+	const struct classify_job* job = user;
+	const struct q3svo* svo = job->svo;
+	size_t count = 0;
+	for(u32 y = 0; y < svo->dims[1]; y++) {
+		u64* row = job->bits + (z * svo->dims[1] + y) * job->row_words;
+		for(u32 x = 0; x < svo->dims[0]; x++) {
+			vec3 p = {
+				svo->origin.x + (x + 0.5f) * svo->voxel_size,
+				svo->origin.y + (y + 0.5f) * svo->voxel_size,
+				svo->origin.z + (z + 0.5f) * svo->voxel_size,
+			};
+			if(q3svo_brush_solid(job->bsp, job->contents, p)) {
+				row[x / 64] |= (u64)1 << (x % 64);
+				count++;
+			}
+		}
+	}
+	job->counts[z] = count;
+}
+
+/* one level of the status pyramid, cells past dims are empty */
+struct level {
+	u32 dims[3];
+	u8* status;
+};
+
+struct reduce_job {
+	const struct q3svo* svo;
+	const u64* bits;
+	size_t row_words;
+	/* the finer level, unused when building on the voxels */
+	const struct level* below;
+	struct level* level;
+};
+
+static u8 voxel_status(const struct reduce_job* job, u32 x, u32 y, u32 z) {
+	const struct q3svo* svo = job->svo;
+	if(x >= svo->dims[0] || y >= svo->dims[1] || z >= svo->dims[2])
+		return EMPTY;
+	return (job->bits[((size_t)z * svo->dims[1] + y) * job->row_words + x / 64] >> (x % 64)) & 1? SOLID : EMPTY;
+}
+
+static u8 cell_status(const struct level* l, u32 x, u32 y, u32 z) {
+	if(x >= l->dims[0] || y >= l->dims[1] || z >= l->dims[2])
+		return EMPTY;
+	return l->status[((size_t)z * l->dims[1] + y) * l->dims[0] + x];
+}
+
+static u8 child_status(const struct reduce_job* job, u32 x, u32 y, u32 z) {
+	return job->below? cell_status(job->below, x, y, z) : voxel_status(job, x, y, z);
+}
+
+static void reduce_slab(void* user, size_t z) {
+	const struct reduce_job* job = user;
+	struct level* l = job->level;
+	for(u32 y = 0; y < l->dims[1]; y++) {
+		for(u32 x = 0; x < l->dims[0]; x++) {
+			u8 first = child_status(job, 2 * x, 2 * y, 2 * z);
+			u8 s = first;
+			for(int c = 1; c < 8 && s != MIXED; c++)
+				if(child_status(job, 2 * x + (c & 1), 2 * y + (c >> 1 & 1), 2 * z + (c >> 2)) != first)
+					s = MIXED;
+			l->status[((size_t)z * l->dims[1] + y) * l->dims[0] + x] = s;
+		}
+	}
+}
+
+struct q3svo* q3svo_build(const struct q3bsp* bsp, float voxel_size, u32 contents) {
+	struct q3svo* svo = calloc(1, sizeof(struct q3svo));
+	svo->voxel_size = voxel_size > 0.0f? voxel_size : 1.0f;
+
+	/* the world model's bounds plus a voxel of air all round */
+	vec3 mins = bsp->n_models? bsp->models[0].mins : (vec3) { 0.0f, 0.0f, 0.0f };
+	vec3 maxs = bsp->n_models? bsp->models[0].maxs : (vec3) { 0.0f, 0.0f, 0.0f };
+	svo->origin = (vec3) { mins.x - svo->voxel_size, mins.y - svo->voxel_size, mins.z - svo->voxel_size };
+	u32 side = 1;
+	for(int k = 0; k < 3; k++) {
+		float extent = (&maxs.x)[k] - (&mins.x)[k] + 2.0f * svo->voxel_size;
+		svo->dims[k] = (u32)ceilf(extent / svo->voxel_size);
+		if(!svo->dims[k])
+			svo->dims[k] = 1;
+		while(side < svo->dims[k]) {
+			side <<= 1;
+			svo->depth++;
+		}
+	}
+
+	size_t row_words = (svo->dims[0] + 63) / 64;
+	u64* bits = calloc(row_words * svo->dims[1] * svo->dims[2], sizeof(u64));
+	size_t* counts = calloc(svo->dims[2], sizeof(size_t));
+	struct classify_job classify = { bsp, contents, svo, bits, row_words, counts };
+	q3_parallel_for(svo->dims[2], classify_slab, &classify);
+	for(u32 z = 0; z < svo->dims[2]; z++)
+		svo->n_solid_voxels += counts[z];
+	free(counts);
+
+	/* levels[l] holds cells 2^l voxels wide, 1 through depth */
+	struct level* levels = calloc(svo->depth + 1, sizeof(struct level));
+	for(u32 l = 1; l <= svo->depth; l++) {
+		for(int k = 0; k < 3; k++)
+			levels[l].dims[k] = (svo->dims[k] + (1U << l) - 1) >> l;
+		levels[l].status = malloc((size_t)levels[l].dims[0] * levels[l].dims[1] * levels[l].dims[2]);
+		struct reduce_job reduce = { svo, bits, row_words, l > 1? levels + l - 1 : NULL, levels + l };
+		q3_parallel_for(levels[l].dims[2], reduce_slab, &reduce);
+	}
+
+	u8 root = svo->depth? levels[svo->depth].status[0] : (bits[0] & 1? SOLID : EMPTY);
+	if(root != MIXED) {
+		svo->root_solid = root == SOLID;
+	} else {
+		/* breadth first, so each node's mixed children are appended together */
+		size_t cap = 64;
+		svo->nodes = malloc(sizeof(struct q3svo_node) * cap);
+		u32 (*where)[4] = malloc(sizeof(u32[4]) * cap);
+		svo->n_nodes = 1;
+		where[0][0] = svo->depth;
+		where[0][1] = where[0][2] = where[0][3] = 0;
+
+		for(size_t i = 0; i < svo->n_nodes; i++) {
+			u32 l = where[i][0], x = where[i][1], y = where[i][2], z = where[i][3];
+			struct reduce_job below = { svo, bits, row_words, l > 1? levels + l - 1 : NULL, NULL };
+			struct q3svo_node node = { .first_child = svo->n_nodes };
+			for(int c = 0; c < 8; c++) {
+				u32 cx = 2 * x + (c & 1), cy = 2 * y + (c >> 1 & 1), cz = 2 * z + (c >> 2);
+				u8 s = child_status(&below, cx, cy, cz);
+				if(s == SOLID) {
+					node.solid |= 1 << c;
+				} else if(s == MIXED) {
+					node.mixed |= 1 << c;
+					if(svo->n_nodes == cap) {
+						cap *= 2;
+						svo->nodes = realloc(svo->nodes, sizeof(struct q3svo_node) * cap);
+						where = realloc(where, sizeof(u32[4]) * cap);
+					}
+					where[svo->n_nodes][0] = l - 1;
+					where[svo->n_nodes][1] = cx;
+					where[svo->n_nodes][2] = cy;
+					where[svo->n_nodes][3] = cz;
+					svo->n_nodes++;
+				}
+			}
+			svo->nodes[i] = node;
+		}
+		free(where);
+		svo->nodes = realloc(svo->nodes, sizeof(struct q3svo_node) * svo->n_nodes);
+	}
+
+	for(u32 l = 1; l <= svo->depth; l++)
+		free(levels[l].status);
+	free(levels);
+	free(bits);
+	return svo;
+}
+
+void q3svo_free(struct q3svo* svo) {
+	if(!svo)
+		return;
+	free(svo->nodes);
+	free(svo);
+}
+
+static inline u32 child_node(const struct q3svo_node* n, int c) {
+	return n->first_child + __builtin_popcount(n->mixed & ((1U << c) - 1));
+}
+
+bool q3svo_point_solid(const struct q3svo* svo, vec3 p) {
+	float fx = (p.x - svo->origin.x) / svo->voxel_size;
+	float fy = (p.y - svo->origin.y) / svo->voxel_size;
+	float fz = (p.z - svo->origin.z) / svo->voxel_size;
+	float side = (float)(1U << svo->depth);
+	if(!(fx >= 0.0f && fy >= 0.0f && fz >= 0.0f && fx < side && fy < side && fz < side))
+		return false;
+	if(!svo->n_nodes)
+		return svo->root_solid;
+
+	u32 x = fx, y = fy, z = fz;
+	const struct q3svo_node* n = svo->nodes;
+	for(u32 l = svo->depth; l > 0; l--) {
+		int c = (x >> (l - 1) & 1) | (y >> (l - 1) & 1) << 1 | (z >> (l - 1) & 1) << 2;
+		if(n->solid & (1 << c))
+			return true;
+		if(!(n->mixed & (1 << c)))
+			return false;
+		n = svo->nodes + child_node(n, c);
+	}
+	return false;
+}
+
+/* where a + t*d is inside the box, clipped to [t0, t1], false if nowhere */
+static bool clip_box(const float* a, const float* inv, const float* lo, float size, float* t0, float* t1) {
+	for(int k = 0; k < 3; k++) {
+		if(isinf(inv[k])) {
+			if(a[k] < lo[k] || a[k] >= lo[k] + size)
+				return false;
+			continue;
+		}
+		float ta = (lo[k] - a[k]) * inv[k], tb = (lo[k] + size - a[k]) * inv[k];
+		if(ta > tb) {
+			float t = ta;
+			ta = tb;
+			tb = t;
+		}
+		*t0 = fmaxf(*t0, ta);
+		*t1 = fminf(*t1, tb);
+		if(*t0 > *t1)
+			return false;
+	}
+	return true;
+}
+
+/* children are visited in the order the segment enters them, so the first solid one found is the nearest */
+static bool segment_node(const struct q3svo* svo, const struct q3svo_node* n, const float* lo, float size,
+	const float* a, const float* inv, float t0, float t1, float* hit) {
+	float half = size * 0.5f;
+	int order[8];
+	float enter[8];
+	int count = 0;
+	for(int c = 0; c < 8; c++) {
+		if(!((n->solid | n->mixed) & (1 << c)))
+			continue;
+		float clo[3] = { lo[0] + (c & 1) * half, lo[1] + (c >> 1 & 1) * half, lo[2] + (c >> 2) * half };
+		float c0 = t0, c1 = t1;
+		if(!clip_box(a, inv, clo, half, &c0, &c1))
+			continue;
+		int j = count++;
+		for(; j > 0 && enter[j - 1] > c0; j--) {
+			enter[j] = enter[j - 1];
+			order[j] = order[j - 1];
+		}
+		enter[j] = c0;
+		order[j] = c;
+	}
+
+	for(int i = 0; i < count; i++) {
+		int c = order[i];
+		if(n->solid & (1 << c)) {
+			*hit = enter[i];
+			return true;
+		}
+		float clo[3] = { lo[0] + (c & 1) * half, lo[1] + (c >> 1 & 1) * half, lo[2] + (c >> 2) * half };
+		float c0 = t0, c1 = t1;
+		clip_box(a, inv, clo, half, &c0, &c1);
+		if(segment_node(svo, svo->nodes + child_node(n, c), clo, half, a, inv, c0, c1, hit))
+			return true;
+	}
+	return false;
+}
+
+bool q3svo_segment_solid(const struct q3svo* svo, vec3 a, vec3 b, float* frac) {
+	float pa[3] = { a.x, a.y, a.z };
+	float inv[3] = { 1.0f / (b.x - a.x), 1.0f / (b.y - a.y), 1.0f / (b.z - a.z) };
+	float lo[3] = { svo->origin.x, svo->origin.y, svo->origin.z };
+	float size = svo->voxel_size * (float)(1U << svo->depth);
+	float t0 = 0.0f, t1 = 1.0f, hit = 0.0f;
+	bool solid = false;
+
+	if(clip_box(pa, inv, lo, size, &t0, &t1)) {
+		if(!svo->n_nodes) {
+			solid = svo->root_solid;
+			hit = t0;
+		} else {
+			solid = segment_node(svo, svo->nodes, lo, size, pa, inv, t0, t1, &hit);
+		}
+	}
+	if(frac)
+		*frac = solid? hit : 1.0f;
+	return solid;
+}
@@ -0,0 +1,59 @@
+#ifndef Q3_SVO_H_
+#define Q3_SVO_H_
+
+#include <stdbool.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the q3map content bit for solid brushes */
+#define Q3SVO_CONTENTS_SOLID 1
+
+/*
+	Children are in xyz bit order (bit 0 is +x). A child with its solid bit set is solid all the
+	way through, one with its mixed bit set is a node of its own, anything else is empty. Mixed
+	children sit together starting at first_child in bit order. Nodes one level above the voxels
+	only ever have solid bits.
+*/
+struct q3svo_node {
+	u32 first_child;
+	u8 solid;
+	u8 mixed;
+	u16 pad;
+};
+
+struct q3svo {
+	/* min corner of the root cube, which is voxel_size << depth wide */
+	vec3 origin;
+	float voxel_size;
+	u32 depth;
+	/* the area actually classified, in voxels */
+	u32 dims[3];
+	/* the root is node 0, unless the whole cube is one thing and there are no nodes */
+	size_t n_nodes;
+	struct q3svo_node* nodes;
+	bool root_solid;
+	size_t n_solid_voxels;
+};
+
+/* true if p is inside a brush with any of the contents bits, found by walking the BSP tree to its leaf */
+bool q3svo_brush_solid(const struct q3bsp* bsp, u32 contents, vec3 p);
+
+/*
+	Samples q3svo_brush_solid at every voxel centre across the world model's bounds, one task per
+	Z slab, then folds the grid into an octree from the bottom up.
+*/
+struct q3svo* q3svo_build(const struct q3bsp* bsp, float voxel_size, u32 contents);
+void q3svo_free(struct q3svo* svo);
+
+bool q3svo_point_solid(const struct q3svo* svo, vec3 p);
+/* true if the segment touches a solid voxel, frac gets how far along it that happens */
+bool q3svo_segment_solid(const struct q3svo* svo, vec3 a, vec3 b, float* frac);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,13 @@
+#ifndef Q3_TIME_H_
+#define Q3_TIME_H_
+
+#include <time.h>
+
+/* monotonic wall clock in seconds, only meant for measuring intervals */
+static inline double q3_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include <string.h>
+
+#include "q3vis.h"
+
+bool q3vis_cluster_visible(const struct q3vis_data* vis, i32 from, i32 to) {
+	if(!vis || from < 0 || to < 0 || (u32)from >= vis->n_vectors || (u32)to >= vis->sz_vectors * 8)
+		return true;
+
+	const u8* row = vis->vectors + (size_t)from * vis->sz_vectors;
+	return (row[to >> 3] & (1 << (to & 7))) != 0;
+}
+
+/* worst case is alternating single zeros, which doubles the row, so size for that */
+static size_t rle_row(const u8* in, size_t len, u8* out) {
+	u8* start = out;
+	for(size_t i = 0; i < len;) {
+		if(in[i]) {
+			*out++ = in[i++];
+			continue;
+		}
+
+		size_t run = 0;
+		while(i < len && !in[i] && run < 255) {
+			i++;
+			run++;
+		}
+		*out++ = 0;
+		*out++ = (u8)run;
+	}
+	return out - start;
+}
+
+struct q3vis_rle* q3vis_compress(const struct q3vis_data* vis) {
+	if(!vis)
+		return NULL;
+
+	struct q3vis_rle* rle = malloc(sizeof(struct q3vis_rle));
+	rle->n_vectors = vis->n_vectors;
+	rle->sz_vectors = vis->sz_vectors;
+	rle->rows = malloc(sizeof(u32) * (vis->n_vectors + 1));
+
+	/* encode into a worst case sized scratch buffer, then shrink */
+	u8* scratch = malloc((size_t)vis->n_vectors * vis->sz_vectors * 2 + 1);
+	size_t used = 0;
+	for(u32 i = 0; i < vis->n_vectors; i++) {
+		rle->rows[i] = used;
+		used += rle_row(vis->vectors + (size_t)i * vis->sz_vectors, vis->sz_vectors, scratch + used);
+	}
+	rle->rows[vis->n_vectors] = used;
+
+	rle->sz_data = used;
+	rle->data = realloc(scratch, used ? used : 1);
+	return rle;
+}
+
+void q3vis_rle_free(struct q3vis_rle* rle) {
+	if(!rle)
+		return;
+	free(rle->rows);
+	free(rle->data);
+	free(rle);
+}
+
+size_t q3vis_rle_size(const struct q3vis_rle* rle) {
+	return sizeof(*rle) + sizeof(u32) * (rle->n_vectors + 1) + rle->sz_data;
+}
+
+bool q3vis_rle_cluster_visible(const struct q3vis_rle* rle, i32 from, i32 to) {
+	if(!rle || from < 0 || to < 0 || (u32)from >= rle->n_vectors || (u32)to >= rle->sz_vectors * 8)
+		return true;
+
+	const u8* p = rle->data + rle->rows[from];
+	const u8* end = rle->data + rle->rows[from + 1];
+	/* skip whole runs until we land on the byte holding `to` */
+	u32 target = (u32)to >> 3;
+	u32 pos = 0;
+	while(p < end) {
+		if(*p) {
+			if(pos == target)
+				return (*p & (1 << (to & 7))) != 0;
+			pos++;
+			p++;
+		} else {
+			pos += p[1];
+			if(pos > target)
+				return false;
+			p += 2;
+		}
+	}
+	return false;
+}
+
+size_t q3vis_rle_for_each_visible(const struct q3vis_rle* rle, i32 from, void (*fn)(void* user, i32 cluster), void* user) {
+	if(!rle || from < 0 || (u32)from >= rle->n_vectors)
+		return 0;
+
+	const u8* p = rle->data + rle->rows[from];
+	const u8* end = rle->data + rle->rows[from + 1];
+	size_t n = 0;
+	u32 pos = 0;
+	while(p < end) {
+		if(!*p) {
+			pos += p[1];
+			p += 2;
+			continue;
+		}
+
+		/* walk set bits only, lowest first */
+		for(u32 bits = *p; bits; bits &= bits - 1) {
+			i32 cluster = (i32)(pos * 8 + __builtin_ctz(bits));
+			if((u32)cluster >= rle->n_vectors)
+				break;
+			fn(user, cluster);
+			n++;
+		}
+		pos++;
+		p++;
+	}
+	return n;
+}
+
+void q3vis_rle_decompress_row(const struct q3vis_rle* rle, i32 from, u8* out) {
+	if(from < 0 || (u32)from >= rle->n_vectors) {
+		memset(out, 0xff, rle->sz_vectors);
+		return;
+	}
+	const u8* p = rle->data + rle->rows[from];
+	const u8* end = rle->data + rle->rows[from + 1];
+	while(p < end) {
+		if(*p) {
+			*out++ = *p++;
+		} else {
+			memset(out, 0, p[1]);
+			out += p[1];
+			p += 2;
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef Q3_VIS_H_
+#define Q3_VIS_H_
+
+#include <stdbool.h>
+
+#include "q3bsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Compressed copy of the vis lump. Every row is zero-run encoded the way
+	Quake 1/2 stored PVS: a nonzero byte is stored as-is, a zero byte is
+	followed by the number of zero bytes in the run (1-255).
+*/
+struct q3vis_rle {
+	u32 n_vectors;
+	u32 sz_vectors;
+	/* offset of each row into data, n_vectors+1 entries so row lengths fall out */
+	u32* rows;
+	size_t sz_data;
+	u8* data;
+};
+
+/* a negative or out of range cluster (outside the map) or missing vis lump sees everything */
+bool q3vis_cluster_visible(const struct q3vis_data* vis, i32 from, i32 to);
+
+struct q3vis_rle* q3vis_compress(const struct q3vis_data* vis);
+void q3vis_rle_free(struct q3vis_rle* rle);
+
+/* total heap bytes used by the compressed form */
+size_t q3vis_rle_size(const struct q3vis_rle* rle);
+
+bool q3vis_rle_cluster_visible(const struct q3vis_rle* rle, i32 from, i32 to);
+
+/* calls fn for every cluster visible from `from`, returns the number of calls, 0 for a cluster out of range */
+size_t q3vis_rle_for_each_visible(const struct q3vis_rle* rle, i32 from, void (*fn)(void* user, i32 cluster), void* user);
+
+/* expands one row into out, which must hold sz_vectors bytes, all set for a cluster out of range */
+void q3vis_rle_decompress_row(const struct q3vis_rle* rle, i32 from, u8* out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif